@@ -74,8 +74,6 @@ typedef enum {
   UHF_SET_ECHO
 } UHF_Subtype;
 
-SAT_returnState communication_service_app(csp_packet_t* pkt);
-
-SAT_returnState start_communication_service(void);
+SAT_returnState communication_service_handler(csp_conn_t *conn, csp_packet_t *packet);
 
 #endif /* COMMUNICATION_SERVICE_H_ */
@@ -22,12 +22,25 @@
 #ifndef EX2_SERVICES_GENERAL
 #define EX2_SERVICES_GENERAL
 
-SAT_returnState start_general_service(void);
+#include <csp/csp.h>
+
+SAT_returnState general_handler(csp_conn_t *conn, csp_packet_t *packet);
 
 typedef enum {
-  REBOOT = 0
+  REBOOT = 0,
+  GET_METRICS = 1,
+  RESET_METRICS = 2,
+  GET_TASK_CENSUS = 3,
+  GET_BUFFER_STATS = 4,
+  COMMAND_LIST = 5
 } General_Subtype;  // shared with EPS!
 
+// COMMAND_LIST request: flags, step count, then per step the service port,
+// the command length and the command from its subservice byte
+#define COMMAND_LIST_MAX_STEPS 32
+#define COMMAND_STEP_HEADER_LEN 2
+#define COMMAND_LIST_CONTINUE 0x01  // run the remaining steps after a failure
+
 typedef enum {
     bootloader = 'B',
     golden = 'G',
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2021  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file hk_delta.h
+ * @author Dustin Wagner
+ * @date 2021-06-14
+ */
+
+#ifndef HK_DELTA_H
+#define HK_DELTA_H
+
+#include <stdint.h>
+
+/*
+  Delta encoding for housekeeping records
+
+  A record is XORed byte for byte against a reference record (the previous
+  one for a delta, all zeros for a keyframe) so fields that didn't change
+  become runs of zeros. The result is written as a sequence of
+    [varint zero run length][varint literal length][literal bytes]
+  until the whole record is covered. Varints are LEB128, 7 bits per byte,
+  least significant group first.
+*/
+
+/*worst case encoded size of a record of len bytes*/
+#define HK_DELTA_MAX_SIZE(len) ((len) + 6)
+
+uint16_t hk_delta_encode(const uint8_t *prev, const uint8_t *cur, uint16_t len,
+                         uint8_t *out, uint16_t out_max);
+
+uint16_t hk_delta_decode(const uint8_t *prev, const uint8_t *in, uint16_t in_len,
+                         uint8_t *out, uint16_t len);
+
+#endif /* HK_DELTA_H */
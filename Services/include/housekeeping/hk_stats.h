@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2021  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file hk_stats.h
+ * @date 2021-06-21
+ */
+
+#ifndef HK_STATS_H
+#define HK_STATS_H
+
+#include <stdint.h>
+
+#include "housekeeping/housekeeping_service.h"
+
+/*
+  Running statistics of a few scalar housekeeping fields
+
+  Every stored sample is added to the bucket covering its timestamp. A
+  bucket keeps count, min, max, mean and sum of squared deviations (Welford)
+  and how often the field crossed its threshold, so a window is answered by
+  merging whole buckets without reading the ring. Buckets are reused once
+  they fall more than HK_STATS_BUCKETS * HK_STATS_BUCKET_S behind
+*/
+
+#ifndef HK_STATS_BUCKET_S
+#define HK_STATS_BUCKET_S 3600 //window resolution in seconds
+#endif
+#ifndef HK_STATS_BUCKETS
+#define HK_STATS_BUCKETS 24    //history kept. one day by default
+#endif
+
+/*fields with statistics. bit n of a GET_HK_STATS field mask is field n*/
+typedef enum {
+  HK_STAT_EPS_VBATT = 0,        //battery voltage
+  HK_STAT_EPS_CUR_SOLAR = 1,    //total solar current
+  HK_STAT_EPS_CUR_BATT_OUT = 2, //battery discharge current
+  HK_STAT_ATHENA_TEMP_0 = 3,    //first two Athena temperature sensors
+  HK_STAT_ATHENA_TEMP_1 = 4,
+  HK_STAT_SBAND_PA_TEMP = 5,
+  HK_STAT_SBAND_TOP_TEMP = 6,
+  HK_STAT_SBAND_BAT_VOLTAGE = 7,
+  HK_STAT_NUM_FIELDS
+} hk_stat_field;
+
+typedef struct {
+  uint32_t count;     //samples in the window
+  uint32_t crossings; //times consecutive samples were on different sides of the threshold
+  float min;
+  float max;
+  float mean;
+  float stddev;       //population standard deviation
+} hk_field_stats;
+
+//bytes of one field's statistics on the wire: field id then hk_field_stats
+#define HK_STATS_WIRE_SIZE (1 + 2 * sizeof(uint32_t) + 4 * sizeof(float))
+
+void hk_stats_add(const All_systems_housekeeping *hk);
+
+Result hk_stats_get(uint8_t field, uint32_t start, uint32_t end, hk_field_stats *out);
+
+Result hk_stats_set_threshold(uint8_t field, float threshold);
+
+#endif /* HK_STATS_H */
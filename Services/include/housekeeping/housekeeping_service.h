@@ -47,11 +47,6 @@ typedef enum { TM_HK_PARAMETERS_REPORT = 0 } Housekeeping_Subtype;
 
 
 
-typedef enum {
-  FILE_EXISTS = 1,
-  FILE_NOT_EXIST = 0
-} Found_file;
-
 typedef enum {
   SUCCESS = 0,
   FAILURE = 1
@@ -60,18 +55,61 @@ typedef enum {
 typedef enum {
   GET_HK = 0,
   SET_MAX_FILES = 1,
-  GET_MAX_FILES = 2
+  GET_MAX_FILES = 2,
+  GET_HK_BATCH = 3,
+  SET_CACHE_SIZE = 4,
+  GET_CACHE_SIZE = 5,
+  SET_HK_PERIOD = 6,
+  GET_HK_PERIODS = 7,
+  GET_HK_RANGE = 8,
+  GET_HK_STATS = 9,
+  SET_HK_STAT_THRESHOLD = 10,
+  GET_HK_CURSOR = 11
 } subservice;
 
+/*GET_HK_BATCH, GET_HK_RANGE and GET_HK_CURSOR status byte of every packet of a page except the last*/
+#define HK_BATCH_MORE 1
+
+/*GET_HK_CURSOR position of a record. opaque to the ground, which only hands
+  back cursors it was sent. stays valid across connections and reboots*/
+typedef struct __attribute__((packed)) {
+  uint32_t timestamp;   //UNIXtimestamp of the record
+  uint16_t slot;        //slot the record was stored in
+  uint16_t generation;  //low bits of the ring generation it was stored in
+} hk_cursor;
+
+#define HK_CURSOR_MAX_RANGES 8 //ranges one GET_HK_CURSOR request may ask for
+
+/*GET_HK_BATCH record encodings*/
+typedef enum {
+  HK_ENCODING_RAW = 0,   //records as in GET_HK
+  HK_ENCODING_DELTA = 1  //keyframe then deltas, see hk_delta.h
+} hk_encoding;
+
 /*hk data sample*/
 typedef enum { EPS, ADCS, OBC, COMMS } hardware;
 
 /*--------------hk data----------------*/
 
+/*sources of housekeeping. bit n of hk_time_and_order.valid is source n*/
+typedef enum {
+  HK_ATHENA = 0,
+  HK_EPS = 1,
+  HK_UHF = 2,
+  HK_SBAND = 3,
+  //TODO:
+  //HK_ADCS,
+  HK_NUM_SOURCES
+} hk_source;
+
+#define HK_ALL_SOURCES_VALID ((1 << HK_NUM_SOURCES) - 1)
+
 typedef struct __attribute__((packed)){
   /*placeholder timestamp structure. Not sure if we use UNIX time*/
   uint32_t UNIXtimestamp;              //Note when this data was collected
   uint16_t dataPosition;                  //Use to place datasets in chronological order
+  uint8_t valid;                       //bit per hk_source that answered in time without error
+  uint8_t sampled;                     //bit per hk_source polled for this record. others are carried over
 } hk_time_and_order;
 
 typedef struct {
@@ -86,13 +124,20 @@ typedef struct {
 } All_systems_housekeeping;
 
 SAT_returnState start_housekeeping_service(void);
+SAT_returnState hk_service_app(csp_conn_t *conn, csp_packet_t *packet);
 
 /*This function called every interval to collect data periodically*/
 Result populate_and_store_hk_data(void);
 
 uint16_t get_file_id_from_timestamp(uint32_t timestamp);
+Result fetch_hk_range_and_transmit(csp_conn_t *conn, uint32_t start, uint32_t end, uint32_t stride_s,
+                                   uint8_t fields, uint16_t limit, uint16_t max_size);
+Result fetch_hk_cursor_and_transmit(csp_conn_t *conn, const hk_cursor *cursors, const uint16_t *limits,
+                                    uint8_t ranges);
 Result load_historic_hk_data(uint16_t file_num, All_systems_housekeeping* all_hk_data);
 Result set_max_files(uint16_t new_max);
+Result set_cache_size(uint16_t new_size);
+Result set_hk_period(uint8_t source, uint32_t period_s);
 
 
 
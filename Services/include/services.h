@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <csp/csp.h>
 
 #include "subsystems_ids.h"
 #include "main/system.h"
@@ -30,6 +31,17 @@
 #define IN_DATA_BYTE 1
 #define OUT_DATA_BYTE 2
 
+/* PIPELINING */
+// a subservice byte with SUBSERVICE_TAGGED set is followed by a request id
+// the ground picks, and every reply to it starts with the same two bytes.
+// the worker strips them before the handler runs and service_send puts them
+// back, so handlers only ever see the layout above. several tagged requests
+// may be in flight on one connection and the ground matches replies by id.
+// tagged requests are always answered, failures with status -1
+#define SUBSERVICE_TAGGED 0x80
+#define REQUEST_ID_BYTE 1
+#define REQUEST_TAG_LEN 1  // bytes a tag adds to a request or reply
+
 /* SERVICES */
 #define MAX_APP_ID 32     // number of CSP nodes (5-bits)
 #define MAX_SERVICES 64   // number of CSP ports (6-bits)
@@ -38,9 +50,57 @@
 
 #define NORMAL_TICKS_TO_WAIT 1
 #define SERVICE_QUEUE_LEN 3
-#define RESPONSE_QUEUE_LEN 3
+#define RESPONSE_QUEUE_LEN 8
 #define CSP_PKT_QUEUE_SIZE sizeof(csp_packet_t*)
 
+/* RESPONSE SERVER */
+// open RDP connections are kept per (dst, dport) and reused for later
+// responses until unused for RESPONSE_CONN_IDLE_MS. libcsp drops an RDP
+// connection with no traffic for its conn_timeout and may then hand the
+// same csp_conn_t to someone else, so a cached one must be closed well
+// before that. the cache is swept every half RESPONSE_CONN_IDLE_MS
+#define RESPONSE_CONN_CACHE_LEN 4
+#define RESPONSE_RDP_CONN_TIMEOUT_MS 10000 // libcsp's default rdp conn_timeout
+#define RESPONSE_CONN_IDLE_MS 5000
+#define RESPONSE_CONNECT_TIMEOUT_MS 1000
+#define RESPONSE_SEND_TIMEOUT_MS 1000
+
+/* SERVICE WORKERS */
+// every service port is accepted by one dispatcher and handled by a fixed
+// pool of workers, so service stack use is SERVICE_WORKER_COUNT stacks.
+// the first SERVICE_CONTROL_WORKERS only serve SERVICE_CLASS_CONTROL ports
+#define SERVICE_WORKER_COUNT 3
+#define SERVICE_CONTROL_WORKERS 1
+#define SERVICE_WORKER_STACK 1024  // words. deepest handler is communication
+#define SERVICE_CONN_QUEUE_LEN 4
+#define SERVICE_ENQUEUE_TIMEOUT_MS 100  // before a non control connection is refused
+#define CSP_CONN_QUEUE_SIZE sizeof(csp_conn_t*)
+// bytes of scratch storage each worker lends to the handler it is running,
+// see service_scratch. must hold the largest device struct of a subservice,
+// and GET_HK_BATCH's two hk records and offset table
+#ifndef SERVICE_SCRATCH_SIZE
+#define SERVICE_SCRATCH_SIZE 1024
+#endif
+
+/* TRAFFIC CLASSES */
+// commands are queued apart from everything else and served by their own
+// worker above the others. bulk subservices run below the other services,
+// send at low CSP priority and pause every SERVICE_BULK_SLICE packets, for
+// as long as commands are waiting, so a downlink never delays a command by
+// more than SERVICE_BULK_SLICE packets on the link
+typedef enum {
+  SERVICE_CLASS_INTERACTIVE = 0,  // queries answered in a packet or two
+  SERVICE_CLASS_CONTROL = 1,      // commands. short and urgent
+  SERVICE_CLASS_BULK = 2,         // downlinks of many packets
+  SERVICE_NUM_CLASSES
+} service_class;
+
+#define CONTROL_SERVICE_PRIO (NORMAL_SERVICE_PRIO + 1)
+#define BULK_SERVICE_PRIO (NORMAL_SERVICE_PRIO - 1)  // must stay above idle
+#define SERVICE_BULK_SLICE 4
+#define SERVICE_BULK_PAUSE_MS 20
+#define SERVICE_BULK_MAX_PAUSE_MS 2000  // longest a downlink waits for commands
+
 /* SERVICE SOCKETS */
 // HOUSEKEEPING SERVICE
 #define TC_HOUSEKEEPING_SERVICE 9
@@ -70,6 +130,48 @@ union _cnv {
   uint8_t cnv8[8];
 };
 
+/* handles one packet read from a service connection. always consumes packet */
+typedef SAT_returnState (*service_handler_t)(csp_conn_t *conn, csp_packet_t *packet);
+
+/* SUBSERVICE TABLES */
+// every service describes its subservices in a static const table indexed by
+// subtype, and dispatch_subservice validates and runs them in one place.
+// subtypes must stay below SUBSERVICE_TAGGED
+#define SUBSERVICE_SENDS 0x01  // handler sends or frees the packet itself
+#define SUBSERVICE_BULK 0x02   // runs as SERVICE_CLASS_BULK, see TRAFFIC CLASSES
+#define SUBSERVICE_NO_STEP 0x04  // refused as a command list step, as BULK entries are
+
+// nodes allowed to run PRIV_GROUND subservices
+#ifndef SERVICE_PRIVILEGED_SRC
+#define SERVICE_PRIVILEGED_SRC GND_APP_ID
+#endif
+
+#define FIELD_SIZE(type, member) sizeof(((type *)0)->member)
+#define TABLE_LEN(table) (sizeof(table) / sizeof((table)[0]))
+
+typedef enum {
+  PRIV_ANY = 0,    // any node
+  PRIV_GROUND = 1  // only SERVICE_PRIVILEGED_SRC
+} service_privilege;
+
+typedef struct {
+  // runs the subservice. reply is built in place in packet, which is then
+  // sent unless it returns an error or the entry is SUBSERVICE_SENDS
+  SAT_returnState (*handler)(csp_conn_t *conn, csp_packet_t *packet);
+  uint16_t min_in_len;   // bytes of arguments from IN_DATA_BYTE
+  uint16_t max_out_len;  // bytes of reply data from OUT_DATA_BYTE
+  uint8_t privilege;     // service_privilege
+  uint8_t flags;         // SUBSERVICE_*
+} subservice_entry;
+
+void *service_scratch(void);
+int service_send(csp_conn_t *conn, csp_packet_t *packet, uint32_t timeout);
+uint16_t service_reply_room(void);
+uint8_t service_current_class(void);
+int8_t service_run_step(csp_conn_t *conn, csp_id_t id, uint8_t port,
+                        const uint8_t *command, uint16_t len);
+SAT_returnState dispatch_subservice(const subservice_entry *table, uint16_t table_len,
+                                    csp_conn_t *conn, csp_packet_t *packet);
 
 SAT_returnState start_service_server(void);
 
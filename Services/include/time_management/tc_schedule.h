@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2021  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file tc_schedule.h
+ * @date 2021-06-30
+ */
+
+#ifndef TC_SCHEDULE_H
+#define TC_SCHEDULE_H
+
+#include <stdint.h>
+#include <csp/csp.h>
+
+#include "services.h"
+
+/*
+  Time-tagged commands
+
+  Commands uplinked ahead of time are kept in a min-heap on their execution
+  time and mirrored to TC_SCHEDULE_FILE, so they survive a reboot. One task
+  sleeps until the earliest is due and runs it through service_run_step, so
+  it is checked and run exactly as if it had arrived on its own port, with
+  the privileges of the node that scheduled it. Commands due at the same
+  second run in the order they were scheduled. A command found more than
+  TC_SCHEDULE_MAX_LATE_S late, say after a long reset, is dropped instead
+*/
+
+#ifndef TC_SCHEDULE_LEN
+#define TC_SCHEDULE_LEN 64          //commands that can be waiting
+#endif
+#define TC_SCHEDULE_CMD_LEN 32      //longest command, from its subservice byte
+#ifndef TC_SCHEDULE_FILE
+#define TC_SCHEDULE_FILE "TCSCHED.DAT" //path may need to be changed
+#endif
+#define TC_SCHEDULE_MAX_LATE_S 300
+#define TC_SCHEDULE_MAX_SLEEP_MS 60000 //the RTC may be set while we sleep
+#define TC_SCHEDULE_STACK SERVICE_WORKER_STACK //runs the same handlers
+#define TC_SCHEDULE_ALL 0xFFFF      //SCHEDULE_DELETE id clearing every command
+#define TC_SCHEDULE_PAGE_LEN 8      //commands per SCHEDULE_LIST reply, built in service_scratch
+
+typedef struct __attribute__((packed)) {
+  uint32_t execute_at;  //unix time
+  uint16_t id;          //given when scheduled, never 0 or TC_SCHEDULE_ALL
+  uint8_t src;          //node that scheduled it
+  uint8_t port;         //service port the command is for
+  uint8_t len;          //bytes of command
+  uint8_t command[TC_SCHEDULE_CMD_LEN];
+} tc_schedule_entry;
+
+typedef struct {
+  uint16_t count;       //commands waiting
+  uint32_t next_at;     //when the earliest is due. 0 if none
+  uint32_t executed;    //commands run since boot
+  uint32_t failed;      //of those, ones whose status wasn't 0
+  uint32_t dropped;     //commands found too late to run
+} tc_schedule_status;
+
+//bytes of one SCHEDULE_LIST entry: id, execute_at, port, subtype
+#define TC_SCHEDULE_WIRE_ENTRY (sizeof(uint16_t) + sizeof(uint32_t) + 2)
+
+SAT_returnState start_tc_schedule(void);
+
+SAT_returnState tc_schedule_add(uint32_t execute_at, uint8_t src, uint8_t port,
+                                const uint8_t *command, uint8_t len, uint16_t *id);
+
+SAT_returnState tc_schedule_delete(uint16_t id);
+
+uint8_t tc_schedule_list(uint32_t after_at, uint16_t after_id, tc_schedule_entry *out,
+                         uint8_t max);
+
+void tc_schedule_get_status(tc_schedule_status *out);
+
+#endif /* TC_SCHEDULE_H */
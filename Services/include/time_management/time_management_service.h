@@ -24,9 +24,20 @@
 
 typedef enum {
   GET_TIME = 0,
-  SET_TIME = 1
+  SET_TIME = 1,
+  SCHEDULE_ADD = 2,
+  SCHEDULE_DELETE = 3,
+  SCHEDULE_LIST = 4,
+  SCHEDULE_STATUS = 5,
+  GET_TIME_US = 6
 } Time_Management_Subtype;  // shared with EPS!
 
 SAT_returnState start_time_management_service(void);
+SAT_returnState time_management_handler(csp_conn_t *conn, csp_packet_t *packet);
+
+uint64_t get_time_us(void);
+void time_management_clock_state(uint32_t *fix_age, int32_t *drift);
+void time_management_gps_fix(void);
+void time_management_pps_from_isr(void);
 
 #endif /* TIME_MANAGEMENT_H */
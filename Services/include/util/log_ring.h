@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file log_ring.h
+ * @date 2020-10-14
+ */
+
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#include "services.h"
+
+/* Deferred logging. ex2_log only copies the format pointer, the tick and
+   the arguments into a ring slot; the log drain task formats and prints
+   them later at low priority */
+
+#define EX2_LOG_RING_LEN 32   // slots, a power of 2
+#define EX2_LOG_PAYLOAD 48    // bytes of arguments per record. %s strings are copied here
+#define EX2_LOG_DRAIN_MS 20   // how often the drain task looks at the ring
+#define EX2_LOG_DRAIN_STACK 300
+#define EX2_LOG_RATE_PER_S 20  // records accepted per second once the burst is used up
+#define EX2_LOG_BURST 16
+
+typedef enum {
+  EX2_LOG_DEBUG = 0,
+  EX2_LOG_INFO = 1,
+  EX2_LOG_WARN = 2,
+  EX2_LOG_ERROR = 3
+} ex2_log_level;
+
+void ex2_log_at(ex2_log_level level, const char *format, ...);
+
+void ex2_log_record(ex2_log_level level, const char *format, va_list args);
+
+void ex2_log_set_level(ex2_log_level level);
+
+SAT_returnState start_log_drain(void);
+
+#endif /* LOG_RING_H */
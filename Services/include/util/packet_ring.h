@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file packet_ring.h
+ * @date 2020-10-14
+ */
+
+#ifndef PACKET_RING_H
+#define PACKET_RING_H
+
+#include <csp/csp.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Lock free single producer, single consumer ring of packet pointers.
+   Lets an interface's receive side (an ISR or a thread outside the
+   scheduler) hand packets to a task without a queue or a lock. Exactly one
+   context may push and exactly one other may pop */
+
+// orders the slot access against the index update between the two sides
+#ifndef PACKET_RING_BARRIER
+#define PACKET_RING_BARRIER() __sync_synchronize()
+#endif
+
+typedef struct {
+  csp_packet_t **slots;
+  uint16_t size;           // a power of 2
+  volatile uint16_t head;  // only written by the producer
+  volatile uint16_t tail;  // only written by the consumer
+} packet_ring_t;
+
+/**
+ * @brief
+ *      Make an empty ring over caller owned storage
+ * @param slots
+ *      Storage for size packet pointers
+ * @param size
+ *      Number of slots. Must be a power of 2, at most 32768
+ */
+static inline void packet_ring_init(packet_ring_t *ring, csp_packet_t **slots, uint16_t size) {
+  ring->slots = slots;
+  ring->size = size;
+  ring->head = 0;
+  ring->tail = 0;
+}
+
+/**
+ * @brief
+ *      Number of packets in the ring. Exact for either side's own use
+ */
+static inline uint16_t packet_ring_count(const packet_ring_t *ring) {
+  return (uint16_t)(ring->head - ring->tail);
+}
+
+/**
+ * @brief
+ *      Add a packet. Producer side only
+ * @return bool
+ *      false if the ring is full and the packet was not added
+ */
+static inline bool packet_ring_push(packet_ring_t *ring, csp_packet_t *packet) {
+  uint16_t head = ring->head;
+  if ((uint16_t)(head - ring->tail) == ring->size) {
+    return false;
+  }
+  ring->slots[head & (ring->size - 1)] = packet;
+  PACKET_RING_BARRIER();
+  ring->head = head + 1;
+  return true;
+}
+
+/**
+ * @brief
+ *      Take the oldest packet. Consumer side only
+ * @return csp_packet_t *
+ *      The packet, NULL if the ring is empty
+ */
+static inline csp_packet_t *packet_ring_pop(packet_ring_t *ring) {
+  uint16_t tail = ring->tail;
+  if (tail == ring->head) {
+    return NULL;
+  }
+  PACKET_RING_BARRIER();
+  csp_packet_t *packet = ring->slots[tail & (ring->size - 1)];
+  PACKET_RING_BARRIER();
+  ring->tail = tail + 1;
+  return packet;
+}
+
+#endif /* PACKET_RING_H */
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file service_buffers.h
+ * @date 2021-06-28
+ */
+
+#ifndef SERVICE_BUFFERS_H
+#define SERVICE_BUFFERS_H
+
+#include <csp/csp.h>
+#include <stdint.h>
+
+#include "services.h"
+
+/* Buffers services allocate for replies
+
+   CSP has a single pool of same size buffers, shared with the interfaces
+   receiving commands. Services take their buffers through
+   service_buffer_get so a downlink can't empty it: each traffic class has
+   to leave the buffers reserved for the classes above it, so bulk stops
+   short of SERVICE_BUF_RESERVE_INTERACTIVE + SERVICE_BUF_RESERVE_CONTROL
+   free buffers and interactive short of SERVICE_BUF_RESERVE_CONTROL. A
+   refused bulk request waits for the link to drain the pool a while before
+   giving up, so bursts slow down instead of failing.
+
+   Requests are counted by the tier their size falls in, with the pool's
+   low-water mark as seen by services, for GET_BUFFER_STATS */
+
+#define SERVICE_BUF_SMALL_SIZE (OUT_DATA_BYTE + 8)  // status and a few words
+#define SERVICE_BUF_MEDIUM_SIZE 64                  // settings and config replies
+// free CSP buffers only a class of at least this priority may take
+#define SERVICE_BUF_RESERVE_CONTROL 2
+#define SERVICE_BUF_RESERVE_INTERACTIVE 2
+#define SERVICE_BUF_BULK_WAIT_MS 200  // longest bulk waits for a buffer
+
+typedef enum {
+  SERVICE_BUF_SMALL = 0,
+  SERVICE_BUF_MEDIUM = 1,
+  SERVICE_BUF_LARGE = 2,  // housekeeping records and batches, up to csp_buffer_data_size
+  SERVICE_BUF_TIERS
+} service_buffer_tier;
+
+typedef struct {
+  uint32_t gets;
+  uint32_t failures;  // refused to keep a reserve, the pool was empty or too large
+} service_buffer_tier_stats;
+
+typedef struct {
+  uint16_t pool;      // CSP buffers free when the services started
+  uint16_t free_now;
+  uint16_t free_min;  // fewest free seen by a service request
+  service_buffer_tier_stats tiers[SERVICE_BUF_TIERS];
+} service_buffer_stats;
+
+// bytes of service_buffer_stats on the wire
+#define SERVICE_BUF_STATS_WIRE_SIZE (3 * sizeof(uint16_t) + SERVICE_BUF_TIERS * 2 * sizeof(uint32_t))
+
+SAT_returnState service_buffers_init(void);
+
+csp_packet_t *service_buffer_get(uint16_t size);
+
+void service_buffer_stats_get(service_buffer_stats *out);
+
+#endif /* SERVICE_BUFFERS_H */
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file service_metrics.h
+ * @date 2020-10-14
+ */
+
+#ifndef SERVICE_METRICS_H
+#define SERVICE_METRICS_H
+
+#include <FreeRTOS.h>
+#include <stdint.h>
+
+#include "services.h"
+
+// latency bucket 0 counts 0 ticks, bucket i counts [2^(i-1), 2^i) ticks and
+// the last bucket everything from 2^(METRICS_LATENCY_BUCKETS-2) ticks up
+#define METRICS_LATENCY_BUCKETS 10
+// counters are kept for this many services and subservices together
+#define METRICS_SLOTS 48
+
+typedef enum {
+  METRICS_SERVICE = 0,    // every packet of a port
+  METRICS_SUBSERVICE = 1  // packets of one subtype of a port
+} metrics_scope;
+
+typedef enum {
+  METRIC_ALLOC_FAILURE,
+  METRIC_SEND_FAILURE
+} metrics_event;
+
+typedef struct {
+  uint32_t requests;
+  uint32_t errors;              // handler didn't return SATR_OK
+  uint32_t illegal_subservice;  // handler returned SATR_PKT_ILLEGAL_SUBSERVICE
+  uint32_t alloc_failures;
+  uint32_t send_failures;
+  uint32_t latency[METRICS_LATENCY_BUCKETS];  // handler time histogram
+} service_metrics;
+
+// number of uint32_t in a service_metrics, as sent to the ground
+#define METRICS_WIRE_WORDS (sizeof(service_metrics) / sizeof(uint32_t))
+
+void metrics_record_request(metrics_scope scope, uint8_t port, uint8_t subtype,
+                            SAT_returnState state, TickType_t ticks);
+
+void metrics_record_event(uint8_t port, uint8_t subtype, metrics_event event);
+
+SAT_returnState metrics_get(metrics_scope scope, uint8_t port, uint8_t subtype,
+                            service_metrics *out);
+
+void metrics_reset(void);
+
+#endif /* SERVICE_METRICS_H */
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file task_census.h
+ * @date 2020-10-14
+ */
+
+#ifndef TASK_CENSUS_H
+#define TASK_CENSUS_H
+
+#include <FreeRTOS.h>
+#include <os_task.h>
+#include <stdint.h>
+
+#include "services.h"
+
+/* Stack and heap census of the service tasks. Tasks created with
+   census_task_create are remembered so their stack high-water marks
+   can be reported over TC_GENERAL_SERVICE and, if CENSUS_LOG_PERIOD_S is
+   set, logged periodically */
+
+#define CENSUS_MAX_TASKS 16
+#define CENSUS_NAME_LEN 12  // bytes of task name sent to the ground
+#define CENSUS_PAGE_LEN 8   // tasks per GET_TASK_CENSUS reply
+#ifndef CENSUS_LOG_PERIOD_S
+#define CENSUS_LOG_PERIOD_S 0  // 0 to not log the census
+#endif
+#define CENSUS_TASK_STACK 200
+
+typedef struct {
+  const char *name;
+  uint16_t stack_depth;  // words the task was created with
+  uint16_t stack_free;   // fewest words ever left unused
+} census_entry;
+
+BaseType_t census_task_create(TaskFunction_t code, const char *name, uint16_t stack_depth,
+                              void *parameters, UBaseType_t priority, TaskHandle_t *handle);
+
+void census_task_delete_self(void);
+
+uint8_t census_task_count(void);
+
+SAT_returnState census_sample_task(uint8_t index, census_entry *out);
+
+void census_heap(uint32_t *free_now, uint32_t *free_min);
+
+SAT_returnState start_task_census(void);
+
+#endif /* TASK_CENSUS_H */
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file wire_endian.h
+ * @date 2021-06-24
+ */
+
+#ifndef WIRE_ENDIAN_H
+#define WIRE_ENDIAN_H
+
+#include <main/system.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "subsystems_ids.h"
+
+/* Byte order conversion generated from a description of each struct.
+
+   A struct is described once by an X-macro listing every member with the
+   kind of its elements: 8, 16, 32 or 64 for integers and floats of that
+   width, or the name of another described struct. Arrays are listed like
+   any other member.
+
+     #define SBAND_HK_WIRE(X) X(Output_Power, 32) X(PA_Temp, 32) ...
+     WIRE_DEFINE_SWAP(sband_hk, Sband_Housekeeping, SBAND_HK_WIRE)
+
+   defines wire_swap_sband_hk(void *, size_t bytes), which converts one or
+   more Sband_Housekeeping between host and network order in place, used as
+   WIRE_SWAP(sband_hk, &hk). Swapping is its own inverse, so the same
+   function serves hton and ntoh. Floats and doubles are swapped as their
+   bit patterns, as csp_htonflt and csp_htondbl do. 8 bit members are listed
+   so the description stays complete but generate nothing.
+
+   On big endian targets every swap is empty and the converters compile to
+   no code. On little endian targets each element is one load, bswap and
+   store, done through memcpy so members of packed structs are safe */
+
+#if (SYSTEM_ENDIANESS == SYS_LITTLE_ENDIAN)
+#define WIRE_NEEDS_SWAP 1
+#else
+#define WIRE_NEEDS_SWAP 0
+#endif
+
+static inline void wire_swap_8(void *field, size_t size) {
+  (void)field;
+  (void)size;
+}
+
+static inline void wire_swap_16(void *field, size_t size) {
+#if WIRE_NEEDS_SWAP
+  uint8_t *p = field;
+  uint8_t *end = p + size;
+  for (; p < end; p += sizeof(uint16_t)) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    v = __builtin_bswap16(v);
+    memcpy(p, &v, sizeof(v));
+  }
+#else
+  (void)field;
+  (void)size;
+#endif
+}
+
+static inline void wire_swap_32(void *field, size_t size) {
+#if WIRE_NEEDS_SWAP
+  uint8_t *p = field;
+  uint8_t *end = p + size;
+  for (; p < end; p += sizeof(uint32_t)) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    v = __builtin_bswap32(v);
+    memcpy(p, &v, sizeof(v));
+  }
+#else
+  (void)field;
+  (void)size;
+#endif
+}
+
+static inline void wire_swap_64(void *field, size_t size) {
+#if WIRE_NEEDS_SWAP
+  uint8_t *p = field;
+  uint8_t *end = p + size;
+  for (; p < end; p += sizeof(uint64_t)) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    v = __builtin_bswap64(v);
+    memcpy(p, &v, sizeof(v));
+  }
+#else
+  (void)field;
+  (void)size;
+#endif
+}
+
+// one member of a description
+#define WIRE_SWAP_MEMBER(member, kind) wire_swap_##kind(&wire_s->member, sizeof(wire_s->member));
+
+#define WIRE_DEFINE_SWAP(name, type, LIST)                           \
+  static inline void wire_swap_##name(void *field, size_t size) {   \
+    type *wire_s = field;                                            \
+    type *wire_end = wire_s + size / sizeof(type);                   \
+    for (; wire_s < wire_end; wire_s++) {                            \
+      LIST(WIRE_SWAP_MEMBER)                                         \
+    }                                                                \
+  }
+
+// convert *ptr, a struct described as name, in place
+#define WIRE_SWAP(name, ptr) wire_swap_##name((ptr), sizeof(*(ptr)))
+
+#endif /* WIRE_ENDIAN_H */
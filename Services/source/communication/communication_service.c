@@ -23,11 +23,14 @@
 #include <csp/csp.h>
 #include <csp/csp_endian.h>
 #include <main/system.h>
+#include <os_task.h>
+#include <string.h>
 
 #include "sband.h"
 #include "services.h"
 #include "uhf.h"
 #include "util/service_utilities.h"
+#include "util/wire_endian.h"
 //#include "uTransceiver.h" //* Uncomment after EH integration
 
 #define CHAR_LEN 4  // Numpy unicode string character length
@@ -37,729 +40,679 @@
       // Update this to 108 (MIDI) and 97 (Beacon msg) when packet configuration
       // is changed.
 #define FRAM_SIZE 16
+
+// how old a full status snapshot may be if the request doesn't say
+#define COMMS_STATUS_MAX_AGE_MS 1000
 #define SID_byte 1
 
-SAT_returnState communication_service_app(csp_packet_t *packet);
+/**
+ * @brief
+ *      Put the status and reply length of a subservice in the packet
+ * @param packet
+ *      The request, reused for the reply
+ * @param status
+ *      Status of the HAL functions
+ * @param len
+ *      Bytes of reply data already at OUT_DATA_BYTE. Checked against the
+ *      subservice's max_out_len by dispatch_subservice
+ */
+static void set_status(csp_packet_t *packet, int8_t status, uint16_t len) {
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + len + 1);  // +1 for subservice
+}
+
+/**
+ * @brief
+ *      Put the status and reply data of a subservice in the packet
+ * @param packet
+ *      The request, reused for the reply
+ * @param status
+ *      Status of the HAL functions
+ * @param data
+ *      Network order reply data. May be NULL if len is 0
+ * @param len
+ *      Bytes of data
+ */
+static void set_reply(csp_packet_t *packet, int8_t status, const void *data, uint16_t len) {
+  if (len > 0) {
+    memcpy(&packet->data[OUT_DATA_BYTE], data, len);
+  }
+  set_status(packet, status, len);
+}
+
+/* storage for the device structs of one subservice. handlers take it from
+   the worker's scratch arena instead of the heap or their own stack */
+typedef union {
+  Sband_config S_config;
+  Sband_Full_Status S_FS;  // FS: Full Status
+  UHF_Status U_stat;
+  UHF_Beacon U_beacon;
+  UHF_framStruct U_FRAM;
+  UHF_Call_Sign U_callsign;
+} comms_scratch_t;
+
+// fails to compile if the largest struct outgrows SERVICE_SCRATCH_SIZE
+typedef char comms_scratch_fits[(sizeof(comms_scratch_t) <= SERVICE_SCRATCH_SIZE) ? 1 : -1];
+
+static comms_scratch_t *comms_scratch(void) { return (comms_scratch_t *)service_scratch(); }
+
+/* wire layout of the device structs, see wire_endian.h */
+#define SBAND_PA_WIRE(X) X(status, 8) X(mode, 8)
+#define SBAND_ENCODER_WIRE(X) X(scrambler, 8) X(filter, 8) X(modulation, 8) X(rate, 8)
+#define SBAND_CONFIG_WIRE(X) X(freq, 32) X(PA_Power, 8) X(PA, sband_pa) X(enc, sband_encoder)
+#define SBAND_STATUS_WIRE(X) X(PWRGD, 8) X(TXL, 8)
+#define SBAND_TR_WIRE(X) X(transmit, 8)
+#define SBAND_HK_WIRE(X)                                                         \
+  X(Output_Power, 32) X(PA_Temp, 32) X(Top_Temp, 32) X(Bottom_Temp, 32)          \
+  X(Bat_Current, 32) X(Bat_Voltage, 32) X(PA_Current, 32) X(PA_Voltage, 32)
+#define SBAND_BUFFER_WIRE(X) X(pointer, 16)
+#define SBAND_FULL_STATUS_WIRE(X)                                                \
+  X(status, sband_status) X(transmit, sband_tr) X(HK, sband_hk)                  \
+  X(buffer, sband_buffer) X(Firmware_Version, 32)
+#define UHF_SETTINGS_WIRE(X) X(freq, 32) X(pipe_t, 32) X(beacon_t, 32) X(audio_t, 32)
+#define UHF_STATUS_WIRE(X)                                                       \
+  X(scw, 8) X(set, uhf_settings) X(uptime, 32) X(pckts_out, 32) X(pckts_in, 32)  \
+  X(pckts_in_crc16, 32) X(temperature, 32) X(low_pwr_stat, 8)                    \
+  X(payload_size, 16) X(secure_key, 32)
+
+WIRE_DEFINE_SWAP(sband_pa, Sband_PowerAmplifier, SBAND_PA_WIRE)
+WIRE_DEFINE_SWAP(sband_encoder, Sband_Encoder, SBAND_ENCODER_WIRE)
+WIRE_DEFINE_SWAP(sband_config, Sband_config, SBAND_CONFIG_WIRE)
+WIRE_DEFINE_SWAP(sband_status, Sband_Status, SBAND_STATUS_WIRE)
+WIRE_DEFINE_SWAP(sband_tr, Sband_TR, SBAND_TR_WIRE)
+WIRE_DEFINE_SWAP(sband_hk, Sband_Housekeeping, SBAND_HK_WIRE)
+WIRE_DEFINE_SWAP(sband_buffer, Sband_Buffer, SBAND_BUFFER_WIRE)
+WIRE_DEFINE_SWAP(sband_full_status, Sband_Full_Status, SBAND_FULL_STATUS_WIRE)
+WIRE_DEFINE_SWAP(uhf_settings, UHF_Settings, UHF_SETTINGS_WIRE)
+WIRE_DEFINE_SWAP(uhf_status, UHF_Status, UHF_STATUS_WIRE)
+
+/* last full status read from each radio, in host order. status polls accept
+   a snapshot up to a max age old so repeated polls skip the bus. every
+   ground command bumps status_generation once it has run, and a read is only
+   stored if no command completed while it was on the bus */
+typedef struct {
+  TickType_t taken;     // tick the radio was read
+  uint32_t generation;  // status_generation when the read started
+  uint8_t valid;
+} status_snapshot;
+
+static Sband_Full_Status sband_snapshot;
+static status_snapshot sband_snapshot_info;
+static UHF_Status uhf_snapshot;
+static status_snapshot uhf_snapshot_info;
+static volatile uint32_t status_generation;
 
 /**
  * @brief
- *      FreeRTOS communication server task
+ *      Copy a snapshot if it is recent enough
+ * @param max_age_ms
+ *      Oldest snapshot accepted. 0 never accepts one
+ * @return int
+ *      1 if out now holds the snapshot, 0 if the radio must be read
+ */
+static int snapshot_get(const status_snapshot *info, const void *snapshot, void *out, size_t size,
+                        uint16_t max_age_ms) {
+  int hit = 0;
+  taskENTER_CRITICAL();
+  if (max_age_ms > 0 && info->valid && info->generation == status_generation &&
+      xTaskGetTickCount() - info->taken <= pdMS_TO_TICKS(max_age_ms)) {
+    memcpy(out, snapshot, size);
+    hit = 1;
+  }
+  taskEXIT_CRITICAL();
+  return hit;
+}
+
+/**
+ * @brief
+ *      Keep a fresh read for later polls
+ * @param generation
+ *      status_generation from before the read started
+ */
+static void snapshot_put(status_snapshot *info, void *snapshot, const void *in, size_t size,
+                         uint32_t generation) {
+  taskENTER_CRITICAL();
+  if (generation == status_generation) {
+    memcpy(snapshot, in, size);
+    info->taken = xTaskGetTickCount();
+    info->generation = generation;
+    info->valid = 1;
+  }
+  taskEXIT_CRITICAL();
+}
+
+// optional network order uint16 max age in ms following the subservice
+static uint16_t status_max_age(const csp_packet_t *packet) {
+  uint16_t max_age_ms = COMMS_STATUS_MAX_AGE_MS;
+  if (packet->length >= IN_DATA_BYTE + sizeof(max_age_ms)) {
+    memcpy(&max_age_ms, &packet->data[IN_DATA_BYTE], sizeof(max_age_ms));
+    max_age_ms = csp_ntoh16(max_age_ms);
+  }
+  return max_age_ms;
+}
+
+/* S-band subservices */
+static SAT_returnState s_get_freq(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_config *S_config = &comms_scratch()->S_config;
+  // Step 1: get the data
+  int8_t status = HAL_S_getFreq(&S_config->freq);
+  // Step 2: convert to network order
+  S_config->freq = csp_htonflt(S_config->freq);
+  // step 3: copy data & status byte into packet
+  set_reply(packet, status, &S_config->freq, sizeof(S_config->freq));
+  return SATR_OK;
+}
+
+static SAT_returnState s_get_control(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_config *S_config = &comms_scratch()->S_config;
+  int8_t status = HAL_S_getControl(&S_config->PA);
+  WIRE_SWAP(sband_pa, &S_config->PA);
+  set_reply(packet, status, &S_config->PA, sizeof(S_config->PA));
+  return SATR_OK;
+}
+
+static SAT_returnState s_get_encoder(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_config *S_config = &comms_scratch()->S_config;
+  int8_t status = HAL_S_getEncoder(&S_config->enc);
+  WIRE_SWAP(sband_encoder, &S_config->enc);
+  set_reply(packet, status, &S_config->enc, sizeof(S_config->enc));
+  return SATR_OK;
+}
+
+static SAT_returnState s_get_pa_power(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_config *S_config = &comms_scratch()->S_config;
+  int8_t status = HAL_S_getPAPower(&S_config->PA_Power);
+  set_reply(packet, status, &S_config->PA_Power, sizeof(S_config->PA_Power));
+  return SATR_OK;
+}
+
+static SAT_returnState s_get_config(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_config *S_config = &comms_scratch()->S_config;
+  int8_t status = HAL_S_getFreq(&S_config->freq) +
+                  HAL_S_getPAPower(&S_config->PA_Power) +
+                  HAL_S_getControl(&S_config->PA) +
+                  HAL_S_getEncoder(&S_config->enc);
+  WIRE_SWAP(sband_config, S_config);
+  set_reply(packet, status, S_config, sizeof(*S_config));
+  return SATR_OK;
+}
+
+static SAT_returnState s_get_status(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_Full_Status *S_FS = &comms_scratch()->S_FS;
+  int8_t status = HAL_S_getStatus(&S_FS->status);
+  WIRE_SWAP(sband_status, &S_FS->status);
+  set_reply(packet, status, &S_FS->status, sizeof(S_FS->status));
+  return SATR_OK;
+}
+
+static SAT_returnState s_get_tr(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_Full_Status *S_FS = &comms_scratch()->S_FS;
+  int8_t status = HAL_S_getTR(&S_FS->transmit);
+  WIRE_SWAP(sband_tr, &S_FS->transmit);
+  set_reply(packet, status, &S_FS->transmit, sizeof(S_FS->transmit));
+  return SATR_OK;
+}
+
+static SAT_returnState s_get_hk(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_Full_Status *S_FS = &comms_scratch()->S_FS;
+  int8_t status = HAL_S_getHK(&S_FS->HK);
+  WIRE_SWAP(sband_hk, &S_FS->HK);
+  set_reply(packet, status, &S_FS->HK, sizeof(S_FS->HK));
+  return SATR_OK;
+}
+
+static SAT_returnState s_get_buffer(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_Full_Status *S_FS = &comms_scratch()->S_FS;
+  int SID = packet->data[SID_byte];  // The identifier in the packet
+  if (SID < 0 || SID > 2) {
+    return SATR_PKT_ILLEGAL_SUBSERVICE;
+  }
+  int8_t status = HAL_S_getBuffer(SID, &S_FS->buffer);
+  S_FS->buffer.pointer[SID] = csp_hton16(S_FS->buffer.pointer[SID]);
+  set_reply(packet, status, &S_FS->buffer.pointer[SID], sizeof(S_FS->buffer.pointer[SID]));
+  return SATR_OK;
+}
+
+static SAT_returnState s_soft_reset(csp_conn_t *conn, csp_packet_t *packet) {
+  set_status(packet, HAL_S_softResetFPGA(), 0);
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Read the whole S-band status from the radio
  * @details
- *      Accepts incoming communication service packets and executes the
- * application
- * @param void* param
- * @return None
+ *      The only place the full status is read, so a HAL call reading the
+ *      register blocks in fewer transfers replaces these here
+ * @return int8_t
+ *      Sum of the HAL statuses, 0 on success
  */
-void communication_service(void *param) {
-  csp_socket_t *sock;
-  sock = csp_socket(CSP_SO_RDPREQ);
-  csp_bind(sock, TC_COMMUNICATION_SERVICE);
-  csp_listen(sock, SERVICE_BACKLOG_LEN);
-
-  for (;;) {
-    csp_conn_t *conn;
-    csp_packet_t *packet;
-    if ((conn = csp_accept(sock, CSP_MAX_TIMEOUT)) == NULL) {
-      continue;
-    }
-    while ((packet = csp_read(conn, 50)) != NULL) {
-      if (communication_service_app(packet) != SATR_OK) {
-        // something went wrong in the service
-        csp_buffer_free(packet);
-      } else {
-        if (!csp_send(conn, packet, 50)) {
-          csp_buffer_free(packet);
-        }
-      }
+static int8_t read_sband_full_status(Sband_Full_Status *S_FS) {
+  int i;
+  int8_t status = HAL_S_getStatus(&S_FS->status) + HAL_S_getTR(&S_FS->transmit) +
+                  HAL_S_getHK(&S_FS->HK);
+  status += HAL_S_getFV(&S_FS->Firmware_Version);
+  for (i = 0; i <= 2; i++) {
+    status += HAL_S_getBuffer(i, &S_FS->buffer);
+  }
+  return status;
+}
+
+static SAT_returnState s_get_full_status(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_Full_Status *S_FS = &comms_scratch()->S_FS;
+  int8_t status = 0;
+  if (!snapshot_get(&sband_snapshot_info, &sband_snapshot, S_FS, sizeof(*S_FS),
+                    status_max_age(packet))) {
+    uint32_t generation = status_generation;
+    status = read_sband_full_status(S_FS);
+    if (status == 0) {
+      snapshot_put(&sband_snapshot_info, &sband_snapshot, S_FS, sizeof(*S_FS), generation);
     }
-    csp_close(conn);
   }
+  WIRE_SWAP(sband_full_status, S_FS);
+  set_reply(packet, status, S_FS, sizeof(*S_FS));
+  return SATR_OK;
+}
+
+static SAT_returnState s_set_freq(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_config *S_config = &comms_scratch()->S_config;
+  cnv8_F(&packet->data[IN_DATA_BYTE], &S_config->freq);
+  S_config->freq = csp_ntohflt(S_config->freq);
+  set_status(packet, HAL_S_setFreq(S_config->freq), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState s_set_pa_power(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_config *S_config = &comms_scratch()->S_config;
+  S_config->PA_Power = (uint8_t)packet->data[IN_DATA_BYTE];
+  set_status(packet, HAL_S_setPAPower(S_config->PA_Power), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState s_set_control(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_config *S_config = &comms_scratch()->S_config;
+  S_config->PA.status = (uint8_t)packet->data[IN_DATA_BYTE];
+  S_config->PA.mode = (uint8_t)packet->data[IN_DATA_BYTE + 1];
+  WIRE_SWAP(sband_pa, &S_config->PA);
+  set_status(packet, HAL_S_setControl(S_config->PA), 0);
+  return SATR_OK;
+}
+
+static void s_encoder_ntoh(Sband_Encoder *enc, const uint8_t *in) {
+  enc->scrambler = (uint8_t)in[0];
+  enc->filter = (uint8_t)in[1];
+  enc->modulation = (uint8_t)in[2];
+  enc->rate = (uint8_t)in[3];
+  WIRE_SWAP(sband_encoder, enc);
+}
+
+static SAT_returnState s_set_encoder(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_config *S_config = &comms_scratch()->S_config;
+  s_encoder_ntoh(&S_config->enc, &packet->data[IN_DATA_BYTE]);
+  set_status(packet, HAL_S_setEncoder(S_config->enc), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState s_set_config(csp_conn_t *conn, csp_packet_t *packet) {
+  Sband_config *S_config = &comms_scratch()->S_config;
+  cnv8_F(&packet->data[IN_DATA_BYTE], &S_config->freq);
+  S_config->freq = csp_ntohflt(S_config->freq);
+  S_config->PA_Power =
+      (uint8_t)packet->data[IN_DATA_BYTE + 4];  // plus 4 because float takes 4B
+  S_config->PA.status = (uint8_t)packet->data[IN_DATA_BYTE + 5];
+  S_config->PA.mode = (uint8_t)packet->data[IN_DATA_BYTE + 6];
+  WIRE_SWAP(sband_pa, &S_config->PA);
+  s_encoder_ntoh(&S_config->enc, &packet->data[IN_DATA_BYTE + 7]);
+  int8_t status = HAL_S_setFreq(S_config->freq) +
+                  HAL_S_setPAPower(S_config->PA_Power) +
+                  HAL_S_setControl(S_config->PA) + HAL_S_setEncoder(S_config->enc);
+  set_status(packet, status, 0);
+  return SATR_OK;
+}
+
+/* UHF Subservices */
+static SAT_returnState uhf_set_scw(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Status *U_stat = &comms_scratch()->U_stat;
+  int i;
+  for (i = 0; i < SCW_LEN; i++) {
+    U_stat->scw[i] = (uint8_t)packet->data[IN_DATA_BYTE + i];
+  }
+  set_status(packet, HAL_UHF_setSCW(U_stat->scw), 0);
+  return SATR_OK;
+}
+
+// read scw and change the respective bit and set again
+static SAT_returnState uhf_set_scw_bit(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Status *U_stat = &comms_scratch()->U_stat;
+  uint8_t ser_subtype = (uint8_t)packet->data[SUBSERVICE_BYTE];
+  int8_t status = HAL_UHF_getSCW(U_stat->scw);
+  if (status == 0) {  //* replace 0 with U_GOOD_CONFIG
+    U_stat->scw[ser_subtype - UHF_SET_PIPE + 4] = 1;  //* check the endianness
+    status = HAL_UHF_setSCW(U_stat->scw);
+  }
+  set_status(packet, status, 0);
+  return SATR_OK;
+}
+
+static uint32_t uhf_arg32(csp_packet_t *packet, uint16_t offset) {
+  uint32_t value;
+  cnv8_32(&packet->data[IN_DATA_BYTE + offset], &value);
+  return csp_ntoh32(value);
+}
+
+static SAT_returnState uhf_set_freq(csp_conn_t *conn, csp_packet_t *packet) {
+  set_status(packet, HAL_UHF_setFreq(uhf_arg32(packet, 0)), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_set_pipe_timeout(csp_conn_t *conn, csp_packet_t *packet) {
+  set_status(packet, HAL_UHF_setPipeT(uhf_arg32(packet, 0)), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_set_beacon_t(csp_conn_t *conn, csp_packet_t *packet) {
+  set_status(packet, HAL_UHF_setBeaconT(uhf_arg32(packet, 0)), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_set_audio_t(csp_conn_t *conn, csp_packet_t *packet) {
+  set_status(packet, HAL_UHF_setAudioT(uhf_arg32(packet, 0)), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_set_params(csp_conn_t *conn, csp_packet_t *packet) {
+  int8_t status = HAL_UHF_setFreq(uhf_arg32(packet, 0)) +
+                  HAL_UHF_setPipeT(uhf_arg32(packet, 4)) +
+                  HAL_UHF_setBeaconT(uhf_arg32(packet, 8)) +
+                  HAL_UHF_setAudioT(uhf_arg32(packet, 12));
+  set_status(packet, status, 0);
+  return SATR_OK;
+}
+
+static uint8_t uhf_confirm(csp_packet_t *packet) {
+  uint8_t confirm = (uint8_t)packet->data[IN_DATA_BYTE];  // For confirming the change
+  return csp_ntoh32((uint32_t)confirm);
+}
+
+static SAT_returnState uhf_restore_default(csp_conn_t *conn, csp_packet_t *packet) {
+  set_status(packet, HAL_UHF_restore(uhf_confirm(packet)), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_low_pwr(csp_conn_t *conn, csp_packet_t *packet) {
+  set_status(packet, HAL_UHF_lowPwr(uhf_confirm(packet)), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_secure(csp_conn_t *conn, csp_packet_t *packet) {
+  set_status(packet, HAL_UHF_secure(uhf_confirm(packet)), 0);
+  return SATR_OK;
 }
 
 /**
  * @brief
- *      Start the communication server task
- * @details
- *      Starts the FreeRTOS task responsible for accepting incoming
- *      communication service requests
- * @param None
- * @return SAT_returnState
- *      success report
+ *      Read a string sent as numpy unicode, one CHAR_LEN wide char per byte
+ * @param msg
+ *      Where to put the string
+ * @param in
+ *      First character of the string in the packet
+ * @param max_len
+ *      Most characters to read
+ * @param stop_at_nul
+ *      Stop at the first NUL character instead of reading max_len
  */
-SAT_returnState start_communication_service(void) {
-  if (xTaskCreate((TaskFunction_t)communication_service,
-                  "communication_service", 1024, NULL, NORMAL_SERVICE_PRIO,
-                  NULL) != pdPASS) {
-    ex2_log("FAILED TO CREATE TASK start_communication_service\n");
-    return SATR_ERROR;
+static void uhf_read_chars(UHF_configStruct *msg, const uint8_t *in, uint8_t max_len,
+                           bool stop_at_nul) {
+  int i;
+  for (i = 0; i < max_len && !(stop_at_nul && in[(CHAR_LEN - 1) + CHAR_LEN * i] == 0); i++) {
+    msg->message[i] = (uint8_t)in[(CHAR_LEN - 1) + CHAR_LEN * i];
+    msg->message[i] = csp_ntoh32((uint32_t)msg->message[i]);
   }
-  ex2_log("Service handlers started\n");
+  msg->len = i;
+}
+
+static SAT_returnState uhf_set_dest(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Call_Sign *U_callsign = &comms_scratch()->U_callsign;
+  uhf_read_chars(&U_callsign->dest, &packet->data[IN_DATA_BYTE], CALLSIGN_LEN, false);
+  set_status(packet, HAL_UHF_setDestination(U_callsign->dest), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_set_src(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Call_Sign *U_callsign = &comms_scratch()->U_callsign;
+  uhf_read_chars(&U_callsign->src, &packet->data[IN_DATA_BYTE], CALLSIGN_LEN, false);
+  set_status(packet, HAL_UHF_setSource(U_callsign->src), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_set_morse(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Beacon *U_beacon = &comms_scratch()->U_beacon;
+  uhf_read_chars(&U_beacon->morse, &packet->data[IN_DATA_BYTE], MORSE_BEACON_MSG_LEN_MAX, true);
+  set_status(packet, HAL_UHF_setMorse(U_beacon->morse), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_set_midi(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Beacon *U_beacon = &comms_scratch()->U_beacon;
+  uhf_read_chars(&U_beacon->MIDI, &packet->data[IN_DATA_BYTE], BEACON_MSG_LEN_MAX, true);
+  set_status(packet, HAL_UHF_setMIDI(U_beacon->MIDI), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_set_beacon_msg(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Beacon *U_beacon = &comms_scratch()->U_beacon;
+  uhf_read_chars(&U_beacon->message, &packet->data[IN_DATA_BYTE], BEACON_MSG_LEN_MAX, true);
+  set_status(packet, HAL_UHF_setBeaconMsg(U_beacon->message), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_set_i2c(csp_conn_t *conn, csp_packet_t *packet) {
+  uint8_t I2C_address =
+      (uint8_t)packet->data[IN_DATA_BYTE] + 12;  // Hex to Dec (22 -> 0x22)
+  I2C_address = csp_ntoh32((uint32_t)I2C_address);
+  set_status(packet, HAL_UHF_setI2C(I2C_address), 0);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_write_fram(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_framStruct *U_FRAM = &comms_scratch()->U_FRAM;
+  int i;
+  cnv8_32(&packet->data[IN_DATA_BYTE], &U_FRAM->addr);
+  for (i = 0; i < FRAM_SIZE; i++) {
+    U_FRAM->data[i] =
+        (uint8_t)packet->data[IN_DATA_BYTE + sizeof(U_FRAM->addr) +
+                              (CHAR_LEN - 1) + CHAR_LEN * i];
+    U_FRAM->data[i] = csp_ntoh32((uint32_t)U_FRAM->data[i]);
+  }
+  set_status(packet, HAL_UHF_setFRAM(*U_FRAM), 0);
   return SATR_OK;
 }
 
 /**
  * @brief
- *      Takes a CSP packet and switches based on the subservice command
+ *      Read the whole UHF status from the radio
  * @details
- *      Reads/Writes data from communication EHs as subservices
- * @attention
- *      Some subservices return the aggregation of error status of multiple HALs
- * @param *packet
- *      The CSP packet
- * @return SAT_returnState
- *      Success or failure
+ *      The only place the full status is read, so a HAL call reading the
+ *      registers in fewer transfers replaces these here
+ * @return int8_t
+ *      Sum of the HAL statuses, 0 on success
  */
+static int8_t read_uhf_full_status(UHF_Status *U_stat) {
+  return HAL_UHF_getSCW(U_stat->scw) +
+         HAL_UHF_getFreq(&U_stat->set.freq) +
+         HAL_UHF_getUptime(&U_stat->uptime) +
+         HAL_UHF_getPcktsOut(&U_stat->pckts_out) +
+         HAL_UHF_getPcktsIn(&U_stat->pckts_in) +
+         HAL_UHF_getPcktsInCRC16(&U_stat->pckts_in_crc16) +
+         HAL_UHF_getPipeT(&U_stat->set.pipe_t) +
+         HAL_UHF_getBeaconT(&U_stat->set.beacon_t) +
+         HAL_UHF_getAudioT(&U_stat->set.audio_t) +
+         HAL_UHF_getTemp(&U_stat->temperature) +
+         HAL_UHF_getLowPwr(&U_stat->low_pwr_stat) +
+         HAL_UHF_getPayload(&U_stat->payload_size) +
+         HAL_UHF_getSecureKey(&U_stat->secure_key);
+}
 
-SAT_returnState communication_service_app(csp_packet_t *packet) {
-  uint8_t ser_subtype = (uint8_t)packet->data[SUBSERVICE_BYTE];
-  int8_t status;  // Status of HAL functions success
-  uint8_t uhf_struct_len;
-  int i;            // For indexing in multiple loops
-  int SID;          // The identifier in the packet
-  uint8_t confirm;  // For confirming the change
-
-  Sband_config *S_config = (Sband_config *)pvPortMalloc(sizeof(Sband_config));
-  Sband_Full_Status *S_FS = (Sband_Full_Status *)pvPortMalloc(
-      sizeof(Sband_Full_Status));  // FS: Full Status
-
-  UHF_Status *U_stat = (UHF_Status *)pvPortMalloc(sizeof(UHF_Status));
-  UHF_Beacon *U_beacon = (UHF_Beacon *)pvPortMalloc(sizeof(UHF_Beacon));
-  UHF_framStruct *U_FRAM =
-      (UHF_framStruct *)pvPortMalloc(sizeof(UHF_framStruct));
-  UHF_Call_Sign *U_callsign =
-      (UHF_Call_Sign *)pvPortMalloc(sizeof(UHF_Call_Sign));
-  uint8_t I2C_address;
-
-  switch (ser_subtype) {
-    case S_GET_FREQ:
-      // Step 1: get the data
-      status = HAL_S_getFreq(&S_config->freq);
-      // Step 2: Check the size before proceeding
-      if (sizeof(S_config->freq) + 1 >
-          csp_buffer_data_size()) {  // plus one for subservice
-        return SATR_ERROR;
-      }
-      // Step 3: convert to network order
-      S_config->freq = csp_htonflt(S_config->freq);
-      // step 4: copy data & status byte into packet
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &S_config->freq,
-             sizeof(S_config->freq));
-      // Step 5: set packet length
-      set_packet_length(packet, sizeof(int8_t) + sizeof(S_config->freq) + 1);
-
-      break;
-
-    case S_GET_CONTROL:
-      status = HAL_S_getControl(&S_config->PA);
-      if (sizeof(S_config->PA) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      // csp_hton function can not accept structures.
-      S_config->PA.status = csp_hton32((uint32_t)S_config->PA.status);
-      S_config->PA.mode = csp_hton32((uint32_t)S_config->PA.mode);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &S_config->PA, sizeof(S_config->PA));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(S_config->PA) + 1);
-
-      break;
-
-    case S_GET_ENCODER:
-      status = HAL_S_getEncoder(&S_config->enc);
-      if (sizeof(S_config->enc) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      S_config->enc.scrambler = csp_hton32((uint32_t)S_config->enc.scrambler);
-      S_config->enc.filter = csp_hton32((uint32_t)S_config->enc.filter);
-      S_config->enc.modulation = csp_hton32((uint32_t)S_config->enc.modulation);
-      S_config->enc.rate = csp_hton32((uint32_t)S_config->enc.rate);
-
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &S_config->enc,
-             sizeof(S_config->enc));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(S_config->enc) + 1);
-
-      break;
-
-    case S_GET_PA_POWER:
-      status = HAL_S_getPAPower(&S_config->PA_Power);
-      if (sizeof(S_config->PA_Power) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      S_config->PA_Power = csp_hton32((uint32_t)S_config->PA_Power);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &S_config->PA_Power,
-             sizeof(S_config->PA_Power));
-      set_packet_length(packet,
-                        sizeof(int8_t) + sizeof(S_config->PA_Power) + 1);
-
-      break;
-
-    case S_GET_CONFIG:
-      status = HAL_S_getFreq(&S_config->freq) +
-               HAL_S_getPAPower(&S_config->PA_Power) +
-               HAL_S_getControl(&S_config->PA) +
-               HAL_S_getEncoder(&S_config->enc);
-
-      if (sizeof(*S_config) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      S_config->freq = csp_htonflt(S_config->freq);
-      S_config->PA_Power = csp_hton32((uint32_t)S_config->PA_Power);
-      S_config->PA.status = csp_hton32((uint32_t)S_config->PA.status);
-      S_config->PA.mode = csp_hton32((uint32_t)S_config->PA.mode);
-      S_config->enc.scrambler = csp_hton32((uint32_t)S_config->enc.scrambler);
-      S_config->enc.filter = csp_hton32((uint32_t)S_config->enc.filter);
-      S_config->enc.modulation = csp_hton32((uint32_t)S_config->enc.modulation);
-      S_config->enc.rate = csp_hton32((uint32_t)S_config->enc.rate);
-
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], S_config, sizeof(*S_config));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(*S_config) + 1);
-
-      break;
-
-    case S_GET_STATUS:
-      status = HAL_S_getStatus(&S_FS->status);
-      if (sizeof(S_FS->status) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      S_FS->status.PWRGD = csp_hton32((uint32_t)S_FS->status.PWRGD);
-      S_FS->status.TXL = csp_hton32((uint32_t)S_FS->status.TXL);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &S_FS->status, sizeof(S_FS->status));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(S_FS->status) + 1);
-
-      break;
-
-    case S_GET_TR:
-      status = HAL_S_getTR(&S_FS->transmit);
-      if (sizeof(S_FS->transmit) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      S_FS->transmit.transmit = csp_hton32((uint32_t)S_FS->transmit.transmit);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &S_FS->transmit,
-             sizeof(S_FS->transmit));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(S_FS->transmit) + 1);
-
-      break;
-
-    case S_GET_HK:
-      status = HAL_S_getHK(&S_FS->HK);
-      if (sizeof(S_FS->HK) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      S_FS->HK.Output_Power = csp_htonflt(S_FS->HK.Output_Power);
-      S_FS->HK.PA_Temp = csp_htonflt(S_FS->HK.PA_Temp);
-      S_FS->HK.Top_Temp = csp_htonflt(S_FS->HK.Top_Temp);
-      S_FS->HK.Bottom_Temp = csp_htonflt(S_FS->HK.Bottom_Temp);
-      S_FS->HK.Bat_Current = csp_htonflt(S_FS->HK.Bat_Current);
-      S_FS->HK.Bat_Voltage = csp_htonflt(S_FS->HK.Bat_Voltage);
-      S_FS->HK.PA_Current = csp_htonflt(S_FS->HK.PA_Current);
-      S_FS->HK.PA_Voltage = csp_htonflt(S_FS->HK.PA_Voltage);
-
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &S_FS->HK, sizeof(S_FS->HK));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(S_FS->HK) + 1);
-
-      break;
-
-    case S_GET_BUFFER:
-      SID = packet->data[SID_byte];
-      if (SID < 0 || SID > 2) {
-        return SATR_PKT_ILLEGAL_SUBSERVICE;
-      } else {
-        status = HAL_S_getBuffer(SID, &S_FS->buffer);
-        if (sizeof(S_FS->buffer) + 1 > csp_buffer_data_size()) {
-          return SATR_ERROR;
-        }
-        S_FS->buffer.pointer[SID] = csp_hton16(S_FS->buffer.pointer[SID]);
-        memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-        memcpy(&packet->data[OUT_DATA_BYTE], &S_FS->buffer.pointer[SID],
-               sizeof(S_FS->buffer.pointer[SID]));
-        set_packet_length(
-            packet, sizeof(int8_t) + sizeof(S_FS->buffer.pointer[SID]) + 1);
-      }
-      break;
-
-    case S_SOFT_RESET:
-      status = HAL_S_softResetFPGA();
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case S_GET_FULL_STATUS:
-      status = HAL_S_getStatus(&S_FS->status) + HAL_S_getTR(&S_FS->transmit) +
-               HAL_S_getHK(&S_FS->HK);
-      status += HAL_S_getFV(&S_FS->Firmware_Version);
-      for (i = 0; i <= 2; i++) {
-        status += HAL_S_getBuffer(i, &S_FS->buffer);
-      }
-      if (sizeof(*S_FS) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      S_FS->status.PWRGD = csp_hton32((uint32_t)S_FS->status.PWRGD);
-      S_FS->status.TXL = csp_hton32((uint32_t)S_FS->status.TXL);
-      S_FS->transmit.transmit = csp_hton32((uint32_t)S_FS->transmit.transmit);
-      S_FS->HK.Output_Power = csp_htonflt(S_FS->HK.Output_Power);
-      S_FS->HK.PA_Temp = csp_htonflt(S_FS->HK.PA_Temp);
-      S_FS->HK.Top_Temp = csp_htonflt(S_FS->HK.Top_Temp);
-      S_FS->HK.Bottom_Temp = csp_htonflt(S_FS->HK.Bottom_Temp);
-      S_FS->HK.Bat_Current = csp_htonflt(S_FS->HK.Bat_Current);
-      S_FS->HK.Bat_Voltage = csp_htonflt(S_FS->HK.Bat_Voltage);
-      S_FS->HK.PA_Current = csp_htonflt(S_FS->HK.PA_Current);
-      S_FS->HK.PA_Voltage = csp_htonflt(S_FS->HK.PA_Voltage);
-      for (i = 0; i <= 2; i++) {
-        S_FS->buffer.pointer[i] = csp_hton16(S_FS->buffer.pointer[i]);
-      }
-      S_FS->Firmware_Version = csp_htonflt(S_FS->Firmware_Version);
-
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], S_FS, sizeof(*S_FS));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(*S_FS) + 1);
-
-      break;
-
-    case S_SET_FREQ:
-      cnv8_F(&packet->data[IN_DATA_BYTE], &S_config->freq);
-      S_config->freq = csp_ntohflt(S_config->freq);
-      status = HAL_S_setFreq(S_config->freq);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case S_SET_PA_POWER:
-      S_config->PA_Power = (uint8_t)packet->data[IN_DATA_BYTE];
-      S_config->PA_Power = csp_ntoh32((uint32_t)S_config->PA_Power);
-      status = HAL_S_setPAPower(S_config->PA_Power);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case S_SET_CONTROL:
-      S_config->PA.status = (uint8_t)packet->data[IN_DATA_BYTE];
-      S_config->PA.mode = (uint8_t)packet->data[IN_DATA_BYTE + 1];
-      S_config->PA.status = csp_ntoh32((uint32_t)S_config->PA.status);
-      S_config->PA.mode = csp_ntoh32((uint32_t)S_config->PA.mode);
-      status = HAL_S_setControl(S_config->PA);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case S_SET_ENCODER:
-      S_config->enc.scrambler = (uint8_t)packet->data[IN_DATA_BYTE];
-      S_config->enc.filter = (uint8_t)packet->data[IN_DATA_BYTE + 1];
-      S_config->enc.modulation = (uint8_t)packet->data[IN_DATA_BYTE + 2];
-      S_config->enc.rate = (uint8_t)packet->data[IN_DATA_BYTE + 3];
-      S_config->enc.scrambler = csp_ntoh32((uint32_t)S_config->enc.scrambler);
-      S_config->enc.filter = csp_ntoh32((uint32_t)S_config->enc.filter);
-      S_config->enc.modulation = csp_ntoh32((uint32_t)S_config->enc.modulation);
-      S_config->enc.rate = csp_ntoh32((uint32_t)S_config->enc.rate);
-      status = HAL_S_setEncoder(S_config->enc);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case S_SET_CONFIG:
-      cnv8_F(&packet->data[IN_DATA_BYTE], &S_config->freq);
-      S_config->freq = csp_ntohflt(S_config->freq);
-      S_config->PA_Power =
-          (uint8_t)
-              packet->data[IN_DATA_BYTE + 4];  // plus 4 because float takes 4B
-      S_config->PA_Power = csp_ntoh32((uint32_t)S_config->PA_Power);
-      S_config->PA.status = (uint8_t)packet->data[IN_DATA_BYTE + 5];
-      S_config->PA.mode = (uint8_t)packet->data[IN_DATA_BYTE + 6];
-      S_config->PA.status = csp_ntoh32((uint32_t)S_config->PA.status);
-      S_config->PA.mode = csp_ntoh32((uint32_t)S_config->PA.mode);
-      S_config->enc.scrambler = (uint8_t)packet->data[IN_DATA_BYTE + 7];
-      S_config->enc.filter = (uint8_t)packet->data[IN_DATA_BYTE + 8];
-      S_config->enc.modulation = (uint8_t)packet->data[IN_DATA_BYTE + 9];
-      S_config->enc.rate = (uint8_t)packet->data[IN_DATA_BYTE + 10];
-      S_config->enc.scrambler = csp_ntoh32((uint32_t)S_config->enc.scrambler);
-      S_config->enc.filter = csp_ntoh32((uint32_t)S_config->enc.filter);
-      S_config->enc.modulation = csp_ntoh32((uint32_t)S_config->enc.modulation);
-      S_config->enc.rate = csp_ntoh32((uint32_t)S_config->enc.rate);
-      status = HAL_S_setFreq(S_config->freq) +
-               HAL_S_setPAPower(S_config->PA_Power) +
-               HAL_S_setControl(S_config->PA) + HAL_S_setEncoder(S_config->enc);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-      /* UHF Subservices */
-    case UHF_SET_SCW:
-      for (i = 0; i < SCW_LEN; i++) {
-        U_stat->scw[i] = (uint8_t)packet->data[IN_DATA_BYTE + i];
-        U_stat->scw[i] = csp_ntoh32((uint32_t)U_stat->scw[i]);
-      }
-      status = HAL_UHF_setSCW(U_stat->scw);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    // read scw and change the respective bit and set again
-    case UHF_SET_PIPE:
-    case UHF_SET_BCN:
-    case UHF_SET_ECHO: {
-      status = HAL_UHF_getSCW(U_stat->scw);
-      if (status == 0) {  //* replace 0 with U_GOOD_CONFIG
-        U_stat->scw[ser_subtype - UHF_SET_PIPE + 4] =
-            1;  //* check the endianness
-        status = HAL_UHF_setSCW(U_stat->scw);
-      }
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-      break;
+static SAT_returnState uhf_get_full_stat(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Status *U_stat = &comms_scratch()->U_stat;
+  int8_t status = 0;
+  if (!snapshot_get(&uhf_snapshot_info, &uhf_snapshot, U_stat, sizeof(*U_stat),
+                    status_max_age(packet))) {
+    uint32_t generation = status_generation;
+    status = read_uhf_full_status(U_stat);
+    if (status == 0) {
+      snapshot_put(&uhf_snapshot_info, &uhf_snapshot, U_stat, sizeof(*U_stat), generation);
     }
+  }
+  WIRE_SWAP(uhf_status, U_stat);
+  set_reply(packet, status, U_stat, sizeof(*U_stat));
+  return SATR_OK;
+}
 
-    case UHF_SET_FREQ:
-      cnv8_32(&packet->data[IN_DATA_BYTE], &U_stat->set.freq);
-      U_stat->set.freq = csp_ntoh32(U_stat->set.freq);
-      status = HAL_UHF_setFreq(U_stat->set.freq);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SET_PIPE_TIMEOUT:
-      cnv8_32(&packet->data[IN_DATA_BYTE], &U_stat->set.pipe_t);
-      U_stat->set.pipe_t = csp_ntoh32(U_stat->set.pipe_t);
-      status = HAL_UHF_setPipeT(U_stat->set.pipe_t);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SET_BEACON_T:
-      cnv8_32(&packet->data[IN_DATA_BYTE], &U_stat->set.beacon_t);
-      U_stat->set.beacon_t = csp_ntoh32(U_stat->set.beacon_t);
-      status = HAL_UHF_setBeaconT(U_stat->set.beacon_t);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SET_AUDIO_T:
-      cnv8_32(&packet->data[IN_DATA_BYTE], &U_stat->set.audio_t);
-      U_stat->set.audio_t = csp_ntoh32(U_stat->set.audio_t);
-      status = HAL_UHF_setAudioT(U_stat->set.audio_t);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SET_PARAMS:
-      cnv8_32(&packet->data[IN_DATA_BYTE], &U_stat->set.freq);
-      U_stat->set.freq = csp_ntoh32(U_stat->set.freq);
-      cnv8_32(&packet->data[IN_DATA_BYTE + 4], &U_stat->set.pipe_t);
-      U_stat->set.pipe_t = csp_ntoh32(U_stat->set.pipe_t);
-      cnv8_32(&packet->data[IN_DATA_BYTE + 8], &U_stat->set.beacon_t);
-      U_stat->set.beacon_t = csp_ntoh32(U_stat->set.beacon_t);
-      cnv8_32(&packet->data[IN_DATA_BYTE + 12], &U_stat->set.audio_t);
-      U_stat->set.audio_t = csp_ntoh32(U_stat->set.audio_t);
-      status = HAL_UHF_setFreq(U_stat->set.freq) +
-               HAL_UHF_setPipeT(U_stat->set.pipe_t) +
-               HAL_UHF_setBeaconT(U_stat->set.beacon_t) +
-               HAL_UHF_setAudioT(U_stat->set.audio_t);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_RESTORE_DEFAULT:
-      confirm = (uint8_t)packet->data[IN_DATA_BYTE];
-      confirm = csp_ntoh32((uint32_t)confirm);
-      status = HAL_UHF_restore(confirm);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_LOW_PWR:
-      confirm = (uint8_t)packet->data[IN_DATA_BYTE];
-      confirm = csp_ntoh32((uint32_t)confirm);
-      status = HAL_UHF_lowPwr(confirm);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SET_DEST:
-      uhf_struct_len = CALLSIGN_LEN;
-      U_callsign->dest.len = uhf_struct_len;
-      for (i = 0; i < uhf_struct_len; i++) {
-        U_callsign->dest.message[i] =
-            (uint8_t)packet->data[IN_DATA_BYTE + (CHAR_LEN - 1) + CHAR_LEN * i];
-        U_callsign->dest.message[i] =
-            csp_ntoh32((uint32_t)U_callsign->dest.message[i]);
-      }
-      status = HAL_UHF_setDestination(U_callsign->dest);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SET_SRC:
-      uhf_struct_len = CALLSIGN_LEN;
-      U_callsign->src.len = uhf_struct_len;
-      for (i = 0; i < uhf_struct_len; i++) {
-        U_callsign->src.message[i] =
-            (uint8_t)packet->data[IN_DATA_BYTE + (CHAR_LEN - 1) + CHAR_LEN * i];
-        U_callsign->src.message[i] =
-            csp_ntoh32((uint32_t)U_callsign->src.message[i]);
-      }
-      status = HAL_UHF_setSource(U_callsign->src);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SET_MORSE:
-      uhf_struct_len = MORSE_BEACON_MSG_LEN_MAX;
-      for (i = 0;
-           i < uhf_struct_len &&
-           packet->data[IN_DATA_BYTE + (CHAR_LEN - 1) + CHAR_LEN * i] != 0;
-           i++) {
-        U_beacon->morse.message[i] =
-            (uint8_t)packet->data[IN_DATA_BYTE + (CHAR_LEN - 1) + CHAR_LEN * i];
-        U_beacon->morse.message[i] =
-            csp_ntoh32((uint32_t)U_beacon->morse.message[i]);
-      }
-      U_beacon->morse.len = i;
-      status = HAL_UHF_setMorse(U_beacon->morse);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SET_MIDI:
-      uhf_struct_len = BEACON_MSG_LEN_MAX;
-      for (i = 0;
-           i < uhf_struct_len &&
-           packet->data[IN_DATA_BYTE + (CHAR_LEN - 1) + CHAR_LEN * i] != 0;
-           i++) {
-        U_beacon->MIDI.message[i] =
-            (uint8_t)packet->data[IN_DATA_BYTE + (CHAR_LEN - 1) + CHAR_LEN * i];
-        U_beacon->MIDI.message[i] =
-            csp_ntoh32((uint32_t)U_beacon->MIDI.message[i]);
-      }
-      U_beacon->MIDI.len = i;
-      status = HAL_UHF_setMIDI(U_beacon->MIDI);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SET_BEACON_MSG:
-      uhf_struct_len = BEACON_MSG_LEN_MAX;
-      for (i = 0;
-           i < uhf_struct_len &&
-           packet->data[IN_DATA_BYTE + (CHAR_LEN - 1) + CHAR_LEN * i] != 0;
-           i++) {
-        U_beacon->message.message[i] =
-            (uint8_t)packet->data[IN_DATA_BYTE + (CHAR_LEN - 1) + CHAR_LEN * i];
-        U_beacon->message.message[i] =
-            csp_ntoh32((uint32_t)U_beacon->message.message[i]);
-      }
-      U_beacon->message.len = i;
-      status = HAL_UHF_setBeaconMsg(U_beacon->message);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SET_I2C:
-      I2C_address =
-          (uint8_t)packet->data[IN_DATA_BYTE] + 12;  // Hex to Dec (22 -> 0x22)
-      I2C_address = csp_ntoh32((uint32_t)I2C_address);
-      status = HAL_UHF_setI2C(I2C_address);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_WRITE_FRAM:
-      cnv8_32(&packet->data[IN_DATA_BYTE], &U_FRAM->addr);
-      for (i = 0; i < FRAM_SIZE; i++) {
-        U_FRAM->data[i] =
-            (uint8_t)packet->data[IN_DATA_BYTE + sizeof(U_FRAM->addr) +
-                                  (CHAR_LEN - 1) + CHAR_LEN * i];
-        U_FRAM->data[i] = csp_ntoh32((uint32_t)U_FRAM->data[i]);
-      }
-      status = HAL_UHF_setFRAM(*U_FRAM);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_SECURE:
-      confirm = (uint8_t)packet->data[IN_DATA_BYTE];
-      confirm = csp_ntoh32((uint32_t)confirm);
-      status = HAL_UHF_secure(confirm);
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);
-
-      break;
-
-    case UHF_GET_FULL_STAT:
-      status = HAL_UHF_getSCW(U_stat->scw) +
-               HAL_UHF_getFreq(&U_stat->set.freq) +
-               HAL_UHF_getUptime(&U_stat->uptime) +
-               HAL_UHF_getPcktsOut(&U_stat->pckts_out) +
-               HAL_UHF_getPcktsIn(&U_stat->pckts_in) +
-               HAL_UHF_getPcktsInCRC16(&U_stat->pckts_in_crc16) +
-               HAL_UHF_getPipeT(&U_stat->set.pipe_t) +
-               HAL_UHF_getBeaconT(&U_stat->set.beacon_t) +
-               HAL_UHF_getAudioT(&U_stat->set.audio_t) +
-               HAL_UHF_getTemp(&U_stat->temperature) +
-               HAL_UHF_getLowPwr(&U_stat->low_pwr_stat) +
-               HAL_UHF_getPayload(&U_stat->payload_size) +
-               HAL_UHF_getSecureKey(&U_stat->secure_key);
-
-      if (sizeof(*U_stat) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      for (i = 0; i < SCW_LEN; i++) {
-        U_stat->scw[i] = csp_hton32((uint32_t)U_stat->scw[i]);
-      }
-      U_stat->set.freq = csp_hton32(U_stat->set.freq);
-      U_stat->uptime = csp_hton32(U_stat->uptime);
-      U_stat->pckts_out = csp_hton32(U_stat->pckts_out);
-      U_stat->pckts_in = csp_hton32(U_stat->pckts_in);
-      U_stat->pckts_in_crc16 = csp_hton32(U_stat->pckts_in_crc16);
-      U_stat->set.pipe_t = csp_hton32(U_stat->set.pipe_t);
-      U_stat->set.beacon_t = csp_hton32(U_stat->set.beacon_t);
-      U_stat->set.audio_t = csp_hton32(U_stat->set.audio_t);
-      U_stat->temperature = csp_htonflt(U_stat->temperature);
-      U_stat->low_pwr_stat = csp_hton32((uint32_t)U_stat->low_pwr_stat);
-      U_stat->payload_size = csp_hton16(U_stat->payload_size);
-      U_stat->secure_key = csp_hton32(U_stat->secure_key);
-
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], U_stat, sizeof(*U_stat));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(*U_stat) + 1);
-
-      break;
-
-    case UHF_GET_CALL_SIGN:
-      status = HAL_UHF_getDestination(&U_callsign->dest) +
-               HAL_UHF_getSource(&U_callsign->src);
-      uhf_struct_len = CALLSIGN_LEN;
-      uint8_t dst[CALLSIGN_LEN * CHAR_LEN];
-      memset(dst, 0, CALLSIGN_LEN * CHAR_LEN);
-      uint8_t src[CALLSIGN_LEN * CHAR_LEN];
-      memset(src, 0, CALLSIGN_LEN * CHAR_LEN);
-      if (sizeof(dst) + sizeof(src) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      for (i = 0; i < uhf_struct_len; i++) {
-        dst[(CHAR_LEN - 1) + CHAR_LEN * i] =
-            csp_hton32((uint32_t)U_callsign->dest.message[i]);
-        src[(CHAR_LEN - 1) + CHAR_LEN * i] =
-            csp_hton32((uint32_t)U_callsign->src.message[i]);
-      }
-
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &dst, sizeof(dst));
-      memcpy(&packet->data[OUT_DATA_BYTE + sizeof(dst)], &src, sizeof(src));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(dst) + sizeof(src) + 1);
-
-      break;
-
-    case UHF_GET_MORSE:
-      status = HAL_UHF_getMorse(&U_beacon->morse);
-      uhf_struct_len = U_beacon->morse.len;
-      uint8_t mrs[MORSE_BEACON_MSG_LEN_MAX * CHAR_LEN];
-      memset(mrs, 0, MORSE_BEACON_MSG_LEN_MAX * CHAR_LEN);
-      if (sizeof(mrs) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      for (i = 0; i < uhf_struct_len; i++) {
-        mrs[(CHAR_LEN - 1) + CHAR_LEN * i] =
-            csp_hton32((uint32_t)U_beacon->morse.message[i]);
-      }
-
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &mrs, sizeof(mrs));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(mrs) + 1);
-
-      break;
-
-    case UHF_GET_MIDI:
-      status = HAL_UHF_getMIDI(&U_beacon->MIDI);
-      uhf_struct_len = U_beacon->MIDI.len;
-      uint8_t midi[BEACON_MSG_LEN_MAX * CHAR_LEN];
-      memset(midi, 0, BEACON_MSG_LEN_MAX * CHAR_LEN);
-      if (sizeof(midi) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      for (i = 0; i < uhf_struct_len; i++) {
-        midi[(CHAR_LEN - 1) + CHAR_LEN * i] =
-            csp_hton32((uint32_t)U_beacon->MIDI.message[i]);
-      }
-
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &midi, sizeof(midi));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(midi) + 1);
-
-      break;
-
-    case UHF_GET_BEACON_MSG:
-      status = HAL_UHF_getBeaconMsg(&U_beacon->message);
-      uhf_struct_len = U_beacon->message.len;
-      // Switch BEACON_MSG_LEN_MAX to MAX_W_CMDLEN after packet configuration
-      uint8_t beacon[BEACON_MSG_LEN_MAX * CHAR_LEN];
-      memset(beacon, 0, BEACON_MSG_LEN_MAX * CHAR_LEN);
-      if (sizeof(beacon) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      for (i = 0; i < uhf_struct_len; i++) {
-        beacon[(CHAR_LEN - 1) + CHAR_LEN * i] =
-            csp_hton32((uint32_t)U_beacon->message.message[i]);
-      }
-
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &beacon, sizeof(beacon));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(beacon) + 1);
-
-      break;
-
-    case UHF_GET_FRAM:
-      cnv8_32(&packet->data[IN_DATA_BYTE], &U_FRAM->addr);
-      status = HAL_UHF_getFRAM(&U_FRAM);
-      uint8_t fram[FRAM_SIZE * CHAR_LEN];
-      memset(fram, 0, FRAM_SIZE * CHAR_LEN);
-      if (sizeof(fram) + 1 > csp_buffer_data_size()) {
-        return SATR_ERROR;
-      }
-      for (i = 0; i < FRAM_SIZE; i++) {
-        fram[(CHAR_LEN - 1) + CHAR_LEN * i] =
-            csp_hton32((uint32_t)U_FRAM->data[i]);
-      }
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &fram, sizeof(fram));
-      set_packet_length(packet, sizeof(int8_t) + sizeof(fram) + 1);
-
-      break;
-
-    default:
-      ex2_log("No such subservice\n");
-      return SATR_PKT_ILLEGAL_SUBSERVICE;
+/**
+ * @brief
+ *      Write a string as numpy unicode, one CHAR_LEN wide char per byte
+ * @param out
+ *      Where to put the characters. Must hold CHAR_LEN * max_len bytes
+ * @param msg
+ *      The string
+ * @param max_len
+ *      Size of out in characters. Unused characters are zero
+ */
+static void uhf_write_chars(uint8_t *out, const UHF_configStruct *msg, uint8_t max_len) {
+  int i;
+  memset(out, 0, max_len * CHAR_LEN);
+  for (i = 0; i < msg->len && i < max_len; i++) {
+    out[(CHAR_LEN - 1) + CHAR_LEN * i] = csp_hton32((uint32_t)msg->message[i]);
   }
+}
 
-  vPortFree(S_config);
-  vPortFree(S_FS);
-  vPortFree(U_stat);
-  vPortFree(U_beacon);
-  vPortFree(U_FRAM);
-  vPortFree(U_callsign);
+static SAT_returnState uhf_get_call_sign(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Call_Sign *U_callsign = &comms_scratch()->U_callsign;
+  int8_t status = HAL_UHF_getDestination(&U_callsign->dest) +
+                  HAL_UHF_getSource(&U_callsign->src);
+  // both callsigns are always CALLSIGN_LEN characters
+  U_callsign->dest.len = CALLSIGN_LEN;
+  U_callsign->src.len = CALLSIGN_LEN;
+  uhf_write_chars(&packet->data[OUT_DATA_BYTE], &U_callsign->dest, CALLSIGN_LEN);
+  uhf_write_chars(&packet->data[OUT_DATA_BYTE + CALLSIGN_LEN * CHAR_LEN], &U_callsign->src,
+                  CALLSIGN_LEN);
+  set_status(packet, status, 2 * CALLSIGN_LEN * CHAR_LEN);
   return SATR_OK;
 }
+
+static SAT_returnState uhf_get_morse(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Beacon *U_beacon = &comms_scratch()->U_beacon;
+  int8_t status = HAL_UHF_getMorse(&U_beacon->morse);
+  uhf_write_chars(&packet->data[OUT_DATA_BYTE], &U_beacon->morse, MORSE_BEACON_MSG_LEN_MAX);
+  set_status(packet, status, MORSE_BEACON_MSG_LEN_MAX * CHAR_LEN);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_get_midi(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Beacon *U_beacon = &comms_scratch()->U_beacon;
+  int8_t status = HAL_UHF_getMIDI(&U_beacon->MIDI);
+  uhf_write_chars(&packet->data[OUT_DATA_BYTE], &U_beacon->MIDI, BEACON_MSG_LEN_MAX);
+  set_status(packet, status, BEACON_MSG_LEN_MAX * CHAR_LEN);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_get_beacon_msg(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_Beacon *U_beacon = &comms_scratch()->U_beacon;
+  int8_t status = HAL_UHF_getBeaconMsg(&U_beacon->message);
+  // Switch BEACON_MSG_LEN_MAX to MAX_W_CMDLEN after packet configuration
+  uhf_write_chars(&packet->data[OUT_DATA_BYTE], &U_beacon->message, BEACON_MSG_LEN_MAX);
+  set_status(packet, status, BEACON_MSG_LEN_MAX * CHAR_LEN);
+  return SATR_OK;
+}
+
+static SAT_returnState uhf_get_fram(csp_conn_t *conn, csp_packet_t *packet) {
+  UHF_framStruct *U_FRAM = &comms_scratch()->U_FRAM;
+  int i;
+  cnv8_32(&packet->data[IN_DATA_BYTE], &U_FRAM->addr);
+  int8_t status = HAL_UHF_getFRAM(U_FRAM);
+  uint8_t *fram = &packet->data[OUT_DATA_BYTE];
+  memset(fram, 0, FRAM_SIZE * CHAR_LEN);
+  for (i = 0; i < FRAM_SIZE; i++) {
+    fram[(CHAR_LEN - 1) + CHAR_LEN * i] = csp_hton32((uint32_t)U_FRAM->data[i]);
+  }
+  set_status(packet, status, FRAM_SIZE * CHAR_LEN);
+  return SATR_OK;
+}
+
+/* communication subservices. lengths exclude the subservice and status bytes.
+   Some subservices return the aggregation of error status of multiple HALs
+*/
+static const subservice_entry communication_subservices[] = {
+  [S_GET_FREQ] = {s_get_freq, 0, FIELD_SIZE(Sband_config, freq), PRIV_ANY, 0},
+  [S_GET_CONTROL] = {s_get_control, 0, FIELD_SIZE(Sband_config, PA), PRIV_ANY, 0},
+  [S_GET_ENCODER] = {s_get_encoder, 0, FIELD_SIZE(Sband_config, enc), PRIV_ANY, 0},
+  [S_GET_PA_POWER] = {s_get_pa_power, 0, FIELD_SIZE(Sband_config, PA_Power), PRIV_ANY, 0},
+  [S_GET_STATUS] = {s_get_status, 0, FIELD_SIZE(Sband_Full_Status, status), PRIV_ANY, 0},
+  [S_GET_TR] = {s_get_tr, 0, FIELD_SIZE(Sband_Full_Status, transmit), PRIV_ANY, 0},
+  [S_GET_BUFFER] = {s_get_buffer, 1, FIELD_SIZE(Sband_Buffer, pointer[0]), PRIV_ANY, 0},
+  [S_GET_HK] = {s_get_hk, 0, FIELD_SIZE(Sband_Full_Status, HK), PRIV_ANY, 0},
+  [S_SOFT_RESET] = {s_soft_reset, 0, 0, PRIV_GROUND, 0},
+  [S_GET_FULL_STATUS] = {s_get_full_status, 0, sizeof(Sband_Full_Status), PRIV_ANY, 0}, //optional max age
+  [S_SET_FREQ] = {s_set_freq, sizeof(float), 0, PRIV_GROUND, 0},
+  [S_SET_CONTROL] = {s_set_control, 2, 0, PRIV_GROUND, 0},
+  [S_SET_ENCODER] = {s_set_encoder, 4, 0, PRIV_GROUND, 0},
+  [S_SET_PA_POWER] = {s_set_pa_power, 1, 0, PRIV_GROUND, 0},
+  [S_GET_CONFIG] = {s_get_config, 0, sizeof(Sband_config), PRIV_ANY, 0},
+  [S_SET_CONFIG] = {s_set_config, 11, 0, PRIV_GROUND, 0},
+
+  [UHF_SET_SCW] = {uhf_set_scw, SCW_LEN, 0, PRIV_GROUND, 0},
+  [UHF_SET_FREQ] = {uhf_set_freq, sizeof(uint32_t), 0, PRIV_GROUND, 0},
+  [UHF_SET_PIPE_TIMEOUT] = {uhf_set_pipe_timeout, sizeof(uint32_t), 0, PRIV_GROUND, 0},
+  [UHF_SET_BEACON_T] = {uhf_set_beacon_t, sizeof(uint32_t), 0, PRIV_GROUND, 0},
+  [UHF_SET_AUDIO_T] = {uhf_set_audio_t, sizeof(uint32_t), 0, PRIV_GROUND, 0},
+  [UHF_SET_PARAMS] = {uhf_set_params, 4 * sizeof(uint32_t), 0, PRIV_GROUND, 0},
+  [UHF_RESTORE_DEFAULT] = {uhf_restore_default, 1, 0, PRIV_GROUND, 0},
+  [UHF_LOW_PWR] = {uhf_low_pwr, 1, 0, PRIV_GROUND, 0},
+  [UHF_SET_DEST] = {uhf_set_dest, CALLSIGN_LEN * CHAR_LEN, 0, PRIV_GROUND, 0},
+  [UHF_SET_SRC] = {uhf_set_src, CALLSIGN_LEN * CHAR_LEN, 0, PRIV_GROUND, 0},
+  [UHF_SET_MORSE] = {uhf_set_morse, 0, 0, PRIV_GROUND, 0},
+  [UHF_SET_MIDI] = {uhf_set_midi, 0, 0, PRIV_GROUND, 0},
+  [UHF_SET_BEACON_MSG] = {uhf_set_beacon_msg, 0, 0, PRIV_GROUND, 0},
+  [UHF_SET_I2C] = {uhf_set_i2c, 1, 0, PRIV_GROUND, 0},
+  [UHF_WRITE_FRAM] = {uhf_write_fram, sizeof(uint32_t) + FRAM_SIZE * CHAR_LEN, 0, PRIV_GROUND, 0},
+  [UHF_SECURE] = {uhf_secure, 1, 0, PRIV_GROUND, 0},
+  [UHF_GET_FULL_STAT] = {uhf_get_full_stat, 0, sizeof(UHF_Status), PRIV_ANY, 0}, //optional max age
+  [UHF_GET_CALL_SIGN] = {uhf_get_call_sign, 0, 2 * CALLSIGN_LEN * CHAR_LEN, PRIV_ANY, 0},
+  [UHF_GET_MORSE] = {uhf_get_morse, 0, MORSE_BEACON_MSG_LEN_MAX * CHAR_LEN, PRIV_ANY, 0},
+  [UHF_GET_MIDI] = {uhf_get_midi, 0, BEACON_MSG_LEN_MAX * CHAR_LEN, PRIV_ANY, 0},
+  [UHF_GET_BEACON_MSG] = {uhf_get_beacon_msg, 0, BEACON_MSG_LEN_MAX * CHAR_LEN, PRIV_ANY, 0},
+  [UHF_GET_FRAM] = {uhf_get_fram, sizeof(uint32_t), FRAM_SIZE * CHAR_LEN, PRIV_ANY, 0},
+  [UHF_SET_PIPE] = {uhf_set_scw_bit, 0, 0, PRIV_GROUND, 0},
+  [UHF_SET_BCN] = {uhf_set_scw_bit, 0, 0, PRIV_GROUND, 0},
+  [UHF_SET_ECHO] = {uhf_set_scw_bit, 0, 0, PRIV_GROUND, 0},
+};
+
+/**
+ * @brief
+ *      Handle one communication service packet
+ * @details
+ *      Called by a service worker for every packet read on a
+ *      TC_COMMUNICATION_SERVICE connection. Reads/Writes data from
+ *      communication EHs as subservices, see communication_subservices.
+ *      Every ground command drops the full status snapshots once it has run
+ * @param conn
+ *      The connection the packet arrived on
+ * @param packet
+ *      The CSP packet. Always consumed
+ * @return SAT_returnState
+ *      Success or failure
+ */
+SAT_returnState communication_service_handler(csp_conn_t *conn, csp_packet_t *packet) {
+  uint8_t ser_subtype = packet->data[SUBSERVICE_BYTE];
+  SAT_returnState state = dispatch_subservice(communication_subservices,
+                                              TABLE_LEN(communication_subservices), conn, packet);
+  // commands may change what the radios report, so drop the status snapshots
+  if (ser_subtype < TABLE_LEN(communication_subservices) &&
+      communication_subservices[ser_subtype].privilege == PRIV_GROUND) {
+    taskENTER_CRITICAL();
+    status_generation++;
+    taskEXIT_CRITICAL();
+  }
+  return state;
+}
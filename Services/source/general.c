@@ -27,114 +27,293 @@
 #include <main/system.h>
 #include "general.h"
 #include "services.h"
+#include "util/service_buffers.h"
+#include "util/service_metrics.h"
 #include "util/service_utilities.h"
+#include "util/task_census.h"
 #include "application_defined_privileged_functions.h"
 
-SAT_returnState general_app(csp_packet_t *packet);
-void general_service(void * param);
+static SAT_returnState general_reboot(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState general_get_metrics(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState general_reset_metrics(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState general_get_task_census(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState general_get_buffer_stats(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState general_command_list(csp_conn_t *conn, csp_packet_t *packet);
 
-csp_conn_t *conn;
+// GET_TASK_CENSUS reply: heap free now and minimum, slot count, then per task
+#define CENSUS_HEADER_LEN (2 * sizeof(uint32_t) + 2 * sizeof(uint8_t))
+#define CENSUS_ENTRY_LEN (sizeof(uint8_t) + CENSUS_NAME_LEN + 2 * sizeof(uint16_t))
+
+/* general subservices. lengths exclude the subservice and status bytes */
+static const subservice_entry general_subservices[] = {
+  [REBOOT] = {general_reboot, 1, 0, PRIV_GROUND, SUBSERVICE_SENDS},
+  [GET_METRICS] = {general_get_metrics, 3, sizeof(service_metrics), PRIV_ANY, 0},
+  [RESET_METRICS] = {general_reset_metrics, 0, 0, PRIV_GROUND, 0},
+  [GET_TASK_CENSUS] = {general_get_task_census, 1,
+                       CENSUS_HEADER_LEN + CENSUS_PAGE_LEN * CENSUS_ENTRY_LEN, PRIV_ANY, 0},
+  [GET_BUFFER_STATS] = {general_get_buffer_stats, 0, SERVICE_BUF_STATS_WIRE_SIZE, PRIV_ANY, 0},
+  [COMMAND_LIST] = {general_command_list, 2, 1 + COMMAND_LIST_MAX_STEPS, PRIV_ANY,
+                    SUBSERVICE_NO_STEP},
+};
+
+/**
+ * @brief
+ *      Handle one general service packet
+ * @details
+ *      Called by a service worker for every packet read on a
+ *      TC_GENERAL_SERVICE connection to perform tasks not covered by
+ *      other services, see general_subservices
+ * @param conn
+ *      The connection the packet arrived on
+ * @param packet
+ *      The CSP packet. Always consumed
+ * @return SAT_returnState
+ *      success report
+ */
+SAT_returnState general_handler(csp_conn_t *conn, csp_packet_t *packet) {
+  return dispatch_subservice(general_subservices, TABLE_LEN(general_subservices),
+                             conn, packet);
+}
 
 /**
  * @brief
- *      Start the general server task
+ *      Reply, then reboot into the requested image
  * @details
- *      Starts the FreeRTOS task responsible for accepting incoming
- *      general packets
- * @param None
+ *      The reply is sent before rebooting since there is no coming back
+ * @param csp_conn_t *conn
+ *              Connection the response is sent on
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet. Always consumed
  * @return SAT_returnState
  *      success report
  */
-SAT_returnState start_general_service(void) {
-  if (xTaskCreate((TaskFunction_t)general_service,
-                  "general_service", 300, NULL, NORMAL_SERVICE_PRIO,
-                  NULL) != pdPASS) {
-    ex2_log("FAILED TO CREATE TASK general_service\n");
-    return SATR_ERROR;
+static SAT_returnState general_reboot(csp_conn_t *conn, csp_packet_t *packet) {
+  int8_t status;
+  char reboot_type = packet->data[IN_DATA_BYTE];
+
+  switch(reboot_type) {
+  case 'A':
+  case 'B':
+  case 'G':
+      status = 0;
+      break;
+  default:
+      status = -1;
+      break;
+  }
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + 1);  // +1 for subservice
+  if (!service_send(conn, packet, 50)) {
+      csp_buffer_free(packet);
   }
 
+  if (status == 0) {
+      reboot_system(reboot_type);
+  }
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Reply with the counters of a service or one of its subservices
+ * @details
+ *      Request data is the port, the metrics_scope and the subtype (ignored
+ *      for METRICS_SERVICE). The reply is the METRICS_WIRE_WORDS counters of
+ *      service_metrics in order, each a network order uint32_t. Status is -1
+ *      if nothing was recorded for it yet, with every counter 0
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet, reused for the reply
+ * @return SAT_returnState
+ *      success report
+ */
+static SAT_returnState general_get_metrics(csp_conn_t *conn, csp_packet_t *packet) {
+  uint8_t port = packet->data[IN_DATA_BYTE];
+  uint8_t scope = packet->data[IN_DATA_BYTE + 1];
+  uint8_t subtype = packet->data[IN_DATA_BYTE + 2];
+  service_metrics metrics;
+  int8_t status = 0;
+
+  if (scope > METRICS_SUBSERVICE ||
+      metrics_get((metrics_scope)scope, port, subtype, &metrics) != SATR_OK) {
+    memset(&metrics, 0, sizeof(metrics));
+    status = -1;
+  }
+
+  uint32_t *words = (uint32_t *)&metrics;
+  int i;
+  for (i = 0; i < METRICS_WIRE_WORDS; i++) {
+    words[i] = csp_hton32(words[i]);
+  }
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  memcpy(&packet->data[OUT_DATA_BYTE], &metrics, sizeof(metrics));
+  set_packet_length(packet, sizeof(int8_t) + sizeof(metrics) + 1);  // +1 for subservice
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Clear every service metric
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet, reused for the reply
+ * @return SAT_returnState
+ *      success report
+ */
+static SAT_returnState general_reset_metrics(csp_conn_t *conn, csp_packet_t *packet) {
+  int8_t status = 0;
+  metrics_reset();
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + 1);  // +1 for subservice
   return SATR_OK;
 }
 
 /**
  * @brief
- *      FreeRTOS general server task
+ *      Reply with the heap use and the stack use of the counted tasks
  * @details
- *      Accepts incoming csp connections to perform tasks not covered by other services
- * @param void* param
- * @return None
+ *      Request data is the first census slot to report. The reply is the
+ *      free and minimum ever free heap bytes (uint32_t), the number of
+ *      census slots and the number of tasks that follow (uint8_t). Each task
+ *      is its slot (uint8_t), CENSUS_NAME_LEN bytes of name, its stack depth
+ *      and the fewest stack words it ever left free (uint16_t). At most
+ *      CENSUS_PAGE_LEN tasks are sent, ask again from the slot after the
+ *      last one for the rest. All network order
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet, reused for the reply
+ * @return SAT_returnState
+ *      success report
  */
-void general_service(void * param) {
-    csp_socket_t *sock;
-    sock = csp_socket(CSP_SO_RDPREQ); // require RDP connection
-    csp_bind(sock, TC_GENERAL_SERVICE);
-    csp_listen(sock, SERVICE_BACKLOG_LEN);
-
-    for(;;) {
-        csp_packet_t *packet;
-        if ((conn = csp_accept(sock, CSP_MAX_TIMEOUT)) == NULL) {
-          /* timeout */
-          continue;
-        }
-        while ((packet = csp_read(conn, 50)) != NULL) {
-          if (general_app(packet) != SATR_OK) {
-            // something went wrong, this shouldn't happen
-            csp_buffer_free(packet);
-          } else {
-              if (!csp_send(conn, packet, 50)) {
-                  csp_buffer_free(packet);
-              }
-          }
-        }
-        csp_close(conn);
+static SAT_returnState general_get_task_census(csp_conn_t *conn, csp_packet_t *packet) {
+  uint8_t slot = packet->data[IN_DATA_BYTE];
+  uint8_t *out = &packet->data[OUT_DATA_BYTE];
+  int8_t status = 0;
+  uint32_t free_now, free_min;
+
+  census_heap(&free_now, &free_min);
+  free_now = csp_hton32(free_now);
+  free_min = csp_hton32(free_min);
+  memcpy(out, &free_now, sizeof(uint32_t));
+  memcpy(out + sizeof(uint32_t), &free_min, sizeof(uint32_t));
+  out[2 * sizeof(uint32_t)] = census_task_count();
+
+  uint8_t count = 0;
+  uint8_t *entry_out = out + CENSUS_HEADER_LEN;
+  for (; slot < census_task_count() && count < CENSUS_PAGE_LEN; slot++) {
+    census_entry entry;
+    if (census_sample_task(slot, &entry) != SATR_OK) {
+      continue;
     }
+    uint16_t depth = csp_hton16(entry.stack_depth);
+    uint16_t stack_free = csp_hton16(entry.stack_free);
+    entry_out[0] = slot;
+    strncpy((char *)&entry_out[1], entry.name, CENSUS_NAME_LEN);
+    memcpy(&entry_out[1 + CENSUS_NAME_LEN], &depth, sizeof(uint16_t));
+    memcpy(&entry_out[1 + CENSUS_NAME_LEN + sizeof(uint16_t)], &stack_free, sizeof(uint16_t));
+    entry_out += CENSUS_ENTRY_LEN;
+    count++;
+  }
+  out[2 * sizeof(uint32_t) + 1] = count;
+
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + CENSUS_HEADER_LEN + count * CENSUS_ENTRY_LEN +
+                                1);  // +1 for subservice
+  return SATR_OK;
 }
 
 /**
  * @brief
- *      Handle incoming csp_packet_t
+ *      Reply with the use of the CSP buffer pool by the services
  * @details
- *      Takes a csp packet destined for the general service handler,
- *              and will handle the packet based on it's subservice type.
+ *      The reply is the pool size, the buffers free now and the fewest ever
+ *      free (uint16_t), then for each service_buffer_tier the requests and
+ *      the failed requests (uint32_t). All network order
  * @param csp_packet_t *packet
- *              Incoming CSP packet - we can be sure that this packet is
- *              valid and destined for this service.
+ *              Incoming CSP packet, reused for the reply
  * @return SAT_returnState
  *      success report
  */
-SAT_returnState general_app(csp_packet_t *packet) {
-  uint8_t ser_subtype = (uint8_t)packet->data[SUBSERVICE_BYTE];
-  int8_t status;
-  char reboot_type;
-
-  switch (ser_subtype) {
-    case REBOOT:
-
-      reboot_type = packet->data[IN_DATA_BYTE];
-
-      switch(reboot_type) {
-      case 'A':
-      case 'B':
-      case 'G':
-          status = 0;
-          break;
-      default:
-          status = -1;
-          break;
-      }
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      set_packet_length(packet, sizeof(int8_t) + 1);  // +1 for subservice
-      csp_send(conn, packet, 50);
-
-      if (status == 0) {
-          reboot_system(reboot_type);
-      }
+static SAT_returnState general_get_buffer_stats(csp_conn_t *conn, csp_packet_t *packet) {
+  service_buffer_stats stats;
+  uint8_t *out = &packet->data[OUT_DATA_BYTE];
+  int8_t status = 0;
+  int i;
 
-      break;
+  service_buffer_stats_get(&stats);
+  uint16_t words16[3] = {csp_hton16(stats.pool), csp_hton16(stats.free_now),
+                         csp_hton16(stats.free_min)};
+  memcpy(out, words16, sizeof(words16));
+  out += sizeof(words16);
+  for (i = 0; i < SERVICE_BUF_TIERS; i++) {
+    uint32_t counts[2] = {csp_hton32(stats.tiers[i].gets), csp_hton32(stats.tiers[i].failures)};
+    memcpy(out, counts, sizeof(counts));
+    out += sizeof(counts);
+  }
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + SERVICE_BUF_STATS_WIRE_SIZE + 1);  // +1 for subservice
+  return SATR_OK;
+}
 
-    default:
-      ex2_log("No such subservice\n");
-      return SATR_PKT_ILLEGAL_SUBSERVICE;
+/**
+ * @brief
+ *      Run a list of commands to any services back to back
+ * @details
+ *      Request data is the COMMAND_LIST_* flags and the step count, then
+ *      each step as its service port, the length of its command and the
+ *      command laid out from the subservice byte, as it would be sent on
+ *      its own. The whole list is checked before anything runs, so a
+ *      malformed list runs no step. Steps run in order with the privileges
+ *      of the sender and stop at the first failure unless
+ *      COMMAND_LIST_CONTINUE is set. There is no undo of the steps that ran.
+ *      The reply is the number of steps run and the status of each (int8_t).
+ *      Status is -1 if the list was malformed or any step failed
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet, reused for the reply
+ * @return SAT_returnState
+ *      success report
+ */
+static SAT_returnState general_command_list(csp_conn_t *conn, csp_packet_t *packet) {
+  uint8_t flags = packet->data[IN_DATA_BYTE];
+  uint8_t count = packet->data[IN_DATA_BYTE + 1];
+  uint16_t offsets[COMMAND_LIST_MAX_STEPS];
+  int8_t statuses[COMMAND_LIST_MAX_STEPS];
+  uint16_t pos = IN_DATA_BYTE + 2;
+  uint8_t run = 0;
+  int8_t status = 0;
+  int i;
+
+  if (count > COMMAND_LIST_MAX_STEPS) {
+    status = -1;
+  }
+  for (i = 0; status == 0 && i < count; i++) {
+    if (pos + COMMAND_STEP_HEADER_LEN > packet->length ||
+        packet->data[pos + 1] == 0 ||
+        pos + COMMAND_STEP_HEADER_LEN + packet->data[pos + 1] > packet->length) {
+      status = -1;
+    } else {
+      offsets[i] = pos;
+      pos += COMMAND_STEP_HEADER_LEN + packet->data[pos + 1];
+    }
   }
+  if (pos != packet->length) {
+    status = -1;
+  }
+
+  for (i = 0; status == 0 && i < count; i++) {
+    const uint8_t *step = &packet->data[offsets[i]];
+    statuses[run++] = service_run_step(conn, packet->id, step[0], step + COMMAND_STEP_HEADER_LEN,
+                                       step[1]);
+    if (statuses[i] != 0 && !(flags & COMMAND_LIST_CONTINUE)) {
+      break;
+    }
+  }
+  for (i = 0; i < run; i++) {
+    if (statuses[i] != 0) {
+      status = -1;
+    }
+  }
+
+  packet->data[OUT_DATA_BYTE] = run;
+  memcpy(&packet->data[OUT_DATA_BYTE + 1], statuses, run);
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + 1 + run + 1);  // +1 for subservice
   return SATR_OK;
 }
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2021  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file hk_delta.c
+ * @author Dustin Wagner
+ * @date 2021-06-14
+ */
+#include "housekeeping/hk_delta.h"
+
+#include <stddef.h>
+
+/**
+ * @brief
+ *      Private. Write a varint
+ * @param value
+ *      The value to write
+ * @param out
+ *      Buffer to write into
+ * @param pos
+ *      Position in out. Advanced past the varint
+ * @param out_max
+ *      Size of out
+ * @return int
+ *      1 if it fit, 0 otherwise
+ */
+static int put_varint(uint16_t value, uint8_t *out, uint16_t *pos, uint16_t out_max) {
+  do {
+    if (*pos >= out_max) {
+      return 0;
+    }
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    out[(*pos)++] = byte | (value ? 0x80 : 0);
+  } while (value);
+  return 1;
+}
+
+/**
+ * @brief
+ *      Private. Read a varint
+ * @param in
+ *      Buffer to read from
+ * @param pos
+ *      Position in in. Advanced past the varint
+ * @param in_len
+ *      Size of in
+ * @param value
+ *      Where to put the value read
+ * @return int
+ *      1 on success, 0 if in is truncated or the value overflows
+ */
+static int get_varint(const uint8_t *in, uint16_t *pos, uint16_t in_len, uint16_t *value) {
+  uint32_t result = 0;
+  uint8_t shift = 0;
+  uint8_t byte;
+  do {
+    if (*pos >= in_len || shift > 14) {
+      return 0;
+    }
+    byte = in[(*pos)++];
+    result |= (uint32_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  if (result > UINT16_MAX) {
+    return 0;
+  }
+  *value = (uint16_t)result;
+  return 1;
+}
+
+/**
+ * @brief
+ *      Encode a record as zero run/literal tokens of its XOR against prev
+ * @details
+ *      A single zero byte between non zero bytes is kept in the literal since
+ *      splitting the literal would cost more than the byte it saves
+ * @param prev
+ *      Reference record of len bytes. NULL encodes a keyframe
+ * @param cur
+ *      Record to encode of len bytes
+ * @param len
+ *      Size of the record
+ * @param out
+ *      Where to put the encoded record
+ * @param out_max
+ *      Size of out. HK_DELTA_MAX_SIZE(len) always fits
+ * @return uint16_t
+ *      Number of bytes written. 0 if out_max was too small
+ */
+uint16_t hk_delta_encode(const uint8_t *prev, const uint8_t *cur, uint16_t len,
+                         uint8_t *out, uint16_t out_max) {
+  uint16_t pos = 0;
+  uint16_t i = 0;
+
+#define DELTA_BYTE(n) ((uint8_t)(cur[(n)] ^ (prev ? prev[(n)] : 0)))
+  do {
+    uint16_t zeros = 0;
+    while (i + zeros < len && DELTA_BYTE(i + zeros) == 0) {
+      zeros++;
+    }
+    i += zeros;
+
+    uint16_t literals = 0;
+    while (i + literals < len) {
+      if (DELTA_BYTE(i + literals) == 0 &&
+          (i + literals + 1 == len || DELTA_BYTE(i + literals + 1) == 0)) {
+        break;
+      }
+      literals++;
+    }
+
+    if (!put_varint(zeros, out, &pos, out_max) ||
+        !put_varint(literals, out, &pos, out_max) ||
+        pos + literals > out_max) {
+      return 0;
+    }
+    uint16_t j;
+    for (j = 0; j < literals; j++) {
+      out[pos++] = DELTA_BYTE(i + j);
+    }
+    i += literals;
+  } while (i < len);
+#undef DELTA_BYTE
+
+  return pos;
+}
+
+/**
+ * @brief
+ *      Decode a record encoded by hk_delta_encode
+ * @param prev
+ *      Reference record the encoder used. NULL for a keyframe
+ * @param in
+ *      Encoded record
+ * @param in_len
+ *      Bytes available in in. May be more than the record used
+ * @param out
+ *      Where to put the decoded record of len bytes. May not alias prev
+ * @param len
+ *      Size of the record
+ * @return uint16_t
+ *      Number of bytes of in consumed. 0 if in is malformed
+ */
+uint16_t hk_delta_decode(const uint8_t *prev, const uint8_t *in, uint16_t in_len,
+                         uint8_t *out, uint16_t len) {
+  uint16_t pos = 0;
+  uint16_t i = 0;
+
+  do {
+    uint16_t zeros;
+    uint16_t literals;
+    if (!get_varint(in, &pos, in_len, &zeros) ||
+        !get_varint(in, &pos, in_len, &literals) ||
+        (uint32_t)i + zeros + literals > len ||
+        pos + literals > in_len) {
+      return 0;
+    }
+    uint16_t j;
+    for (j = 0; j < zeros; j++, i++) {
+      out[i] = prev ? prev[i] : 0;
+    }
+    for (j = 0; j < literals; j++, i++) {
+      out[i] = in[pos++] ^ (prev ? prev[i] : 0);
+    }
+  } while (i < len);
+
+  return pos;
+}
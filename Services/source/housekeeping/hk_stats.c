@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2021  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file hk_stats.c
+ * @date 2021-06-21
+ */
+#include "housekeeping/hk_stats.h"
+
+#include <FreeRTOS.h>
+#include <os_task.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef enum { HK_STAT_U16, HK_STAT_I16, HK_STAT_F32 } hk_stat_type;
+
+typedef struct {
+  uint8_t source;      //hk_source the field comes from
+  uint8_t type;        //hk_stat_type
+  uint16_t offset;     //offset of the field in All_systems_housekeeping
+  float threshold;     //default threshold, in the field's own units
+} hk_stat_def;
+
+static const hk_stat_def hk_stat_defs[HK_STAT_NUM_FIELDS] = {
+  [HK_STAT_EPS_VBATT] = {HK_EPS, HK_STAT_U16,
+                         offsetof(All_systems_housekeeping, EPS_hk.vBatt), 7000},    //mV
+  [HK_STAT_EPS_CUR_SOLAR] = {HK_EPS, HK_STAT_U16,
+                             offsetof(All_systems_housekeeping, EPS_hk.curSolar), 10}, //mA, eclipse
+  [HK_STAT_EPS_CUR_BATT_OUT] = {HK_EPS, HK_STAT_U16,
+                                offsetof(All_systems_housekeeping, EPS_hk.curBattOut), 1000}, //mA
+  [HK_STAT_ATHENA_TEMP_0] = {HK_ATHENA, HK_STAT_I16,
+                             offsetof(All_systems_housekeeping, Athena_hk.temparray[0]), 60},
+  [HK_STAT_ATHENA_TEMP_1] = {HK_ATHENA, HK_STAT_I16,
+                             offsetof(All_systems_housekeeping, Athena_hk.temparray[1]), 60},
+  [HK_STAT_SBAND_PA_TEMP] = {HK_SBAND, HK_STAT_F32,
+                             offsetof(All_systems_housekeeping, S_band_hk.PA_Temp), 60.0f}, //C
+  [HK_STAT_SBAND_TOP_TEMP] = {HK_SBAND, HK_STAT_F32,
+                              offsetof(All_systems_housekeeping, S_band_hk.Top_Temp), 60.0f}, //C
+  [HK_STAT_SBAND_BAT_VOLTAGE] = {HK_SBAND, HK_STAT_F32,
+                                 offsetof(All_systems_housekeeping, S_band_hk.Bat_Voltage), 7.0f}, //V
+};
+
+typedef struct {
+  uint32_t count;
+  uint32_t crossings;
+  float min;
+  float max;
+  float mean;
+  float m2;  //sum of squared deviations from mean
+} hk_stat_bucket;
+
+/*bucket for time t is t / HK_STATS_BUCKET_S, kept at that index modulo
+  HK_STATS_BUCKETS. bucket_epoch says which bucket a position currently holds*/
+static uint32_t bucket_epoch[HK_STATS_BUCKETS];
+static uint8_t bucket_used[HK_STATS_BUCKETS];
+static hk_stat_bucket buckets[HK_STATS_BUCKETS][HK_STAT_NUM_FIELDS];
+
+static float thresholds[HK_STAT_NUM_FIELDS];
+static int8_t last_side[HK_STAT_NUM_FIELDS]; //-1 unknown, 0 below threshold, 1 at or above
+static uint8_t stats_ready = 0;
+
+/**
+ * @brief
+ *      Private. Load the default thresholds on first use
+ * @attention
+ *      Call inside a critical section
+ */
+static void init_stats(void) {
+  int i;
+  if (stats_ready) {
+    return;
+  }
+  for (i = 0; i < HK_STAT_NUM_FIELDS; i++) {
+    thresholds[i] = hk_stat_defs[i].threshold;
+    last_side[i] = -1;
+  }
+  stats_ready = 1;
+}
+
+static float read_field(const All_systems_housekeeping *hk, const hk_stat_def *def) {
+  const uint8_t *field = (const uint8_t *)hk + def->offset;
+  uint16_t u16;
+  int16_t i16;
+  float f32;
+  switch (def->type) {
+    case HK_STAT_U16:
+      memcpy(&u16, field, sizeof(u16));
+      return u16;
+    case HK_STAT_I16:
+      memcpy(&i16, field, sizeof(i16));
+      return i16;
+    default:
+      memcpy(&f32, field, sizeof(f32));
+      return f32;
+  }
+}
+
+/**
+ * @brief
+ *      Add a stored sample to the statistics
+ * @details
+ *      Only fields of sources that were sampled and answered for this record
+ *      are added, so values carried over from an earlier record aren't
+ *      counted twice
+ * @param hk
+ *      The sample, in host order
+ */
+void hk_stats_add(const All_systems_housekeeping *hk) {
+  uint32_t epoch = hk->hk_timeorder.UNIXtimestamp / HK_STATS_BUCKET_S;
+  uint16_t position = epoch % HK_STATS_BUCKETS;
+  uint8_t fresh = hk->hk_timeorder.sampled & hk->hk_timeorder.valid;
+  int i;
+
+  taskENTER_CRITICAL();
+  init_stats();
+  if (!bucket_used[position] || bucket_epoch[position] != epoch) {
+    if (bucket_used[position] && bucket_epoch[position] > epoch) {
+      taskEXIT_CRITICAL(); //older than anything kept
+      return;
+    }
+    memset(buckets[position], 0, sizeof(buckets[position]));
+    bucket_epoch[position] = epoch;
+    bucket_used[position] = 1;
+  }
+
+  for (i = 0; i < HK_STAT_NUM_FIELDS; i++) {
+    const hk_stat_def *def = &hk_stat_defs[i];
+    if (!(fresh & (1 << def->source))) {
+      continue;
+    }
+    float value = read_field(hk, def);
+    hk_stat_bucket *bucket = &buckets[position][i];
+
+    if (bucket->count == 0 || value < bucket->min) {
+      bucket->min = value;
+    }
+    if (bucket->count == 0 || value > bucket->max) {
+      bucket->max = value;
+    }
+    bucket->count++;
+    float delta = value - bucket->mean;
+    bucket->mean += delta / bucket->count;
+    bucket->m2 += delta * (value - bucket->mean);
+
+    int8_t side = (value >= thresholds[i]) ? 1 : 0;
+    if (last_side[i] >= 0 && side != last_side[i]) {
+      bucket->crossings++;
+    }
+    last_side[i] = side;
+  }
+  taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief
+ *      Statistics of one field over a time window
+ * @details
+ *      Merges every bucket overlapping [start, end], so the window is widened
+ *      to whole buckets
+ * @param field
+ *      hk_stat_field
+ * @param start
+ *      Earliest timestamp wanted
+ * @param end
+ *      Latest timestamp wanted
+ * @param out
+ *      The statistics. count is 0 if there were no samples
+ * @return Result
+ *      FAILURE if field or window are invalid
+ */
+Result hk_stats_get(uint8_t field, uint32_t start, uint32_t end, hk_field_stats *out) {
+  if (field >= HK_STAT_NUM_FIELDS || end < start) {
+    return FAILURE;
+  }
+  uint32_t first = start / HK_STATS_BUCKET_S;
+  uint32_t last = end / HK_STATS_BUCKET_S;
+  if (last - first >= HK_STATS_BUCKETS) { //nothing older is kept
+    first = last - (HK_STATS_BUCKETS - 1);
+  }
+
+  //merged with Chan's parallel update, in double so long windows stay exact
+  double count = 0;
+  double mean = 0;
+  double m2 = 0;
+  memset(out, 0, sizeof(*out));
+
+  uint32_t epoch = first;
+  taskENTER_CRITICAL();
+  do {
+    uint16_t position = epoch % HK_STATS_BUCKETS;
+    const hk_stat_bucket *bucket = &buckets[position][field];
+    if (bucket_used[position] && bucket_epoch[position] == epoch && bucket->count > 0) {
+      if (out->count == 0 || bucket->min < out->min) {
+        out->min = bucket->min;
+      }
+      if (out->count == 0 || bucket->max > out->max) {
+        out->max = bucket->max;
+      }
+      out->count += bucket->count;
+      out->crossings += bucket->crossings;
+
+      double n = bucket->count;
+      double delta = bucket->mean - mean;
+      double total = count + n;
+      mean += delta * n / total;
+      m2 += bucket->m2 + delta * delta * count * n / total;
+      count = total;
+    }
+  } while (epoch++ != last);
+  taskEXIT_CRITICAL();
+
+  if (count > 0) {
+    if (m2 < 0) { //rounding
+      m2 = 0;
+    }
+    out->mean = (float)mean;
+    out->stddev = (float)sqrt(m2 / count);
+  }
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Change the threshold crossings of a field are counted against
+ * @details
+ *      Counts already in the buckets were against the old threshold
+ * @param field
+ *      hk_stat_field
+ * @param threshold
+ *      New threshold in the field's own units
+ * @return Result
+ *      FAILURE if field is unknown
+ */
+Result hk_stats_set_threshold(uint8_t field, float threshold) {
+  if (field >= HK_STAT_NUM_FIELDS) {
+    return FAILURE;
+  }
+  taskENTER_CRITICAL();
+  init_stats();
+  thresholds[field] = threshold;
+  last_side[field] = -1;
+  taskEXIT_CRITICAL();
+  return SUCCESS;
+}
@@ -23,368 +23,1326 @@
 #include <os_semphr.h>
 #include <csp/csp.h>
 #include <csp/csp_endian.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "housekeeping/hk_delta.h"
+#include "housekeeping/hk_stats.h"
+#include "util/service_buffers.h"
+#include "util/service_metrics.h"
 #include "util/service_utilities.h"
+#include "util/task_census.h"
+#include "util/wire_endian.h"
 #include "services.h"
 
 static uint8_t SID_byte = 1;
 
-/*for housekeeping temporary file creation
-  naming convention becomes base_file + current_file + extension
-  e.g. tempHKdata134.TMP
+/*housekeeping is stored in a single preallocated ring file
+  layout is one hk_ring_header followed by MAX_FILES fixed size records
+  record for slot N lives at sizeof(hk_ring_header) + (N - 1) * HK_RECORD_SIZE.
+  records are stored in wire format, network order and packed in the order
+  below, so a record is read from storage straight into a downlink packet
 */
-uint16_t MAX_FILES = 500; //currently arbitrary number
-char base_file[] = "tempHKdata"; //path may need to be changed
-char extension[] = ".TMP";
+#define HK_RING_MAGIC 0x484B5247 //"HKRG"
+#define HK_RING_VERSION 5
+
+//size of one stored record. Must match the order of serialize_hk_record
+//TODO:
+//sizeof(adcs_housekeeping) +
+#define HK_RECORD_SIZE (sizeof(hk_time_and_order) +              \
+                        sizeof(athena_housekeeping) +            \
+                        sizeof(eps_instantaneous_telemetry_t) +  \
+                        sizeof(UHF_housekeeping) +               \
+                        sizeof(Sband_Housekeeping))
+
+//offset of each subsystem in a wire record
+#define HK_WIRE_ATHENA (sizeof(hk_time_and_order))
+#define HK_WIRE_EPS (HK_WIRE_ATHENA + sizeof(athena_housekeeping))
+#define HK_WIRE_UHF (HK_WIRE_EPS + sizeof(eps_instantaneous_telemetry_t))
+#define HK_WIRE_SBAND (HK_WIRE_UHF + sizeof(UHF_housekeeping))
+
+//wire layout of the record header, see wire_endian.h
+#define HK_TIMEORDER_WIRE(X) X(UNIXtimestamp, 32) X(dataPosition, 16) X(valid, 8) X(sampled, 8)
+WIRE_DEFINE_SWAP(hk_timeorder, hk_time_and_order, HK_TIMEORDER_WIRE)
+
+#define HK_CURSOR_WIRE(X) X(timestamp, 32) X(slot, 16) X(generation, 16)
+WIRE_DEFINE_SWAP(hk_cursor, hk_cursor, HK_CURSOR_WIRE)
+
+//where each hk_source lives in a wire record, for GET_HK_RANGE field masks
+typedef struct {
+  uint16_t offset;
+  uint16_t size;
+} hk_wire_field;
+
+static const hk_wire_field hk_wire_fields[HK_NUM_SOURCES] = {
+  [HK_ATHENA] = {HK_WIRE_ATHENA, sizeof(athena_housekeeping)},
+  [HK_EPS] = {HK_WIRE_EPS, sizeof(eps_instantaneous_telemetry_t)},
+  [HK_UHF] = {HK_WIRE_UHF, sizeof(UHF_housekeeping)},
+  [HK_SBAND] = {HK_WIRE_SBAND, sizeof(Sband_Housekeeping)},
+};
+
+//GET_HK_RANGE loads each record into the worker's scratch arena. GET_HK_BATCH
+//keeps two there and its offset table in what is left
+typedef char hk_record_fits_scratch[(HK_RECORD_SIZE <= SERVICE_SCRATCH_SIZE) ? 1 : -1];
+typedef char hk_batch_fits_scratch[(2 * HK_RECORD_SIZE + 2 * sizeof(uint16_t) <= SERVICE_SCRATCH_SIZE) ? 1 : -1];
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;       //HK_RING_MAGIC. anything else means the file is not ours
+  uint16_t version;     //HK_RING_VERSION. bumped when record layout changes
+  uint16_t record_size; //HK_RECORD_SIZE when the file was created
+  uint16_t max_slots;   //MAX_FILES when the header was last written
+  uint16_t head;        //next slot to be written (current_file). 1 indexed
+  uint16_t count;       //number of valid records. oldest (tail) is head - count
+  uint32_t generation;  //bumped each time stored records are discarded
+} hk_ring_header;
+
+//number of slots in ring. a record is stored whenever any source is due, so
+//with the default periods that is every 5 s, at the EPS rate, and 3000 slots
+//keep a little over 4 hours (~1.1MB of ring, ~18KB of RAM index)
+uint16_t MAX_FILES = 3000;
+char ring_file[] = "HKdata.RNG"; //path may need to be changed
+FILE *ring_fp = NULL; //kept open for the life of the service. guarded by f_count_lock
 uint16_t current_file = 1;  //Increments after file write. loops back at MAX_FILES
                             //1 indexed
+uint16_t stored_count = 0;  //number of valid slots in the ring. saturates at MAX_FILES
 
-uint32_t *timestamps; //This is a dynamic array to handle file search by timestamp
-uint16_t hk_timestamp_array_size = 0; //NOT BYTES. stored as number of items. 1 indexed. 0 element unused
-
+/*write-through cache of the most recent records so requests for the latest
+  data are served without touching the filesystem. Entries are kept in write
+  order and hk_cache_next is where the next record will be placed
+*/
+#define HK_CACHE_DEFAULT 10 //records. ~3.6KB at 356 bytes each
+#define HK_CACHE_MAX 100    //upper bound accepted from SET_CACHE_SIZE
+uint8_t *hk_cache = NULL; //hk_cache_size wire records. lazily allocated. written under f_count_lock, see hk_seq
+uint16_t hk_cache_size = HK_CACHE_DEFAULT; //number of records cache can hold. 0 disables
+uint16_t hk_cache_count = 0; //number of valid records in cache
+uint16_t hk_cache_next = 0;  //0 indexed position of next write
+
+/*sidecar index of when each slot was written so before_time requests work
+  straight after boot. layout is one hk_index_header followed by MAX_FILES
+  hk_index_entry. entry for slot N lives at position N - 1 and is rewritten
+  with its record so the file never grows past the ring
+*/
+#define HK_INDEX_MAGIC 0x484B4958 //"HKIX"
+#define HK_INDEX_VERSION 1
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;       //HK_INDEX_MAGIC. anything else means the file is not ours
+  uint16_t version;     //HK_INDEX_VERSION. bumped when entry layout changes
+  uint16_t max_slots;   //MAX_FILES when the header was last written
+  uint32_t generation;  //must match ring header generation or index is rebuilt
+} hk_index_header;
+
+typedef struct __attribute__((packed)) {
+  uint32_t timestamp;   //UNIXtimestamp of the record in the slot
+  uint16_t slot;        //slot this entry describes. mismatch means never written
+} hk_index_entry;
+
+char index_file[] = "HKdata.IDX"; //path may need to be changed
+FILE *index_fp = NULL; //kept open for the life of the service. guarded by f_count_lock
+hk_index_entry *hk_index = NULL; //RAM copy of the index file. MAX_FILES entries
+uint32_t ring_generation = 0; //bumped each time stored records are discarded
+
+/*locking. the sampler and the commands changing the ring hold f_count_lock
+  while they write. requests never take it, so a long downlink can't hold up
+  the next sample:
+  - readers hold hk_read_lock, which keeps the ring size, hk_index and
+    hk_cache allocated while they are used and serializes ring_read_fp.
+    writers take it after f_count_lock, and only to open or resize
+  - the ring position, hk_index and hk_cache are changed by writers only
+    inside hk_publish_begin/end, a short critical section bumping hk_seq.
+    readers note hk_seq before a lookup and retry if it moved by the end
+  - a slot about to be overwritten is retired first, so a reader that
+    started before the overwrite always sees hk_seq move
+*/
 SemaphoreHandle_t f_count_lock;
+static SemaphoreHandle_t hk_read_lock = NULL;
+static FILE *ring_read_fp = NULL; //readers' own handle on the ring. guarded by hk_read_lock
+static volatile uint32_t hk_seq = 0; //bumped twice per publish
+#define HK_READ_RETRIES 4 //lookups raced by publishes before a read gives up
+
+/*growing the ring preallocates storage. that is left to a background task,
+  a step at a time, so resizing doesn't hold f_count_lock for long*/
+#define HK_STORAGE_STEP 50       //slots preallocated per step
+#define HK_STORAGE_PAUSE_MS 100  //gap between steps
+#define HK_STORAGE_STACK 256
+static uint16_t backed_slots = 0; //slots preallocated in both files. guarded by f_count_lock
+static TaskHandle_t hk_storage_handle = NULL;
+
+static SemaphoreHandle_t prv_get_count_lock() {
+  if (!f_count_lock) {
+    f_count_lock = xSemaphoreCreateMutex();
+  }
+  configASSERT(f_count_lock);
+  return f_count_lock;
+}
+
+static SemaphoreHandle_t prv_get_read_lock() {
+  if (!hk_read_lock) {
+    hk_read_lock = xSemaphoreCreateMutex();
+  }
+  configASSERT(hk_read_lock);
+  return hk_read_lock;
+}
+
+static inline void prv_get_lock(SemaphoreHandle_t lock) {
+  configASSERT(lock);
+  xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+static inline void prv_give_lock(SemaphoreHandle_t lock) {
+  configASSERT(lock);
+  xSemaphoreGive(lock);
+}
 
 /**
  * @brief
- *      gets the hk file id that holds a timestamp closest to that given
+ *      Start changing state readers look up without f_count_lock
  * @attention
- *      Complex algorithm. should be thoroughly tested when possible
- * @param timestamp
- *      This is the time from which the file is desired
- * @return uint16_t
- *      File ID if found. 0 if no file found
+ *      Caller must hold f_count_lock. Keep the section to RAM updates, it is
+ *      a critical section
  */
-uint16_t get_file_id_from_timestamp(uint32_t timestamp) {
-  uint32_t threshold = 15; //How many seconds timestamps need to be within. Currently assumes 30 second hk intervals
-  //perform leftmost binary search
-  uint16_t left;
-  uint16_t right;
-  uint16_t middle;
-  if(timestamps == NULL) {
-    return 0;
+static inline void hk_publish_begin(void) {
+  taskENTER_CRITICAL();
+  hk_seq++;
+  __asm__ volatile("" ::: "memory");
+}
+
+static inline void hk_publish_end(void) {
+  __asm__ volatile("" ::: "memory");
+  hk_seq++;
+  taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief
+ *      Note the state a lookup is about to use
+ * @return uint32_t
+ *      Pass to hk_seq_moved once the lookup is done
+ */
+static inline uint32_t hk_seq_begin(void) {
+  uint32_t seq = hk_seq;
+  __asm__ volatile("" ::: "memory");
+  return seq;
+}
+
+/**
+ * @return int
+ *      1 if something was published since hk_seq_begin, so the lookup must be
+ *      repeated
+ */
+static inline int hk_seq_moved(uint32_t seq) {
+  __asm__ volatile("" ::: "memory");
+  return hk_seq != seq;
+}
+
+/*collection fans every device out to its own poller task so a slow bus only
+  costs its own deadline instead of adding to every other device's latency
+*/
+#define HK_POLL_DEADLINE_MS 200 //longest a sample waits for any one device
+#define HK_POLLER_STACK 256
+
+typedef struct {
+  const char *name;         //task name
+  int (*poll)(void *out);   //driver call. 0 on success
+  void *staging;            //where poller task puts the driver result
+  size_t size;              //size of staging and of the field in the record
+  size_t offset;            //offset of the field in All_systems_housekeeping
+  TaskHandle_t task;        //poller task. NULL polls inline from the collector
+  SemaphoreHandle_t done;   //given by the poller once staging is written
+  int busy;                 //request whose done isn't taken yet. only the collector changes it
+  volatile int result;      //driver return code of the last poll
+} hk_poller;
+
+static athena_housekeeping athena_staging;
+static eps_instantaneous_telemetry_t eps_staging;
+static UHF_housekeeping uhf_staging;
+static Sband_Housekeeping sband_staging;
+
+static int poll_athena(void *out) { return Athena_getHK(out); }
+static int poll_eps(void *out) { return EPS_getHK(out); }
+static int poll_uhf(void *out) { return UHF_getHK(out); }
+static int poll_sband(void *out) { return HAL_S_getHK(out); }
+
+//TODO:
+//{"hk_adcs", poll_adcs, &adcs_staging, ...}
+static hk_poller hk_pollers[HK_NUM_SOURCES] = {
+  [HK_ATHENA] = {"hk_athena", poll_athena, &athena_staging, sizeof(athena_staging),
+                 offsetof(All_systems_housekeeping, Athena_hk)},
+  [HK_EPS] = {"hk_eps", poll_eps, &eps_staging, sizeof(eps_staging),
+              offsetof(All_systems_housekeeping, EPS_hk)},
+  [HK_UHF] = {"hk_uhf", poll_uhf, &uhf_staging, sizeof(uhf_staging),
+              offsetof(All_systems_housekeeping, UHF_hk)},
+  [HK_SBAND] = {"hk_sband", poll_sband, &sband_staging, sizeof(sband_staging),
+                offsetof(All_systems_housekeeping, S_band_hk)},
+};
+
+/*every source has its own sampling period. the sampler wakes once per
+  HK_SAMPLE_TICK_MS and stores one record with whichever sources are due.
+  sources not due carry their previous sample forward, see hk_timeorder.sampled.
+  the fastest period sets the store rate, so retention is MAX_FILES times it
+*/
+#define HK_SAMPLE_TICK_MS 1000 //resolution of hk_period_s
+#define HK_SAMPLER_STACK 300
+#define HK_PERIOD_MAX 86400 //seconds. one sample a day
+
+volatile uint32_t hk_period_s[HK_NUM_SOURCES] = { //seconds. 0 disables the source
+  [HK_ATHENA] = 30,
+  [HK_EPS] = 5,     //power changes fast
+  [HK_UHF] = 300,   //mostly configuration
+  [HK_SBAND] = 300, //mostly configuration
+};
+
+/**
+ * @brief
+ *      Seconds between stored records, the shortest enabled period
+ * @return uint32_t
+ *      HK_PERIOD_MAX if every source is disabled
+ */
+static uint32_t hk_record_period(void) {
+  uint32_t shortest = HK_PERIOD_MAX;
+  int i;
+  for (i = 0; i < HK_NUM_SOURCES; i++) {
+    uint32_t period = hk_period_s[i];
+    if (period != 0 && period < shortest) {
+      shortest = period;
+    }
+  }
+  return shortest;
+}
+
+static All_systems_housekeeping hk_latest; //last sample of every source. guarded by sample_lock
+static uint8_t hk_latest_wire[HK_RECORD_SIZE]; //hk_latest as stored. guarded by sample_lock
+static SemaphoreHandle_t sample_lock = NULL; //one collection at a time, pollers aren't reentrant
+
+/**
+ * @brief
+ *      FreeRTOS task polling one device whenever the collector asks
+ * @param param
+ *      The hk_poller this task serves
+ */
+static void hk_poller_task(void *param) {
+  hk_poller *poller = param;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    poller->result = poller->poll(poller->staging);
+    xSemaphoreGive(poller->done); //the collector clears busy once it takes this
   }
-  if (timestamps[current_file] == 0) { //haven't made full loop of storage
-    if (current_file == 1) { //base case. no files written
-      return 0;
+}
+
+/**
+ * @brief
+ *      Start one poller task per housekeeping source
+ * @details
+ *      A source whose task can't be created is polled inline instead
+ * @return SAT_returnState
+ *      success report
+ */
+static SAT_returnState start_hk_pollers(void) {
+  SAT_returnState state = SATR_OK;
+  int i;
+  for (i = 0; i < HK_NUM_SOURCES; i++) {
+    hk_poller *poller = &hk_pollers[i];
+    if (poller->task != NULL) {
+      continue;
+    }
+    poller->done = xSemaphoreCreateBinary();
+    if (poller->done == NULL ||
+        census_task_create((TaskFunction_t)hk_poller_task, poller->name, HK_POLLER_STACK,
+                           poller, NORMAL_SERVICE_PRIO, &poller->task) != pdPASS) {
+      ex2_log("FAILED TO CREATE TASK %s\n", poller->name);
+      poller->task = NULL;
+      state = SATR_ERROR;
     }
-    //not enough files written to use loop portion yet
-    left = 1;
-    right = current_file -1;
-  } else {
-    //These accomodate circular structure
-    left = current_file;
-    right = left + hk_timestamp_array_size - 1;
   }
+  return state;
+}
 
-  while (left < right) {
-    middle = (left + right) / 2;
-    if (timestamps[middle - (current_file - 1)] < timestamp) {
-      left = middle + 1;
-    } else {
-      right = middle;
+/**
+ * @brief
+ *      Private. Collect housekeeping information from each device in system
+ * @details
+ *      Every due device is polled at once by its own task. Devices that don't
+ *      answer within HK_POLL_DEADLINE_MS, or that report an error, have their
+ *      field zeroed and their bit cleared in hk_timeorder.valid. A device still
+ *      stuck from a previous sample is not asked again until it returns.
+ *      Fields of devices that aren't due are left as they are
+ * @param all_hk_data
+ *      pointer to struct of all the housekeeping data collected from components
+ * @param due
+ *      bit per hk_source to poll
+ * @return Result
+ *      FAILURE if any due device is missing from the sample, SUCCESS otherwise
+ */
+Result collect_hk_from_devices(All_systems_housekeeping* all_hk_data, uint8_t due) {
+  uint8_t requested = 0;
+  int i;
+
+  /*populate struct by asking every due poller at once*/
+  for (i = 0; i < HK_NUM_SOURCES; i++) {
+    hk_poller *poller = &hk_pollers[i];
+    if (!(due & (1 << i))) {
+      continue;
+    } else if (poller->task == NULL) {
+      poller->result = poller->poll(poller->staging);
+      requested |= 1 << i;
+    } else if (!poller->busy || xSemaphoreTake(poller->done, 0) == pdTRUE) {
+      //idle, or a late poll has since finished and its result is dropped
+      poller->busy = 1;
+      xTaskNotifyGive(poller->task);
+      requested |= 1 << i;
     }
   }
-  uint16_t true_position = left - (current_file - 1);
-  if (true_position > 1) {
-    if (timestamp - timestamps[true_position - 1] <= threshold) { //check lower neighbour if exists
-      return true_position - 1;
+
+  all_hk_data->hk_timeorder.valid &= ~due;
+  all_hk_data->hk_timeorder.sampled = due;
+  TickType_t deadline = xTaskGetTickCount() + pdMS_TO_TICKS(HK_POLL_DEADLINE_MS);
+  for (i = 0; i < HK_NUM_SOURCES; i++) {
+    hk_poller *poller = &hk_pollers[i];
+    uint8_t *field = (uint8_t *)all_hk_data + poller->offset;
+    int arrived = 0;
+    if (!(due & (1 << i))) {
+      continue;
     }
-    if (true_position != hk_timestamp_array_size) { //check self if won't cause underflow
-      if (timestamps[true_position] - timestamp <= threshold) {
-        return true_position;
-      }
-    } else { //left must be max index
-      if (timestamp > timestamps[true_position] && 
-      timestamp - timestamps[true_position] <= threshold) { //edge case left is max index. bigger value than at max
-        return true_position;
-      } else if (timestamps[true_position] - timestamp <= threshold) { //edge case left is max index. smaller value than at max
-        return true_position;
+    if (requested & (1 << i)) {
+      if (poller->task == NULL) {
+        arrived = 1;
+      } else {
+        TickType_t now = xTaskGetTickCount();
+        TickType_t wait = ((int32_t)(deadline - now) > 0) ? deadline - now : 0;
+        arrived = (xSemaphoreTake(poller->done, wait) == pdTRUE);
+        if (arrived) {
+          poller->busy = 0;
+        }
       }
     }
-  } else { //left must be min index
-    if (timestamps[true_position] - timestamp <= threshold) { //edge case left is min index. smaller than min
-      return true_position;
+    if (arrived && poller->result == 0) {
+      memcpy(field, poller->staging, poller->size);
+      all_hk_data->hk_timeorder.valid |= 1 << i;
+    } else {
+      memset(field, 0, poller->size); //never report a previous sample as current
+      ex2_log("%s %s\n", poller->name, arrived ? "returned error" : "missed deadline");
     }
   }
-  return 0;
-
 
+  return ((all_hk_data->hk_timeorder.valid & due) == due) ? SUCCESS : FAILURE;
 }
 
 /**
  * @brief
- *      Handles malloc, realloc, and free for array holding hk timestamps
- * @param num_items
- *      This is how many items should have space malloced
+ *      Write the ring header describing head and count to the ring file
+ * @attention
+ *      Caller must hold f_count_lock
  * @return Result
  *      FAILURE or SUCCESS
  */
-Result dynamic_timestamp_array_handler(uint16_t num_items) {
-  if (num_items == 0) {
-    if (timestamps != NULL) {
-      free(timestamps);
-    }
-    hk_timestamp_array_size = 0;
-    return SUCCESS;
+static Result write_ring_header(void) {
+  hk_ring_header header;
+  header.magic = HK_RING_MAGIC;
+  header.version = HK_RING_VERSION;
+  header.record_size = HK_RECORD_SIZE;
+  header.max_slots = MAX_FILES;
+  header.head = current_file;
+  header.count = stored_count;
+  header.generation = ring_generation;
+
+  if (fseek(ring_fp, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, ring_fp) != 1) {
+    ex2_log("Failed to write hk ring header\n");
+    return FAILURE;
   }
-  if (num_items != hk_timestamp_array_size) {
-    uint32_t *tmp = realloc(timestamps, sizeof(*timestamps * (num_items + 1))); //+1 to allow non-zero index room
-    if (!tmp) { 
-      return FAILURE;
-    }
-    timestamps = tmp;
-    uint16_t i = hk_timestamp_array_size + 1;
-    hk_timestamp_array_size = num_items;
+  fflush(ring_fp); //header is what makes the record visible after reboot
+  return SUCCESS;
+}
 
-    for (i; i <= num_items; i++) {
-      timestamps[i] = 0;
-    }
+/**
+ * @brief
+ *      Grow the ring file so every slot up to max_slots is backed by storage
+ * @details
+ *      Writes a single byte at the end of the last slot. The filesystem fills
+ *      the gap so slots never have to be allocated on the sampling path
+ * @attention
+ *      Caller must hold f_count_lock
+ * @param max_slots
+ *      Number of slots the file must be able to hold
+ * @return Result
+ *      FAILURE or SUCCESS
+ */
+static Result preallocate_ring(uint16_t max_slots) {
+  uint8_t zero = 0;
+  long end = (long)sizeof(hk_ring_header) + (long)max_slots * HK_RECORD_SIZE;
+
+  if (fseek(ring_fp, end - 1, SEEK_SET) != 0 ||
+      fwrite(&zero, sizeof(zero), 1, ring_fp) != 1) {
+    ex2_log("Failed to preallocate %hu hk slots\n", max_slots);
+    return FAILURE;
   }
   return SUCCESS;
 }
 
+/**
+ * @brief
+ *      How many writes ago a slot was written
+ * @attention
+ *      Caller must hold f_count_lock, or hk_read_lock and check hk_seq didn't move
+ * @param slot
+ *      The 1 indexed slot to check. Must be within 1 and MAX_FILES
+ * @return uint16_t
+ *      1 for the most recent record up to MAX_FILES for the oldest
+ */
+static uint16_t ring_slot_age(uint16_t slot) {
+  return (uint16_t)((current_file + MAX_FILES - slot - 1) % MAX_FILES) + 1;
+}
+
+/**
+ * @brief
+ *      Check whether a slot currently holds a record
+ * @attention
+ *      Caller must hold f_count_lock, or hk_read_lock and check hk_seq didn't move
+ * @param slot
+ *      The 1 indexed slot to check
+ * @return int
+ *      1 if the slot holds one of the last stored_count records, 0 otherwise
+ */
+static int ring_slot_is_valid(uint16_t slot) {
+  if (slot < 1 || slot > MAX_FILES) {
+    return 0;
+  }
+  return ring_slot_age(slot) <= stored_count;
+}
 
+/**
+ * @brief
+ *      Slot holding the n'th oldest stored record
+ * @attention
+ *      Caller must hold f_count_lock, or hk_read_lock and check hk_seq didn't move
+ * @param position
+ *      0 for the oldest record up to stored_count - 1 for the newest
+ * @return uint16_t
+ *      The 1 indexed slot
+ */
+static uint16_t ring_slot_at(uint16_t position) {
+  return (uint16_t)((current_file - 1 + MAX_FILES - stored_count + position) % MAX_FILES) + 1;
+}
 
 /**
  * @brief
- *      Private. Collect housekeeping information from each device in system
+ *      Write the index header to the index file
  * @attention
- *      Error testing and review recommended to check for possible shallow
- *      copies and resultant data loss and concurrency errors
- * @param all_hk_data
- *      pointer to struct of all the housekeeping data collected from components
+ *      Caller must hold f_count_lock
  * @return Result
  *      FAILURE or SUCCESS
  */
-Result collect_hk_from_devices(All_systems_housekeeping* all_hk_data) {
-  /*populate struct by calling appropriate functions*/
-  //TODO:
-  //ADCS_return = HAL_adcs_gethk(&all_hk_data->ADCS_hk);             //ADCS get housekeeeing
-  int Athena_return_code = Athena_getHK(&all_hk_data->Athena_hk);    //Athena get temperature
-
-  EPS_getHK(&all_hk_data->EPS_hk);                                   //EPS get housekeeping
-  UHF_return UHF_return_code = UHF_getHK(&all_hk_data->UHF_hk);      //UHF get housekeeping
-  STX_return STX_return_code = HAL_S_getHK(&all_hk_data->S_band_hk); //S_band get housekeeping
-  /*consider if struct should hold error codes returned from these functions*/
+static Result write_index_header(void) {
+  hk_index_header header;
+  header.magic = HK_INDEX_MAGIC;
+  header.version = HK_INDEX_VERSION;
+  header.max_slots = MAX_FILES;
+  header.generation = ring_generation;
+
+  if (fseek(index_fp, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, index_fp) != 1) {
+    ex2_log("Failed to write hk index header\n");
+    return FAILURE;
+  }
+  fflush(index_fp);
   return SUCCESS;
 }
 
 /**
  * @brief
- *      Check if file with given name exists
- * @param filename
- *      const char * to name of file to check
- * @return Found_file
- *      FILE_EXISTS or FILE_NOT_EXIST
+ *      Grow the index file so every slot up to max_slots has an entry
+ * @attention
+ *      Caller must hold f_count_lock
+ * @param max_slots
+ *      Number of entries the file must be able to hold
+ * @return Result
+ *      FAILURE or SUCCESS
  */
-Found_file exists(const char *filename){
-    FILE *file;
-    if((file = fopen(filename, "rb"))){ //open file to read binary
-        fclose(file);
-        return FILE_EXISTS;
-    }
-    return FILE_NOT_EXIST;
+static Result preallocate_index(uint16_t max_slots) {
+  uint8_t zero = 0;
+  long end = (long)sizeof(hk_index_header) + (long)max_slots * sizeof(hk_index_entry);
+
+  if (fseek(index_fp, end - 1, SEEK_SET) != 0 ||
+      fwrite(&zero, sizeof(zero), 1, index_fp) != 1) {
+    ex2_log("Failed to preallocate %hu hk index entries\n", max_slots);
+    return FAILURE;
+  }
+  return SUCCESS;
 }
 
 /**
  * @brief
- *      Write housekeeping data to the given file
- * @details
- *      Writes one struct to file for each subsystem present
- *      Order of writes must match the appropriate read function
- * @param filename
- *      const char * to name of file to write to
- * @param all_hk_data
- *      Struct containing structs of other hk data
+ *      Write the RAM index entry of a slot to the index file
+ * @attention
+ *      Caller must hold f_count_lock
+ * @param slot
+ *      The 1 indexed slot that was written
  * @return Result
  *      FAILURE or SUCCESS
  */
-Result write_hk_to_file(const char *filename, All_systems_housekeeping* all_hk_data) {
-  FILE *fout = fopen(filename, "wb"); //open or create file to write binary
-  if (fout == NULL) {
-    ex2_log("Failed to open or create file to write: '%c'\n", filename);
+static Result write_index_entry(uint16_t slot) {
+  hk_index_entry *entry = &hk_index[slot - 1];
+
+  long offset = (long)sizeof(hk_index_header) + (long)(slot - 1) * sizeof(*entry);
+  if (fseek(index_fp, offset, SEEK_SET) != 0 ||
+      fwrite(entry, sizeof(*entry), 1, index_fp) != 1) {
+    ex2_log("Failed to write hk index entry %hu\n", slot);
     return FAILURE;
   }
-  /*The order of writes and subsequent reads must match*/
-  //TODO:
-  //fwrite(&all_hk_data->ADCS_hk, sizeof(all_hk_data->ADCS_hk), 1, fout);
-  fwrite(&all_hk_data->hk_timeorder, sizeof(all_hk_data->hk_timeorder), 1, fout);
-  fwrite(&all_hk_data->Athena_hk, sizeof(all_hk_data->Athena_hk), 1, fout);
-  fwrite(&all_hk_data->EPS_hk, sizeof(all_hk_data->EPS_hk), 1, fout);
-  fwrite(&all_hk_data->UHF_hk, sizeof(all_hk_data->UHF_hk), 1, fout);
-  fwrite(&all_hk_data->S_band_hk, sizeof(all_hk_data->S_band_hk), 1, fout);
+  fflush(index_fp);
+  return SUCCESS;
+}
 
-  if(fwrite == 0) {
-    ex2_log("Failed to write to file: '%c'\n", filename);
+/**
+ * @brief
+ *      Resize the RAM index to hold max_slots entries
+ * @details
+ *      Only called when the ring is opened or MAX_FILES changes, never per
+ *      sample. New entries are marked as never written
+ * @attention
+ *      Caller must hold f_count_lock
+ * @param old_slots
+ *      Number of entries currently allocated
+ * @param max_slots
+ *      Number of entries required
+ * @return Result
+ *      FAILURE or SUCCESS
+ */
+static Result resize_index(uint16_t old_slots, uint16_t max_slots) {
+  hk_index_entry *tmp = realloc(hk_index, max_slots * sizeof(*hk_index));
+  if (!tmp) {
+    ex2_log("Error, failed to malloc hk index for %hu slots\n", max_slots);
     return FAILURE;
   }
-  fclose(fout);
+  hk_index = tmp;
+  if (max_slots > old_slots) {
+    memset(&hk_index[old_slots], 0, (max_slots - old_slots) * sizeof(*hk_index));
+  }
   return SUCCESS;
 }
 
 /**
  * @brief
- *      Read housekeeping data from given file
+ *      Rebuild the index from the timestamps held in the ring records
  * @details
- *      Reads one struct from file for each subsystem present
- *      Order of reads must match the appropriate write function
- * @param filename
- *      const char * to name of file to read from
- * @param all_hk_data
- *      Struct containing structs of other hk data
+ *      Only needed when the index file is missing or doesn't belong to the
+ *      ring generation, e.g. power was lost between the two header writes
+ * @attention
+ *      Caller must hold f_count_lock and hk_read_lock
  * @return Result
  *      FAILURE or SUCCESS
  */
-Result read_hk_from_file(const char *filename, All_systems_housekeeping* all_hk_data) {
-  if(!exists(filename)){
-    ex2_log("Attempted to read file that doesn't exist: '%c'\n", filename);
+static Result rebuild_index(void) {
+  ex2_log("Rebuilding hk index from %hu records\n", stored_count);
+  memset(hk_index, 0, MAX_FILES * sizeof(*hk_index));
+  if (preallocate_index(MAX_FILES) != SUCCESS ||
+      write_index_header() != SUCCESS) {
     return FAILURE;
   }
-  FILE *fin = fopen(filename, "rb"); //open file to read binary
-  if (fin == NULL) {
-    ex2_log("Failed to open file to read: '%c'\n", filename);
-    return FAILURE;
+  uint16_t i;
+  for (i = 0; i < stored_count; i++) {
+    uint16_t slot = ring_slot_at(i);
+    hk_time_and_order timeorder;
+    long offset = (long)sizeof(hk_ring_header) + (long)(slot - 1) * HK_RECORD_SIZE;
+    if (fseek(ring_fp, offset, SEEK_SET) != 0 ||
+        fread(&timeorder, sizeof(timeorder), 1, ring_fp) != 1) {
+      return FAILURE;
+    }
+    hk_index[slot - 1].timestamp = csp_ntoh32(timeorder.UNIXtimestamp);
+    hk_index[slot - 1].slot = slot;
+    if (write_index_entry(slot) != SUCCESS) {
+      return FAILURE;
+    }
   }
-  /*The order of writes and subsequent reads must match*/
-  //TODO:
-  //fread(&all_hk_data->ADCS_hk, sizeof(all_hk_data->ADCS_hk), 1, fin);
-  fread(&all_hk_data->hk_timeorder, sizeof(all_hk_data->hk_timeorder), 1, fin);
-  fread(&all_hk_data->Athena_hk, sizeof(all_hk_data->Athena_hk), 1, fin);
-  fread(&all_hk_data->EPS_hk, sizeof(all_hk_data->EPS_hk), 1, fin);
-  fread(&all_hk_data->UHF_hk, sizeof(all_hk_data->UHF_hk), 1, fin);
-  fread(&all_hk_data->S_band_hk, sizeof(all_hk_data->S_band_hk), 1, fin);
-
   return SUCCESS;
 }
 
-/*Helper function to find number of digits in number*/
-int num_digits(int num) {
-  uint16_t count = 0;
+/**
+ * @brief
+ *      Open the index file and load it into RAM in a single read
+ * @attention
+ *      Caller must hold f_count_lock and hk_read_lock. Ring file must already be open
+ * @return Result
+ *      FAILURE or SUCCESS
+ */
+static Result open_index_file(void) {
+  hk_index_header header;
 
-  while(num != 0) {
-    num /= 10;
-    ++count;
+  if (resize_index(0, MAX_FILES) != SUCCESS) {
+    return FAILURE;
   }
-  return count;
-}
 
-static SemaphoreHandle_t prv_get_count_lock() {
-  if (!f_count_lock) {
-    f_count_lock = xSemaphoreCreateMutex();
+  index_fp = fopen(index_file, "r+b"); //open existing index to read and write binary
+  if (index_fp != NULL) {
+    if (fread(&header, sizeof(header), 1, index_fp) == 1 &&
+        header.magic == HK_INDEX_MAGIC &&
+        header.version == HK_INDEX_VERSION &&
+        header.max_slots == MAX_FILES &&
+        header.generation == ring_generation &&
+        fread(hk_index, sizeof(*hk_index), MAX_FILES, index_fp) == MAX_FILES) {
+      uint16_t i;
+      for (i = 0; i < stored_count; i++) { //every stored record must be indexed
+        uint16_t slot = ring_slot_at(i);
+        if (hk_index[slot - 1].slot != slot) {
+          return rebuild_index();
+        }
+      }
+      return SUCCESS;
+    }
+  } else {
+    index_fp = fopen(index_file, "w+b"); //create index file
+    if (index_fp == NULL) {
+      ex2_log("Failed to open or create file: '%s'\n", index_file);
+      return FAILURE;
+    }
   }
-  configASSERT(f_count_lock);
-  return &f_count_lock;
-}
-
-static inline void prv_get_lock(SemaphoreHandle_t *lock) {
-  configASSERT(lock);
-  xSemaphoreTake(lock, portMAX_DELAY);
-}
-
-static inline void prv_give_lock(SemaphoreHandle_t *lock) {
-  configASSERT(lock);
-  xSemaphoreGive(lock);
+  return rebuild_index();
 }
 
 /**
  * @brief
- *      Public. Performs all calls and operations to retrieve hk data and store it
- * @return
- *      enum for SUCCESS or FAILURE
+ *      Private. Open or create the ring, then the index
+ * @attention
+ *      Caller must hold f_count_lock and hk_read_lock
+ * @return Result
+ *      FAILURE or SUCCESS
  */
-Result populate_and_store_hk_data(void) {
-  All_systems_housekeeping temp_hk_data;
+static Result load_ring_file(void) {
+  hk_ring_header header;
 
-  if(collect_hk_from_devices(&temp_hk_data) == FAILURE) {
-    ex2_log("Error collecting hk data from peripherals\n");
+  if (ring_fp != NULL) { //ring opened but index failed previously
+    return open_index_file();
   }
 
-  //Not sure if time works like a normal machine but can be changed
-  temp_hk_data.hk_timeorder.UNIXtimestamp = (uint32_t)time(NULL); //set creation time to now
-  SemaphoreHandle_t lock = prv_get_count_lock();
-
-  prv_get_lock(lock); //lock
-  configASSERT(lock);
-  temp_hk_data.hk_timeorder.dataPosition = current_file;
-
-  uint16_t length = strlen(base_file) + num_digits(current_file) + 
-  strlen(extension) + 1;
-  char * filename = malloc(length); // + 1 for NULL terminator
+  ring_fp = fopen(ring_file, "r+b"); //open existing ring to read and write binary
+  if (ring_fp != NULL) {
+    if (fread(&header, sizeof(header), 1, ring_fp) == 1 &&
+        header.magic == HK_RING_MAGIC &&
+        header.version == HK_RING_VERSION &&
+        header.record_size == HK_RECORD_SIZE &&
+        header.max_slots > 0 &&
+        header.head >= 1 && header.head <= header.max_slots &&
+        header.count <= header.max_slots) {
+      MAX_FILES = header.max_slots;
+      current_file = header.head;
+      stored_count = header.count;
+      ring_generation = header.generation;
+      return open_index_file();
+    }
+    ex2_log("hk ring header invalid, recreating\n");
+    fclose(ring_fp);
+  }
 
-  if(!filename) {
-    ex2_log("Error, failed to malloc %hu bytes\n", length);
+  ring_fp = fopen(ring_file, "w+b"); //create or truncate ring file
+  if (ring_fp == NULL) {
+    ex2_log("Failed to open or create file: '%s'\n", ring_file);
     return FAILURE;
   }
-  snprintf(filename, length, "%s%hu%s", base_file, current_file, extension);
-
-  if(!write_hk_to_file(filename, &temp_hk_data)) {
-    ex2_log("Housekeeping data lost\n");
-    free(filename); // No memory leaks here
+  current_file = 1;
+  stored_count = 0;
+  ++ring_generation;
+  if (preallocate_ring(MAX_FILES) != SUCCESS ||
+      write_ring_header() != SUCCESS) {
     return FAILURE;
   }
+  return open_index_file();
+}
 
-
-  if (dynamic_timestamp_array_handler(MAX_FILES)) {
-    timestamps[current_file] = temp_hk_data.hk_timeorder.UNIXtimestamp;
-  } else {
-    ex2_log("Warning, failed to malloc for secondary data structure\n");
+/**
+ * @brief
+ *      Slots a file has storage for
+ * @param fp
+ *      The ring or index file
+ * @param header_size
+ *      Size of the file's header
+ * @param slot_size
+ *      Size of one record or entry
+ * @return uint16_t
+ *      Number of whole slots behind the header
+ */
+static uint16_t slots_backed(FILE *fp, long header_size, long slot_size) {
+  if (fseek(fp, 0, SEEK_END) != 0) {
+    return 0;
   }
-
-  ++current_file;
-
-  if(current_file > MAX_FILES) {
-    current_file = 1;
+  long size = ftell(fp);
+  if (size < header_size) {
+    return 0;
   }
-  prv_give_lock(lock); //unlock
-
-  free(filename); // No memory leaks here
-  return SUCCESS;
+  long slots = (size - header_size) / slot_size;
+  return (slots > UINT16_MAX) ? UINT16_MAX : (uint16_t)slots;
 }
 
 /**
  * @brief
- *      Performs all calls and operations to load hk data from disk
- * @param file_num
- *      The id of the file to be retrieved. will be combined into full
- *      file name and is checked to ensure request is valid
- * @param all_hk_data
- *      Struct containing structs of other hk data
- * @return
- *      enum for SUCCESS or FAILURE
+ *      Preallocate storage for slots added by a resize
+ * @details
+ *      Left to hk_storage_task if it runs, otherwise done here
+ * @attention
+ *      Caller must hold f_count_lock
+ * @return Result
+ *      FAILURE or SUCCESS
  */
-Result load_historic_hk_data(uint16_t file_num, All_systems_housekeeping* all_hk_data) {
-  uint16_t length = strlen(base_file) + num_digits(current_file) + 
-  strlen(extension) + 1;
-  char * filename = malloc(length); // + 1 for NULL terminator
-
-  if(!filename) {
-    ex2_log("Error, failed to malloc %hu bytes\n", length);
+static Result grow_storage(void) {
+  if (backed_slots >= MAX_FILES) {
+    return SUCCESS;
+  }
+  if (hk_storage_handle != NULL) {
+    xTaskNotifyGive(hk_storage_handle);
+    return SUCCESS;
+  }
+  if (preallocate_ring(MAX_FILES) != SUCCESS ||
+      preallocate_index(MAX_FILES) != SUCCESS) {
     return FAILURE;
   }
-  snprintf(filename, length, "%s%hu%s", base_file, current_file, extension);
+  backed_slots = MAX_FILES;
+  return SUCCESS;
+}
 
-  if(!read_hk_from_file(filename, all_hk_data)) {
-    ex2_log("Housekeeping data could not be retrieved\n");
-    free(filename); // No memory leaks here
+/**
+ * @brief
+ *      Open the ring and index files, creating and preallocating as needed
+ * @details
+ *      A valid existing header restores current_file, MAX_FILES and the number
+ *      of stored records so history survives a reboot. A missing file or one
+ *      with a foreign header is recreated empty. A resize that was still
+ *      preallocating when power was lost is carried on
+ * @attention
+ *      Caller must hold f_count_lock
+ * @return Result
+ *      FAILURE or SUCCESS
+ */
+static Result open_ring_file(void) {
+  if (ring_fp != NULL && index_fp != NULL) {
+    return SUCCESS;
+  }
+  SemaphoreHandle_t read_lock = prv_get_read_lock();
+  prv_get_lock(read_lock); //readers wait until the ring is there
+  Result result = load_ring_file();
+  prv_give_lock(read_lock);
+  if (result != SUCCESS) {
     return FAILURE;
   }
 
-  free(filename); // No memory leaks here
-  return SUCCESS;
+  uint16_t ring_slots = slots_backed(ring_fp, sizeof(hk_ring_header), HK_RECORD_SIZE);
+  uint16_t index_slots = slots_backed(index_fp, sizeof(hk_index_header), sizeof(hk_index_entry));
+  backed_slots = (ring_slots < index_slots) ? ring_slots : index_slots;
+  return grow_storage();
 }
 
 /**
  * @brief
- *      Change the maximum number of files stored by housekeeping service
+ *      Open the readers' handle on the ring
  * @attention
- *      If new_max is less than MAX_FILES, all historic housekeeping files will
- *      be destroyed immediately to prevent orphaned files and confusion of data
- *      order. The next file written to after this function will be file #1.
- *      If new_max is greater than MAX_FILES, the data flow will be unaffected.
+ *      Caller must hold hk_read_lock
+ * @return Result
+ *      FAILURE until the ring has been opened by open_ring_file
+ */
+static Result open_read_file(void) {
+  if (ring_read_fp != NULL) {
+    return SUCCESS;
+  }
+  if (ring_fp == NULL || index_fp == NULL) {
+    return FAILURE;
+  }
+  ring_read_fp = fopen(ring_file, "rb");
+  return (ring_read_fp != NULL) ? SUCCESS : FAILURE;
+}
+
+/**
+ * @brief
+ *      Oldest stored position whose timestamp is not before the one given
+ * @attention
+ *      Caller must hold f_count_lock, or hk_read_lock and check hk_seq didn't
+ *      move. hk_index must be loaded. Assumes records were stored in
+ *      chronological order
+ * @param timestamp
+ *      Time to search for
+ * @return uint16_t
+ *      Position as in ring_slot_at. stored_count if every record is older
+ */
+static uint16_t index_lower_bound(uint32_t timestamp) {
+  uint16_t left = 0;
+  uint16_t right = stored_count;
+  while (left < right) {
+    uint16_t middle = left + (right - left) / 2;
+    if (hk_index[ring_slot_at(middle) - 1].timestamp < timestamp) {
+      left = middle + 1;
+    } else {
+      right = middle;
+    }
+  }
+  return left;
+}
+
+/**
+ * @brief
+ *      gets the hk file id that holds a timestamp closest to that given
+ * @details
+ *      Binary search over the stored records from oldest to newest using the
+ *      RAM index, so it is O(log n) and works straight after boot. A record
+ *      only matches within half of hk_record_period of the timestamp
+ * @attention
+ *      Caller must hold f_count_lock, or hk_read_lock and check hk_seq didn't
+ *      move. Assumes records were stored in chronological order
+ * @param timestamp
+ *      This is the time from which the file is desired
+ * @return uint16_t
+ *      File ID if found. 0 if no file found
+ */
+uint16_t get_file_id_from_timestamp(uint32_t timestamp) {
+  //How many seconds timestamps need to be within. half the spacing of records
+  uint32_t threshold = (hk_record_period() + 1) / 2;
+  if (hk_index == NULL || stored_count == 0) {
+    return 0;
+  }
+
+  uint16_t left = index_lower_bound(timestamp);
+
+  //closest is either the match or its older neighbour
+  uint16_t best = 0;
+  uint32_t best_diff = threshold + 1;
+  if (left < stored_count) {
+    uint16_t slot = ring_slot_at(left);
+    uint32_t diff = hk_index[slot - 1].timestamp - timestamp;
+    if (diff < best_diff) {
+      best = slot;
+      best_diff = diff;
+    }
+  }
+  if (left > 0) {
+    uint16_t slot = ring_slot_at(left - 1);
+    uint32_t diff = timestamp - hk_index[slot - 1].timestamp;
+    if (diff <= best_diff) {
+      best = slot;
+      best_diff = diff;
+    }
+  }
+  return (best_diff <= threshold) ? best : 0;
+}
+
+/**
+ * @brief
+ *      Allocate the hot cache on first use
+ * @attention
+ *      Caller must hold f_count_lock
+ */
+static void cache_reserve(void) {
+  if (hk_cache_size == 0 || hk_cache != NULL) {
+    return;
+  }
+  uint8_t *cache = malloc(hk_cache_size * HK_RECORD_SIZE);
+  if (cache == NULL) {
+    ex2_log("Warning, failed to malloc hk cache\n");
+    return;
+  }
+  hk_publish_begin();
+  hk_cache = cache;
+  hk_cache_count = 0;
+  hk_cache_next = 0;
+  hk_publish_end();
+}
+
+/**
+ * @brief
+ *      Add the newest record to the hot cache, evicting the oldest if full
+ * @attention
+ *      Caller must be between hk_publish_begin and hk_publish_end
+ * @param record
+ *      The wire record as stored
+ */
+static void cache_store(const uint8_t *record) {
+  if (hk_cache == NULL) {
+    return;
+  }
+  memcpy(&hk_cache[hk_cache_next * HK_RECORD_SIZE], record, HK_RECORD_SIZE);
+  hk_cache_next = (hk_cache_next + 1) % hk_cache_size;
+  if (hk_cache_count < hk_cache_size) {
+    ++hk_cache_count;
+  }
+}
+
+/**
+ * @brief
+ *      Look up a record in the hot cache by how recently it was written
+ * @attention
+ *      Caller must hold f_count_lock, or hk_read_lock and check hk_seq didn't move
+ * @param age
+ *      1 for the most recent record. Same as ring_slot_age
+ * @param record
+ *      Where to copy the wire record on a hit. HK_RECORD_SIZE bytes
+ * @return Result
+ *      SUCCESS on a hit, FAILURE if the record isn't cached
+ */
+static Result cache_lookup(uint16_t age, uint8_t *record) {
+  if (hk_cache == NULL || age < 1 || age > hk_cache_count) {
+    return FAILURE;
+  }
+  uint16_t index = (hk_cache_next + hk_cache_size - age) % hk_cache_size;
+  memcpy(record, &hk_cache[index * HK_RECORD_SIZE], HK_RECORD_SIZE);
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Drop every record in the hot cache
+ * @attention
+ *      Caller must be between hk_publish_begin and hk_publish_end
+ */
+static void cache_clear(void) {
+  hk_cache_count = 0;
+  hk_cache_next = 0;
+}
+
+/**
+ * @brief
+ *      Write a wire record to the given ring slot
+ * @attention
+ *      Caller must hold f_count_lock
+ * @param slot
+ *      The 1 indexed slot to write
+ * @param record
+ *      HK_RECORD_SIZE bytes as built by serialize_hk_record
+ * @return Result
+ *      FAILURE or SUCCESS
+ */
+static Result write_hk_to_slot(uint16_t slot, const uint8_t *record) {
+  long offset = (long)sizeof(hk_ring_header) + (long)(slot - 1) * HK_RECORD_SIZE;
+  if (fseek(ring_fp, offset, SEEK_SET) != 0 ||
+      fwrite(record, HK_RECORD_SIZE, 1, ring_fp) != 1) {
+    ex2_log("Failed to write to hk slot %hu\n", slot);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Read the wire record held in the given ring slot
+ * @attention
+ *      Caller must hold hk_read_lock and ring_read_fp must be open
+ * @param slot
+ *      The 1 indexed slot to read
+ * @param record
+ *      Where to put the record. HK_RECORD_SIZE bytes, may be a packet payload
+ * @return Result
+ *      FAILURE or SUCCESS
+ */
+static Result read_hk_from_slot(uint16_t slot, uint8_t *record) {
+  long offset = (long)sizeof(hk_ring_header) + (long)(slot - 1) * HK_RECORD_SIZE;
+  if (fseek(ring_read_fp, offset, SEEK_SET) != 0 ||
+      fread(record, HK_RECORD_SIZE, 1, ring_read_fp) != 1) {
+    ex2_log("Failed to read hk slot %hu\n", slot);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Convert the endianness of every value of a wire record in place
+ * @details
+ *      Swapping is its own inverse so this converts host to network order
+ *      and back. Subsystem structs are packed so any offset is safe
+ * @param record
+ *      HK_RECORD_SIZE bytes laid out as serialize_hk_record
+ */
+static void convert_hk_record_endianness(uint8_t *record) {
+  /*hk_time_and_order*/
+  wire_swap_hk_timeorder(record, sizeof(hk_time_and_order));
+
+  //TODO:
+  //ADCS_hk_convert_endianness(...);
+
+  /*athena_housekeeping*/
+  Athena_hk_convert_endianness((athena_housekeeping *)&record[HK_WIRE_ATHENA]);
+
+  /*eps_instantaneous_telemetry_t*/
+  prv_instantaneous_telemetry_letoh((eps_instantaneous_telemetry_t *)&record[HK_WIRE_EPS]);
+
+  /*UHF_housekeeping*/
+  UHF_convert_endianness((UHF_housekeeping *)&record[HK_WIRE_UHF]);
+
+  /*Sband_Housekeeping*/
+  HAL_S_hk_convert_endianness((Sband_Housekeeping *)&record[HK_WIRE_SBAND]);
+}
+
+/**
+ * @brief
+ *      Build the wire record of a sample, as stored and as downlinked
+ * @details
+ *      Order of copies must match what the ground station expects
+ * @param out
+ *      Where to put the record. Must have HK_RECORD_SIZE bytes available
+ * @param all_hk_data
+ *      Struct containing structs of other hk data, in host order
+ */
+static void serialize_hk_record(uint8_t *out, const All_systems_housekeeping *all_hk_data) {
+  memcpy(out, &all_hk_data->hk_timeorder, sizeof(all_hk_data->hk_timeorder));
+  //TODO:
+  //memcpy(&out[HK_WIRE_ADCS], &all_hk_data->ADCS_hk, sizeof(all_hk_data->ADCS_hk));
+  memcpy(&out[HK_WIRE_ATHENA], &all_hk_data->Athena_hk, sizeof(all_hk_data->Athena_hk));
+  memcpy(&out[HK_WIRE_EPS], &all_hk_data->EPS_hk, sizeof(all_hk_data->EPS_hk));
+  memcpy(&out[HK_WIRE_UHF], &all_hk_data->UHF_hk, sizeof(all_hk_data->UHF_hk));
+  memcpy(&out[HK_WIRE_SBAND], &all_hk_data->S_band_hk, sizeof(all_hk_data->S_band_hk));
+  convert_hk_record_endianness(out);
+}
+
+/**
+ * @brief
+ *      Turn a wire record back into a host order struct
+ * @param all_hk_data
+ *      Where to put the sample
+ * @param record
+ *      The wire record. Converted in place, so no longer valid wire format
+ */
+static void deserialize_hk_record(All_systems_housekeeping *all_hk_data, uint8_t *record) {
+  convert_hk_record_endianness(record);
+  memcpy(&all_hk_data->hk_timeorder, record, sizeof(all_hk_data->hk_timeorder));
+  memcpy(&all_hk_data->Athena_hk, &record[HK_WIRE_ATHENA], sizeof(all_hk_data->Athena_hk));
+  memcpy(&all_hk_data->EPS_hk, &record[HK_WIRE_EPS], sizeof(all_hk_data->EPS_hk));
+  memcpy(&all_hk_data->UHF_hk, &record[HK_WIRE_UHF], sizeof(all_hk_data->UHF_hk));
+  memcpy(&all_hk_data->S_band_hk, &record[HK_WIRE_SBAND], sizeof(all_hk_data->S_band_hk));
+}
+
+/**
+ * @brief
+ *      Private. Sample the due sources and store a record of every source
+ * @details
+ *      Sources not in due keep the values of their last sample
+ * @param due
+ *      bit per hk_source to poll
+ * @return
+ *      enum for SUCCESS or FAILURE
+ */
+static Result sample_and_store_hk(uint8_t due) {
+  if (sample_lock != NULL) {
+    xSemaphoreTake(sample_lock, portMAX_DELAY);
+  }
+  All_systems_housekeeping *temp_hk_data = &hk_latest;
+
+  if(collect_hk_from_devices(temp_hk_data, due) == FAILURE) {
+    ex2_log("Error collecting hk data from peripherals\n");
+  }
+
+  //Not sure if time works like a normal machine but can be changed
+  temp_hk_data->hk_timeorder.UNIXtimestamp = (uint32_t)time(NULL); //set creation time to now
+  SemaphoreHandle_t lock = prv_get_count_lock();
+
+  prv_get_lock(lock); //lock
+  configASSERT(lock);
+  uint16_t slot = current_file;
+  temp_hk_data->hk_timeorder.dataPosition = slot;
+  serialize_hk_record(hk_latest_wire, temp_hk_data);
+
+  if (open_ring_file() != SUCCESS) {
+    ex2_log("Housekeeping data lost\n");
+    prv_give_lock(lock); //unlock
+    if (sample_lock != NULL) xSemaphoreGive(sample_lock);
+    return FAILURE;
+  }
+  if (stored_count == MAX_FILES) { //retire the oldest record before it is overwritten
+    hk_publish_begin();
+    --stored_count;
+    hk_publish_end();
+  }
+  //flushed so ring_read_fp sees the record once it is published
+  if (write_hk_to_slot(slot, hk_latest_wire) != SUCCESS || fflush(ring_fp) != 0) {
+    ex2_log("Housekeeping data lost\n");
+    prv_give_lock(lock); //unlock
+    if (sample_lock != NULL) xSemaphoreGive(sample_lock);
+    return FAILURE;
+  }
+
+  cache_reserve();
+  hk_publish_begin();
+  hk_index[slot - 1].timestamp = temp_hk_data->hk_timeorder.UNIXtimestamp;
+  hk_index[slot - 1].slot = slot;
+  cache_store(hk_latest_wire);
+  ++current_file;
+  if(current_file > MAX_FILES) {
+    current_file = 1;
+  }
+  ++stored_count;
+  hk_publish_end();
+  hk_stats_add(temp_hk_data);
+  if (slot > backed_slots) { //written ahead of hk_storage_task
+    backed_slots = slot;
+  }
+
+  //index entry must be on disk before the header makes the record visible
+  if (write_index_entry(slot) != SUCCESS) {
+    ex2_log("Warning, failed to index hk record\n");
+  }
+  //record is only counted after reboot once the header pointing past it is on disk
+  Result result = write_ring_header();
+  prv_give_lock(lock); //unlock
+  if (sample_lock != NULL) xSemaphoreGive(sample_lock);
+
+  return result;
+}
+
+/**
+ * @brief
+ *      Public. Performs all calls and operations to retrieve hk data from
+ *      every source and store it, regardless of the sampling periods
+ * @return
+ *      enum for SUCCESS or FAILURE
+ */
+Result populate_and_store_hk_data(void) {
+  return sample_and_store_hk(HK_ALL_SOURCES_VALID);
+}
+
+/**
+ * @brief
+ *      FreeRTOS task storing a record whenever any source's period is up
+ * @details
+ *      Every source is sampled on the first tick after boot
+ * @param void* param
+ * @return None
+ */
+static void hk_sampler_task(void *param) {
+  uint32_t elapsed[HK_NUM_SOURCES]; //seconds since each source was last sampled
+  int i;
+  for (i = 0; i < HK_NUM_SOURCES; i++) {
+    elapsed[i] = HK_PERIOD_MAX;
+  }
+
+  TickType_t last_wake = xTaskGetTickCount();
+  for (;;) {
+    vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(HK_SAMPLE_TICK_MS));
+    uint8_t due = 0;
+    for (i = 0; i < HK_NUM_SOURCES; i++) {
+      uint32_t period = hk_period_s[i];
+      if (period == 0) {
+        continue;
+      }
+      if (elapsed[i] < HK_PERIOD_MAX) {
+        ++elapsed[i];
+      }
+      if (elapsed[i] >= period) {
+        elapsed[i] = 0;
+        due |= 1 << i;
+      }
+    }
+    if (due) {
+      sample_and_store_hk(due);
+    }
+  }
+}
+
+/**
+ * @brief
+ *      Change how often one source is sampled
+ * @details
+ *      Takes effect on the sampler's next tick. A period shorter than the
+ *      time since the last sample makes the source due immediately
+ * @param source
+ *      The hk_source to change
+ * @param period_s
+ *      Seconds between samples, at most HK_PERIOD_MAX. 0 stops sampling it
+ * @return
+ *      enum for SUCCESS or FAILURE
+ */
+Result set_hk_period(uint8_t source, uint32_t period_s) {
+  if (source >= HK_NUM_SOURCES || period_s > HK_PERIOD_MAX) return FAILURE;
+  hk_period_s[source] = period_s;
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Same as load_hk_record for callers already holding hk_read_lock
+ * @attention
+ *      Caller must hold hk_read_lock and check hk_seq didn't move, or hold
+ *      both locks
+ */
+static Result load_hk_record_locked(uint16_t file_num, uint8_t *record) {
+  if (open_read_file() != SUCCESS) {
+    ex2_log("Housekeeping data could not be retrieved\n");
+    return FAILURE;
+  }
+  if (!ring_slot_is_valid(file_num)) {
+    ex2_log("Attempted to read empty hk slot %hu\n", file_num);
+    return FAILURE;
+  }
+  if (cache_lookup(ring_slot_age(file_num), record) == SUCCESS) {
+    return SUCCESS;
+  }
+  if (read_hk_from_slot(file_num, record) != SUCCESS) {
+    ex2_log("Housekeeping data could not be retrieved\n");
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Load the wire record held in a slot
+ * @details
+ *      Recent records are served from the hot cache without touching disk.
+ *      Otherwise the record is read from storage directly into the buffer.
+ *      Never waits for the sampler
+ * @param file_num
+ *      The id of the ring slot to be retrieved. Checked to ensure the
+ *      slot currently holds a record
+ * @param record
+ *      Where to put the record. HK_RECORD_SIZE bytes, may be a packet payload
+ * @return
+ *      enum for SUCCESS or FAILURE
+ */
+static Result load_hk_record(uint16_t file_num, uint8_t *record) {
+  SemaphoreHandle_t lock = prv_get_read_lock();
+  prv_get_lock(lock); //lock
+  Result result = FAILURE;
+  int tries;
+  for (tries = 0; tries < HK_READ_RETRIES; tries++) {
+    uint32_t seq = hk_seq_begin();
+    result = load_hk_record_locked(file_num, record);
+    if (!hk_seq_moved(seq)) {
+      break;
+    }
+    result = FAILURE; //slot may have been rewritten while read
+  }
+  prv_give_lock(lock); //unlock
+  return result;
+}
+
+/**
+ * @brief
+ *      Performs all calls and operations to load hk data from disk
+ * @details
+ *      Downlink paths use load_hk_record and skip the host order struct
+ * @param file_num
+ *      The id of the ring slot to be retrieved. Checked to ensure the
+ *      slot currently holds a record
+ * @param all_hk_data
+ *      Struct containing structs of other hk data
+ * @return
+ *      enum for SUCCESS or FAILURE
+ */
+Result load_historic_hk_data(uint16_t file_num, All_systems_housekeeping* all_hk_data) {
+  uint8_t record[HK_RECORD_SIZE];
+  if (load_hk_record(file_num, record) != SUCCESS) {
+    return FAILURE;
+  }
+  deserialize_hk_record(all_hk_data, record);
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Change the maximum number of files stored by housekeeping service
+ * @attention
+ *      If new_max is less than MAX_FILES, all historic housekeeping records are
+ *      discarded immediately to prevent confusion of data order. The next
+ *      record written after this function will be slot #1.
+ *      If new_max is greater than MAX_FILES, the data flow will be unaffected
+ *      unless the ring has already wrapped, in which case it is also discarded.
+ *      Discarding only rewrites the ring header, no files are removed.
+ *      Storage for added slots is preallocated by hk_storage_task.
  * @param new_max
  *      The new value to change the maximum value to  
  * @return
@@ -397,306 +1355,1127 @@ Result set_max_files(uint16_t new_max) {
   SemaphoreHandle_t lock = prv_get_count_lock();
   prv_get_lock(lock); //lock
   configASSERT(lock);
-  
-  //adjust the array
 
-  //ensure value set before cleanup
+  if (open_ring_file() != SUCCESS) {
+    prv_give_lock(lock); //unlock
+    return FAILURE;
+  }
+
   uint16_t old_max = MAX_FILES;
+  //slots stay in chronological order only if the ring never wrapped
+  int in_order = (stored_count == current_file - 1);
+  int discard = (new_max < old_max || !in_order);
+
+  SemaphoreHandle_t read_lock = prv_get_read_lock();
+  prv_get_lock(read_lock); //readers wait while hk_index moves
+  if (resize_index(old_max, new_max) != SUCCESS) {
+    prv_give_lock(read_lock);
+    prv_give_lock(lock); //unlock
+    return FAILURE;
+  }
+  hk_publish_begin();
   MAX_FILES = new_max;
-  current_file = 1;
+  if (discard) {
+    current_file = 1;
+    stored_count = 0;
+    ++ring_generation; //stale index entries can never match again
+    cache_clear();
+  }
+  hk_publish_end();
+  if (discard) {
+    memset(hk_index, 0, new_max * sizeof(*hk_index));
+  }
+  prv_give_lock(read_lock);
+
+  //ring header first. a mismatched index generation is rebuilt on boot
+  Result result = write_ring_header();
+  if (result == SUCCESS) {
+    result = write_index_header();
+  }
+  if (result == SUCCESS) {
+    result = grow_storage(); //new slots are preallocated in the background
+  }
 
   prv_give_lock(lock); //unlock
-  
-  if (old_max < new_max) return SUCCESS;
+  return result;
+}
+
+/**
+ * @brief
+ *      Change the number of recent records kept in RAM
+ * @details
+ *      The newest records already cached are kept if they fit in the new size
+ * @param new_size
+ *      Number of records to cache. 0 disables the cache
+ * @return
+ *      enum for SUCCESS or FAILURE
+ */
+Result set_cache_size(uint16_t new_size) {
+  if (new_size > HK_CACHE_MAX) return FAILURE;
+
+  SemaphoreHandle_t lock = prv_get_count_lock();
+  prv_get_lock(lock); //lock
+  configASSERT(lock);
+  SemaphoreHandle_t read_lock = prv_get_read_lock();
+  prv_get_lock(read_lock); //no reader may be copying out of the old cache
+
+  uint8_t *new_cache = NULL;
+  uint16_t keep = 0;
+  if (new_size > 0) {
+    new_cache = malloc(new_size * HK_RECORD_SIZE);
+    if (new_cache == NULL) {
+      ex2_log("Error, failed to malloc %hu cache records\n", new_size);
+      prv_give_lock(read_lock);
+      prv_give_lock(lock); //unlock
+      return FAILURE;
+    }
+    keep = (hk_cache_count < new_size) ? hk_cache_count : new_size;
+    uint16_t i;
+    for (i = 0; i < keep; i++) { //oldest kept record first
+      cache_lookup(keep - i, &new_cache[i * HK_RECORD_SIZE]);
+    }
+  }
+
+  free(hk_cache);
+  hk_publish_begin();
+  hk_cache = new_cache;
+  hk_cache_size = new_size;
+  hk_cache_count = keep;
+  hk_cache_next = (new_size > 0) ? keep % new_size : 0;
+  hk_publish_end();
+
+  prv_give_lock(read_lock);
+  prv_give_lock(lock); //unlock
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Resolve the paging arguments of a request to the slot to start before
+ * @details
+ *      Also clamps limit to the number of records actually stored older than
+ *      that slot so callers don't attempt to read empty slots
+ * @param limit
+ *      Requested maximum number of records. Clamped in place
+ * @param before_id
+ *      Requested slot. 0 or out of range means most recent
+ * @param before_time
+ *      Requested time. Used over before_id if non zero
+ * @return uint16_t
+ *      The slot that fetching should start before
+ */
+static uint16_t resolve_page_start(uint16_t *limit, uint16_t before_id, uint32_t before_time) {
+  SemaphoreHandle_t lock = prv_get_read_lock();
+  prv_get_lock(lock);
+  uint16_t locked_before_id;
+  uint16_t available;
+  uint32_t seq;
+  int tries = 0;
+  do {
+    seq = hk_seq_begin();
+    locked_before_id = before_id;
+    if (before_time != 0){ //use timestamp if exists
+      locked_before_id = get_file_id_from_timestamp(before_time);
+    }
+
+    //error check and accomodate user input
+    if (locked_before_id == 0 || !ring_slot_is_valid(locked_before_id)) {
+      locked_before_id = current_file;
+      available = stored_count;
+    } else {
+      //records older than before_id are the ones written before it
+      available = stored_count - ring_slot_age(locked_before_id);
+    }
+  } while (hk_seq_moved(seq) && ++tries < HK_READ_RETRIES);
+  prv_give_lock(lock);
+
+  if (*limit > available) {
+    *limit = available;
+  }
+  return locked_before_id;
+}
+
+/**
+ * @brief
+ *      Step back one slot in the ring
+ * @param slot
+ *      The current slot
+ * @return uint16_t
+ *      The slot written immediately before the given one
+ */
+static uint16_t previous_slot(uint16_t slot) {
+  slot--;
+  if (slot == 0) {
+    slot = MAX_FILES;
+  }
+  return slot;
+}
+
+/**
+ * @brief
+ *      Paging function to retrieve sets of data so they can be transmitted
+ * @param conn
+ *      Pointer to the connection on which to send packets
+ * @param limit
+ *      Maximum number of housekeeping files to retrieve in this request
+ * @param before_id
+ *      The earliest file in time that the user received. (lowest id)
+ *      Files older than before_id will be fetched.
+ *      Functions like a typical web API for paging. Prevents page drift.
+ *      0 value means ignore variable. retrieve from most recent
+ * @return
+ *      enum for success or failure
+ */
+Result fetch_historic_hk_and_transmit(csp_conn_t *conn, uint16_t limit, uint16_t before_id, uint32_t before_time) {
+  if (limit == 0) {
+    ex2_log("Successfully did nothing O_o");
+    return SUCCESS;
+  }
+  uint16_t locked_before_id = resolve_page_start(&limit, before_id, before_time);
+
+  //fetch each appropriate set of data from file
+  while (limit > 0) {
+    locked_before_id = previous_slot(locked_before_id);
+    int8_t status = 0;
+    
+    //needed_size is currently 358 bytes as of 2021/06/18
+    uint16_t needed_size = HK_RECORD_SIZE + 2; //+2 for subservice and status
+
+    csp_packet_t *packet = service_buffer_get(needed_size);
+    if (packet == NULL) {
+      metrics_record_event(csp_conn_dport(conn), GET_HK, METRIC_ALLOC_FAILURE);
+      ex2_log("Failed to get buffer for hk");
+      return FAILURE;
+    }
+    uint8_t ser_subtype = GET_HK;
+    memcpy(&packet->data[SUBSERVICE_BYTE], &ser_subtype, sizeof(int8_t));
+    memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+    //stored records are already in wire format
+    if (load_hk_record(locked_before_id, &packet->data[OUT_DATA_BYTE]) != SUCCESS) {
+      csp_buffer_free(packet);
+      return FAILURE;
+    }
+    set_packet_length(packet, HK_RECORD_SIZE + 2); //+2 for subservice and status
+    
+    if (!service_send(conn, packet, 50)) { //why are we all using magic number?
+      metrics_record_event(csp_conn_dport(conn), GET_HK, METRIC_SEND_FAILURE);
+      ex2_log("Failed to send packet");
+      csp_buffer_free(packet);
+      return FAILURE;
+    }
+    limit--;
+  }
+
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Finish a GET_HK_BATCH packet and send it
+ * @details
+ *      Records are packed directly behind the count byte while the packet is
+ *      built since their number isn't known up front. They are moved up here
+ *      to make room for the offset table
+ * @param conn
+ *      Pointer to the connection on which to send the packet
+ * @param packet
+ *      The packet holding used_size bytes of records. Always consumed
+ * @param count
+ *      Number of records in the packet
+ * @param offsets
+ *      Network order offset of each record
+ * @param used_size
+ *      Bytes of records in the packet
+ * @param status
+ *      HK_BATCH_MORE if more packets follow, 0 otherwise
+ * @return
+ *      enum for success or failure
+ */
+static Result send_hk_batch(csp_conn_t *conn, csp_packet_t *packet, uint8_t count,
+                            const uint16_t *offsets, uint16_t used_size, int8_t status) {
+  uint16_t header_size = OUT_DATA_BYTE + 1;
+  uint16_t table_size = count * sizeof(uint16_t);
+
+  packet->data[SUBSERVICE_BYTE] = GET_HK_BATCH;
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  packet->data[OUT_DATA_BYTE] = count;
+  memmove(&packet->data[header_size + table_size], &packet->data[header_size], used_size);
+  memcpy(&packet->data[header_size], offsets, table_size);
+  set_packet_length(packet, header_size + table_size + used_size);
+
+  if (!service_send(conn, packet, 50)) {
+    metrics_record_event(csp_conn_dport(conn), GET_HK_BATCH, METRIC_SEND_FAILURE);
+    ex2_log("Failed to send packet");
+    csp_buffer_free(packet);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Paging function that packs as many whole records as fit into each packet
+ * @details
+ *      Each packet holds the subservice, a status byte, a record count n, n
+ *      network order uint16 offsets of each record relative to the end of the
+ *      offset table, then the records back to back. Status is HK_BATCH_MORE on
+ *      every packet except the last of the page.
+ *      With HK_ENCODING_DELTA the first record of every packet is a keyframe
+ *      and each following record is delta encoded against the one before it
+ *      in the packet (see hk_delta.h), so every packet decodes on its own
+ * @param conn
+ *      Pointer to the connection on which to send packets
+ * @param limit
+ *      Maximum number of housekeeping records to retrieve in this request
+ * @param before_id
+ *      Same as fetch_historic_hk_and_transmit
+ * @param before_time
+ *      Same as fetch_historic_hk_and_transmit
+ * @param max_size
+ *      Largest packet data size the ground will accept. 0 means use the
+ *      largest csp buffer available
+ * @param encoding
+ *      HK_ENCODING_RAW or HK_ENCODING_DELTA
+ * @return
+ *      enum for success or failure
+ */
+static Result fetch_historic_hk_batch_and_transmit(csp_conn_t *conn, uint16_t limit,
+                                                   uint16_t before_id, uint32_t before_time,
+                                                   uint16_t max_size, uint8_t encoding) {
+  uint16_t buffer_size = service_reply_room();
+  if (max_size == 0 || max_size > buffer_size) {
+    max_size = buffer_size;
+  }
+  if (encoding != HK_ENCODING_RAW && encoding != HK_ENCODING_DELTA) {
+    ex2_log("Unknown hk encoding %hu", encoding);
+    return FAILURE;
+  }
+  //subservice, status and count bytes then an offset per record
+  uint16_t header_size = OUT_DATA_BYTE + 1;
+  uint16_t record_max = (encoding == HK_ENCODING_DELTA) ? HK_DELTA_MAX_SIZE(HK_RECORD_SIZE)
+                                                        : HK_RECORD_SIZE;
+  if (max_size < header_size + sizeof(uint16_t) + record_max) {
+    ex2_log("%hu bytes can't hold an hk record", max_size);
+    return FAILURE;
+  }
+
+  uint16_t locked_before_id = resolve_page_start(&limit, before_id, before_time);
+
+  //the record being delta encoded and the one before it, then the offset
+  //table, all in the worker's scratch. raw records are read straight into
+  //the packet. every record takes its offset and at least a byte, which
+  //bounds the table by the packet as well as by the count byte
+  uint8_t *scratch = service_scratch();
+  uint8_t *prev_record = scratch;
+  uint8_t *cur_record = scratch + HK_RECORD_SIZE;
+  uint16_t *offsets = (uint16_t *)(scratch + 2 * HK_RECORD_SIZE);
+  uint16_t table_len = (SERVICE_SCRATCH_SIZE - 2 * HK_RECORD_SIZE) / sizeof(uint16_t);
+  uint16_t packet_len = (max_size - header_size) / (sizeof(uint16_t) + 1);
+  if (table_len > packet_len) {
+    table_len = packet_len;
+  }
+  if (table_len > UINT8_MAX) {
+    table_len = UINT8_MAX;
+  }
+
+  Result result = SUCCESS;
+  csp_packet_t *packet = NULL;
+  uint8_t count = 0;        //records in the packet being built
+  uint16_t used_size = 0;   //bytes of records in the packet being built
+  int have_record = 0;      //cur_record holds a record that didn't fit yet
+
+  do {
+    if (packet == NULL) {
+      packet = service_buffer_get(max_size);
+      if (packet == NULL) {
+        metrics_record_event(csp_conn_dport(conn), GET_HK_BATCH, METRIC_ALLOC_FAILURE);
+        ex2_log("Failed to get buffer for hk");
+        result = FAILURE;
+        break;
+      }
+      count = 0;
+      used_size = 0;
+    }
+    if (limit == 0) { //empty page still gets a final packet
+      break;
+    }
+
+    //room left for records once this record's offset is in the table
+    uint8_t *records = &packet->data[header_size];
+    int32_t room = (int32_t)max_size - header_size
+                   - (count + 1) * (int32_t)sizeof(uint16_t) - used_size;
+    int fits = (count < table_len && room > 0);
+    uint16_t written = 0;
+    if (encoding == HK_ENCODING_RAW) {
+      if (fits && room >= HK_RECORD_SIZE) {
+        locked_before_id = previous_slot(locked_before_id);
+        if (load_hk_record(locked_before_id, &records[used_size]) != SUCCESS) {
+          result = FAILURE;
+          break;
+        }
+        written = HK_RECORD_SIZE;
+      }
+    } else {
+      if (!have_record) {
+        locked_before_id = previous_slot(locked_before_id);
+        if (load_hk_record(locked_before_id, cur_record) != SUCCESS) {
+          result = FAILURE;
+          break;
+        }
+        have_record = 1;
+      }
+      if (fits) {
+        written = hk_delta_encode(count ? prev_record : NULL, cur_record,
+                                  HK_RECORD_SIZE, &records[used_size], room);
+      }
+    }
 
-  //Cleanup files code if number of files has been reduced
-  uint16_t length = strlen(base_file) + num_digits(old_max) + 
-  strlen(extension) + 1;
-  char * filename = malloc(length); // + 1 for NULL terminator
+    if (written > 0) {
+      offsets[count++] = csp_hton16(used_size);
+      used_size += written;
+      uint8_t *swap = prev_record; //cur_record becomes the base of the next delta
+      prev_record = cur_record;
+      cur_record = swap;
+      have_record = 0;
+      limit--;
+    }
+    if (written == 0 || limit == 0) { //packet full or page done
+      result = send_hk_batch(conn, packet, count, offsets, used_size,
+                             (limit > 0) ? HK_BATCH_MORE : 0);
+      packet = NULL;
+    }
+  } while (limit > 0 && result == SUCCESS);
 
-  if(!filename) {
-    ex2_log("Error, failed to malloc %hu bytes\n", length);
-    return FAILURE;
+  if (packet != NULL) {
+    if (result == SUCCESS) {
+      result = send_hk_batch(conn, packet, 0, offsets, 0, 0);
+    } else {
+      csp_buffer_free(packet);
+    }
   }
-  Result result = SUCCESS;
-  uint16_t i = 0;
-  for (i = 1; i <= old_max; i++) {
-    snprintf(filename, length, "%s%hu%s", base_file, i, extension);
-    if (exists(filename) == FILE_EXISTS) {
-      if (!remove(filename) && i > new_max){
-        ex2_log("Error, file %s has been orphaned\n", filename);
-        result = FAILURE;
+  return result;
+}
+
+/**
+ * @brief
+ *      Find the oldest record in a time range and load it
+ * @param from
+ *      Earliest timestamp wanted
+ * @param end
+ *      Latest timestamp wanted
+ * @param record
+ *      Where to put the wire record
+ * @param timestamp
+ *      Set to the timestamp of the record found
+ * @return int
+ *      1 if a record was loaded, 0 if the range holds none, -1 on read failure
+ */
+static int load_first_hk_in_range(uint32_t from, uint32_t end, uint8_t *record,
+                                  uint32_t *timestamp) {
+  SemaphoreHandle_t lock = prv_get_read_lock();
+  prv_get_lock(lock);
+  //looked up and read in one pass, repeated if the ring moved in between
+  int found = -1;
+  int tries;
+  for (tries = 0; tries < HK_READ_RETRIES; tries++) {
+    uint32_t seq = hk_seq_begin();
+    found = 0;
+    if (hk_index != NULL) {
+      uint16_t position = index_lower_bound(from);
+      if (position < stored_count) {
+        uint16_t slot = ring_slot_at(position);
+        *timestamp = hk_index[slot - 1].timestamp;
+        if (*timestamp <= end) {
+          found = (load_hk_record_locked(slot, record) == SUCCESS) ? 1 : -1;
+        }
       }
     }
+    if (!hk_seq_moved(seq)) {
+      break;
+    }
+    found = -1;
   }
-  return result;
+  prv_give_lock(lock);
+  return found;
 }
 
 /**
  * @brief
- *      Is given a struct of all the housekeeping data and converts the
- *      endianness of each value to be sent over the network
- * @param hk
- *      A struct of all the housekeeping data
+ *      Finish a GET_HK_RANGE packet and send it
+ * @param packet
+ *      The packet holding count records. Always consumed
+ * @param record_size
+ *      Bytes of each record after the field mask is applied
  * @return
- *      enum for SUCCESS or FAILURE
+ *      enum for success or failure
  */
-Result convert_hk_endianness(All_systems_housekeeping* hk){
-  /*hk_time_and_order*/
-  hk->hk_timeorder.UNIXtimestamp = csp_hton32(hk->hk_timeorder.UNIXtimestamp);
-  hk->hk_timeorder.dataPosition = csp_hton16(hk->hk_timeorder.dataPosition);
-
-  //TODO:
-  //hk->ADCS_hk.
-  
-  /*athena_housekeeping*/
-  Athena_hk_convert_endianness(&hk->Athena_hk);
-
-  /*eps_instantaneous_telemetry_t*/
-  prv_instantaneous_telemetry_letoh(&hk->EPS_hk);
-  
-  /*UHF_housekeeping*/
-  UHF_convert_endianness(&hk->UHF_hk);
-  
-  /*Sband_Housekeeping*/
-  HAL_S_hk_convert_endianness(&hk->S_band_hk);
-
+static Result send_hk_range(csp_conn_t *conn, csp_packet_t *packet, uint8_t fields, uint8_t count,
+                            uint16_t record_size, int8_t status) {
+  packet->data[SUBSERVICE_BYTE] = GET_HK_RANGE;
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  packet->data[OUT_DATA_BYTE] = fields;
+  packet->data[OUT_DATA_BYTE + 1] = count;
+  set_packet_length(packet, OUT_DATA_BYTE + 2 + count * record_size);
+
+  if (!service_send(conn, packet, 50)) {
+    metrics_record_event(csp_conn_dport(conn), GET_HK_RANGE, METRIC_SEND_FAILURE);
+    ex2_log("Failed to send packet");
+    csp_buffer_free(packet);
+    return FAILURE;
+  }
   return SUCCESS;
 }
 
 /**
  * @brief
- *      Paging function to retrieve sets of data so they can be transmitted
+ *      Send the records of a time range, thinned out and cut down to some sources
+ * @details
+ *      Records are found through the timestamp index by binary search, so
+ *      only the ones sent are read. A stride skips straight to the first
+ *      record at least stride_s after the last one sent, e.g. one EPS sample
+ *      per 10 minutes of a whole day reads 144 records rather than 2880.
+ *      Each packet holds the subservice, a status byte, the field mask used,
+ *      a record count n, then n records oldest first. A record is its
+ *      hk_time_and_order followed by the sources in the mask in hk_source
+ *      order, as in GET_HK. Status is HK_BATCH_MORE on every packet except
+ *      the last. If limit cut the page short, the ground continues from the
+ *      timestamp of the last record plus the stride (or plus 1 without one)
  * @param conn
  *      Pointer to the connection on which to send packets
+ * @param start
+ *      Earliest timestamp wanted
+ * @param end
+ *      Latest timestamp wanted. 0 means up to the newest record
+ * @param stride_s
+ *      Least number of seconds between records sent. 0 sends every record,
+ *      at most one per second
+ * @param fields
+ *      Bit per hk_source to include. 0 means all of them
  * @param limit
- *      Maximum number of housekeeping files to retrieve in this request
- * @param before_id
- *      The earliest file in time that the user received. (lowest id)
- *      Files older than before_id will be fetched.
- *      Functions like a typical web API for paging. Prevents page drift.
- *      0 value means ignore variable. retrieve from most recent
+ *      Maximum number of records to send
+ * @param max_size
+ *      Largest packet data size the ground will accept. 0 means use the
+ *      largest csp buffer available
  * @return
  *      enum for success or failure
  */
-Result fetch_historic_hk_and_transmit(csp_conn_t *conn, uint16_t limit, uint16_t before_id, uint32_t before_time) {
-  SemaphoreHandle_t lock = prv_get_count_lock();
-  prv_get_lock(lock);
-  configASSERT(lock);
-  uint16_t locked_max = MAX_FILES;
-  uint16_t locked_before_id = before_id;
-  uint32_t locked_before_time = before_time;
-  if (locked_before_time != 0){ //use timestamp if exists
-    locked_before_id = get_file_id_from_timestamp(locked_before_time);
+Result fetch_hk_range_and_transmit(csp_conn_t *conn, uint32_t start, uint32_t end, uint32_t stride_s,
+                                   uint8_t fields, uint16_t limit, uint16_t max_size) {
+  uint16_t buffer_size = service_reply_room();
+  if (max_size == 0 || max_size > buffer_size) {
+    max_size = buffer_size;
+  }
+  if (end == 0) {
+    end = UINT32_MAX;
+  }
+  if (fields == 0) {
+    fields = HK_ALL_SOURCES_VALID;
+  }
+  if (fields & ~HK_ALL_SOURCES_VALID) {
+    ex2_log("Unknown hk sources in mask %hu", fields);
+    return FAILURE;
   }
-  prv_give_lock(lock);
 
-  //error check and accomodate user input
-  if (locked_before_id == 0 || locked_before_id > locked_max) {
-    locked_before_id = current_file;
+  uint16_t record_size = sizeof(hk_time_and_order);
+  int source;
+  for (source = 0; source < HK_NUM_SOURCES; source++) {
+    if (fields & (1 << source)) {
+      record_size += hk_wire_fields[source].size;
+    }
   }
-  //Check for data limit ignorance
-  if (limit > locked_max){
-    limit = (uint16_t)locked_max;
-  } else if (limit == 0) {
-    ex2_log("Successfully did nothing O_o");
-    return SUCCESS;
+  //subservice, status, mask and count bytes then the records
+  uint16_t header_size = OUT_DATA_BYTE + 2;
+  if (max_size < header_size + record_size) {
+    ex2_log("%hu bytes can't hold an hk record", max_size);
+    return FAILURE;
+  }
+  uint16_t per_packet = (max_size - header_size) / record_size;
+  if (per_packet > UINT8_MAX) {
+    per_packet = UINT8_MAX;
   }
 
-  //fetch each appropriate set of data from file
+  uint8_t *record = service_scratch();
+  Result result = SUCCESS;
+  csp_packet_t *packet = NULL;
+  uint8_t count = 0;
+  uint32_t from = start;
+
   while (limit > 0) {
-    locked_before_id--;
+    uint32_t timestamp;
+    int found = load_first_hk_in_range(from, end, record, &timestamp);
+    if (found < 0) {
+      result = FAILURE;
+      break;
+    }
+    if (found == 0) {
+      break;
+    }
 
-    if (locked_before_id == 0) {
-      locked_before_id = locked_max;
+    if (packet != NULL && count == per_packet) { //another record follows, so more
+      result = send_hk_range(conn, packet, fields, count, record_size, HK_BATCH_MORE);
+      packet = NULL;
+      if (result != SUCCESS) {
+        break;
+      }
     }
-    All_systems_housekeeping* all_hk_data = {0};
-    if (load_historic_hk_data(locked_before_id, all_hk_data) != SUCCESS) {
-      return FAILURE;
+    if (packet == NULL) {
+      packet = service_buffer_get(max_size);
+      if (packet == NULL) {
+        metrics_record_event(csp_conn_dport(conn), GET_HK_RANGE, METRIC_ALLOC_FAILURE);
+        ex2_log("Failed to get buffer for hk");
+        result = FAILURE;
+        break;
+      }
+      count = 0;
     }
-    if (convert_hk_endianness(all_hk_data) != SUCCESS) {
-      return FAILURE;
+
+    uint8_t *out = &packet->data[header_size + count * record_size];
+    memcpy(out, record, sizeof(hk_time_and_order));
+    out += sizeof(hk_time_and_order);
+    for (source = 0; source < HK_NUM_SOURCES; source++) {
+      if (fields & (1 << source)) {
+        memcpy(out, &record[hk_wire_fields[source].offset], hk_wire_fields[source].size);
+        out += hk_wire_fields[source].size;
+      }
     }
-    int8_t status = 0;
-    
-    //needed_size is currently 354 bytes as of 2021/05/25
-    //TODO:
-    //sizeof(all_hk_data->ADCS_hk) +
-    uint16_t needed_size =  sizeof(all_hk_data->hk_timeorder) + //currently 6U
-                            sizeof(all_hk_data->Athena_hk) +    //currently 24U
-                            sizeof(all_hk_data->EPS_hk) +       //currently 236U
-                            sizeof(all_hk_data->UHF_hk) +       //currently 55U
-                            sizeof(all_hk_data->S_band_hk) +    //currently 32U
-                            1;
-      
-    csp_packet_t *packet = csp_buffer_get(needed_size);
-    uint8_t ser_subtype = GET_HK;
-    memcpy(&packet->data[SUBSERVICE_BYTE], &ser_subtype, sizeof(int8_t));
+    count++;
+    limit--;
 
-    uint16_t used_size = 0;
-    memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-    memcpy(&packet->data[OUT_DATA_BYTE + used_size], &all_hk_data->hk_timeorder, sizeof(all_hk_data->hk_timeorder));
-    used_size += sizeof(all_hk_data->hk_timeorder);
-    //TODO:
-    //memcpy(&packet->data[OUT_DATA_BYTE + used_size], &all_hk_data->ADCS_hk, sizeof(all_hk_data->ADCS_hk));
-    //used_size += sizeof(all_hk_data->ADCS_hk);
-    memcpy(&packet->data[OUT_DATA_BYTE + used_size], &all_hk_data->Athena_hk, sizeof(all_hk_data->Athena_hk));
-    used_size += sizeof(all_hk_data->Athena_hk);
-    memcpy(&packet->data[OUT_DATA_BYTE + used_size], &all_hk_data->EPS_hk, sizeof(all_hk_data->EPS_hk));
-    used_size += sizeof(all_hk_data->EPS_hk);
-    memcpy(&packet->data[OUT_DATA_BYTE + used_size], &all_hk_data->UHF_hk, sizeof(all_hk_data->UHF_hk));
-    used_size += sizeof(all_hk_data->UHF_hk);
-    memcpy(&packet->data[OUT_DATA_BYTE + used_size], &all_hk_data->S_band_hk, sizeof(all_hk_data->S_band_hk));
-    used_size += sizeof(all_hk_data->S_band_hk);
-    set_packet_length(packet, used_size + 1);
-    
-    if (!csp_send(conn, packet, 50)) { //why are we all using magic number?
-      ex2_log("Failed to send packet");
+    uint32_t next = timestamp + (stride_s ? stride_s : 1);
+    if (next <= timestamp) { //wrapped past the last representable time
+      break;
+    }
+    from = next;
+  }
+
+  if (result != SUCCESS) {
+    if (packet != NULL) {
       csp_buffer_free(packet);
+    }
+    return FAILURE;
+  }
+  if (packet == NULL) { //empty range still gets a final packet
+    packet = service_buffer_get(max_size);
+    if (packet == NULL) {
+      metrics_record_event(csp_conn_dport(conn), GET_HK_RANGE, METRIC_ALLOC_FAILURE);
+      ex2_log("Failed to get buffer for hk");
       return FAILURE;
     }
-    csp_buffer_free(packet);
-    limit--;
+    count = 0;
   }
+  return send_hk_range(conn, packet, fields, count, record_size, 0);
+}
 
-  return SUCCESS;
+/**
+ * @brief
+ *      Number of stored records older than the one a cursor points at
+ * @details
+ *      A cursor whose record is still in its slot is resolved without a
+ *      search. Otherwise, after a reboot that rebuilt the index, a resize or
+ *      the ring moving on, the cursor is found again by its timestamp
+ * @attention
+ *      Caller must hold hk_read_lock and check hk_seq didn't move
+ * @param cursor
+ *      The cursor in host order. All zero means newer than everything
+ * @return uint16_t
+ *      The records older than the cursor are positions 0 up to this - 1
+ */
+static uint16_t resolve_cursor_locked(const hk_cursor *cursor) {
+  if (cursor->timestamp == 0 && cursor->slot == 0) {
+    return stored_count;
+  }
+  if (hk_index == NULL) {
+    return 0;
+  }
+  if (cursor->generation == (uint16_t)ring_generation && ring_slot_is_valid(cursor->slot) &&
+      hk_index[cursor->slot - 1].slot == cursor->slot &&
+      hk_index[cursor->slot - 1].timestamp == cursor->timestamp) {
+    return stored_count - ring_slot_age(cursor->slot);
+  }
+  return index_lower_bound(cursor->timestamp);
 }
 
 /**
  * @brief
- *      Processes the incoming requests to decide what response is needed
+ *      Load the newest record older than a cursor and advance the cursor to it
+ * @param cursor
+ *      The cursor in host order. Moved to the record loaded
+ * @param record
+ *      Where to put the record. HK_RECORD_SIZE bytes
+ * @return int
+ *      1 if a record was loaded, 0 if none is older, -1 on error
+ */
+static int load_hk_before_cursor(hk_cursor *cursor, uint8_t *record) {
+  SemaphoreHandle_t lock = prv_get_read_lock();
+  prv_get_lock(lock);
+  int found = -1;
+  hk_cursor next;
+  int tries;
+  for (tries = 0; tries < HK_READ_RETRIES && open_read_file() == SUCCESS; tries++) {
+    uint32_t seq = hk_seq_begin();
+    uint16_t older = resolve_cursor_locked(cursor);
+    found = 0;
+    if (older > 0) {
+      uint16_t slot = ring_slot_at(older - 1);
+      found = -1;
+      if (load_hk_record_locked(slot, record) == SUCCESS) {
+        uint32_t timestamp; //the record starts with its hk_time_and_order
+        memcpy(&timestamp, record, sizeof(timestamp));
+        next.timestamp = csp_ntoh32(timestamp);
+        next.slot = slot;
+        next.generation = (uint16_t)ring_generation;
+        found = 1;
+      }
+    }
+    if (!hk_seq_moved(seq)) {
+      break;
+    }
+    found = -1;
+  }
+  prv_give_lock(lock);
+  if (found == 1) {
+    *cursor = next;
+  }
+  return found;
+}
+
+/**
+ * @brief
+ *      Send the records older than each of a list of cursors
+ * @details
+ *      Every record goes in its own packet: subservice, status HK_BATCH_MORE,
+ *      the record's cursor, then the record as in GET_HK. The request ends
+ *      with a packet of status 0 holding the number of records sent.
+ *
+ *      Handing back the cursor of the last record received resumes a page
+ *      on any later connection or pass. A range of records missed in the
+ *      middle is asked for with the cursor of the record just newer than the
+ *      gap and the length of the gap, so only what is missing is sent again.
+ *      The cursor is resolved again for every record, so records stored
+ *      while a page is sent don't shift it
  * @param conn
- *      Pointer to the connection on which to receive and send packets
- * @param packet
- *      The packet that was sent from the ground station
+ *      Pointer to the connection on which to send packets
+ * @param cursors
+ *      Where each range starts, in host order. All zero for newest
+ * @param limits
+ *      Maximum number of records of each range
+ * @param ranges
+ *      Number of ranges. At most HK_CURSOR_MAX_RANGES
  * @return
- *      enum for return state
+ *      FAILURE if a packet could not be sent. The cursors already sent stay
+ *      valid for a retry
  */
-SAT_returnState hk_service_app(csp_conn_t *conn, csp_packet_t *packet) {
-  uint8_t ser_subtype = (uint8_t)packet->data[SUBSERVICE_BYTE];
-  int8_t status;
+Result fetch_hk_cursor_and_transmit(csp_conn_t *conn, const hk_cursor *cursors, const uint16_t *limits,
+                                    uint8_t ranges) {
+  uint16_t needed_size = OUT_DATA_BYTE + sizeof(hk_cursor) + HK_RECORD_SIZE;
+  uint16_t sent = 0;
+  uint8_t i;
+
+  for (i = 0; i < ranges && i < HK_CURSOR_MAX_RANGES; i++) {
+    hk_cursor cursor = cursors[i];
+    uint16_t limit = limits[i];
+    while (limit > 0) {
+      csp_packet_t *packet = service_buffer_get(needed_size);
+      if (packet == NULL) {
+        metrics_record_event(csp_conn_dport(conn), GET_HK_CURSOR, METRIC_ALLOC_FAILURE);
+        ex2_log("Failed to get buffer for hk");
+        return FAILURE;
+      }
+      int found = load_hk_before_cursor(&cursor, &packet->data[OUT_DATA_BYTE + sizeof(hk_cursor)]);
+      if (found <= 0) {
+        csp_buffer_free(packet);
+        if (found < 0) {
+          return FAILURE;
+        }
+        break; //nothing older
+      }
+
+      hk_cursor wire_cursor = cursor;
+      WIRE_SWAP(hk_cursor, &wire_cursor);
+      packet->data[SUBSERVICE_BYTE] = GET_HK_CURSOR;
+      packet->data[STATUS_BYTE] = HK_BATCH_MORE;
+      memcpy(&packet->data[OUT_DATA_BYTE], &wire_cursor, sizeof(wire_cursor));
+      set_packet_length(packet, needed_size);
+      if (!service_send(conn, packet, 50)) {
+        metrics_record_event(csp_conn_dport(conn), GET_HK_CURSOR, METRIC_SEND_FAILURE);
+        ex2_log("Failed to send packet");
+        csp_buffer_free(packet);
+        return FAILURE;
+      }
+      sent++;
+      limit--;
+    }
+  }
+
+  csp_packet_t *packet = service_buffer_get(OUT_DATA_BYTE + sizeof(uint16_t));
+  if (packet == NULL) {
+    metrics_record_event(csp_conn_dport(conn), GET_HK_CURSOR, METRIC_ALLOC_FAILURE);
+    ex2_log("Failed to get buffer for hk");
+    return FAILURE;
+  }
+  packet->data[SUBSERVICE_BYTE] = GET_HK_CURSOR;
+  packet->data[STATUS_BYTE] = 0;
+  sent = csp_hton16(sent);
+  memcpy(&packet->data[OUT_DATA_BYTE], &sent, sizeof(sent));
+  set_packet_length(packet, OUT_DATA_BYTE + sizeof(sent));
+  if (!service_send(conn, packet, 50)) {
+    metrics_record_event(csp_conn_dport(conn), GET_HK_CURSOR, METRIC_SEND_FAILURE);
+    csp_buffer_free(packet);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
+
+/**
+ * @brief
+ *      Put a status byte and reply length in a request being answered in place
+ * @param packet
+ *      The request, reused for the reply
+ * @param status
+ *      0 for success, -1 for failure
+ * @param len
+ *      Bytes of reply data already at OUT_DATA_BYTE
+ */
+static void set_hk_status(csp_packet_t *packet, int8_t status, uint16_t len) {
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + len + 1);  // +1 for subservice
+}
+
+static SAT_returnState hk_set_max_files(csp_conn_t *conn, csp_packet_t *packet) {
   uint16_t new_max_files;
+  cnv8_16(&packet->data[IN_DATA_BYTE], &new_max_files);
+  new_max_files = csp_ntoh16(new_max_files);
+
+  set_hk_status(packet, (set_max_files(new_max_files) != SUCCESS) ? -1 : 0, 0);
+  return SATR_OK;
+}
+
+static SAT_returnState hk_get_max_files(csp_conn_t *conn, csp_packet_t *packet) {
+  uint16_t new_max_files = csp_hton16(MAX_FILES);
+  memcpy(&packet->data[OUT_DATA_BYTE], &new_max_files, sizeof(new_max_files));
+  set_hk_status(packet, 0, sizeof(new_max_files));
+  return SATR_OK;
+}
+
+static SAT_returnState hk_set_cache_size(csp_conn_t *conn, csp_packet_t *packet) {
+  uint16_t cache_size;
+  cnv8_16LE(&packet->data[IN_DATA_BYTE], &cache_size);
+  cache_size = csp_ntoh16(cache_size);
+
+  set_hk_status(packet, (set_cache_size(cache_size) != SUCCESS) ? -1 : 0, 0);
+  return SATR_OK;
+}
+
+static SAT_returnState hk_get_cache_size(csp_conn_t *conn, csp_packet_t *packet) {
+  uint16_t cache_size = csp_hton16(hk_cache_size);
+  memcpy(&packet->data[OUT_DATA_BYTE], &cache_size, sizeof(cache_size));
+  set_hk_status(packet, 0, sizeof(cache_size));
+  return SATR_OK;
+}
+
+static SAT_returnState hk_set_period(csp_conn_t *conn, csp_packet_t *packet) {
+  uint8_t source = packet->data[IN_DATA_BYTE];
+  uint32_t period;
+  cnv8_32(&packet->data[IN_DATA_BYTE + 1], &period);
+  period = csp_ntoh32(period);
+
+  set_hk_status(packet, (set_hk_period(source, period) != SUCCESS) ? -1 : 0, 0);
+  return SATR_OK;
+}
+
+static SAT_returnState hk_get_periods(csp_conn_t *conn, csp_packet_t *packet) {
+  int i;
+  for (i = 0; i < HK_NUM_SOURCES; i++) {
+    uint32_t period = csp_hton32(hk_period_s[i]);
+    memcpy(&packet->data[OUT_DATA_BYTE + i * sizeof(period)], &period, sizeof(period));
+  }
+  set_hk_status(packet, 0, HK_NUM_SOURCES * sizeof(uint32_t));
+  return SATR_OK;
+}
+
+static SAT_returnState hk_get_hk(csp_conn_t *conn, csp_packet_t *packet) {
+  uint16_t limit = (uint16_t)packet->data16[IN_DATA_BYTE];
+  uint16_t before_id = (uint16_t)packet->data16[IN_DATA_BYTE + 1];
+  uint32_t before_time = (uint32_t)packet->data16[IN_DATA_BYTE + 2];
+
+  csp_buffer_free(packet); //request is not reused for the response
+  if (fetch_historic_hk_and_transmit(conn, limit, before_id, before_time) != SUCCESS) {
+    return SATR_ERROR;
+  }
+  return SATR_OK;
+}
+
+static SAT_returnState hk_get_hk_batch(csp_conn_t *conn, csp_packet_t *packet) {
   uint16_t limit;
   uint16_t before_id;
   uint32_t before_time;
+  uint16_t max_size;
+  cnv8_16LE(&packet->data[IN_DATA_BYTE], &limit);
+  limit = csp_ntoh16(limit);
+  cnv8_16LE(&packet->data[IN_DATA_BYTE + 2], &before_id);
+  before_id = csp_ntoh16(before_id);
+  cnv8_32(&packet->data[IN_DATA_BYTE + 4], &before_time);
+  before_time = csp_ntoh32(before_time);
+  cnv8_16LE(&packet->data[IN_DATA_BYTE + 8], &max_size);
+  max_size = csp_ntoh16(max_size);
+  uint8_t encoding = packet->data[IN_DATA_BYTE + 10];
+
+  csp_buffer_free(packet); //request is not reused for the response
+  if (fetch_historic_hk_batch_and_transmit(conn, limit, before_id, before_time,
+                                           max_size, encoding) != SUCCESS) {
+    return SATR_ERROR;
+  }
+  return SATR_OK;
+}
 
-  switch (ser_subtype) {
-    case SET_MAX_FILES:
-      cnv8_16(&packet->data[IN_DATA_BYTE], &new_max_files);
-      new_max_files = csp_ntoh16(new_max_files);
-
-      if (set_max_files(new_max_files) != SUCCESS) {
-        status = -1;
-        memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      } else {
-        status = 0;
-        memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      }
+static SAT_returnState hk_get_hk_range(csp_conn_t *conn, csp_packet_t *packet) {
+  uint32_t start;
+  uint32_t end;
+  uint32_t stride_s;
+  uint16_t limit;
+  uint16_t max_size;
+  cnv8_32(&packet->data[IN_DATA_BYTE], &start);
+  start = csp_ntoh32(start);
+  cnv8_32(&packet->data[IN_DATA_BYTE + 4], &end);
+  end = csp_ntoh32(end);
+  cnv8_32(&packet->data[IN_DATA_BYTE + 8], &stride_s);
+  stride_s = csp_ntoh32(stride_s);
+  cnv8_16LE(&packet->data[IN_DATA_BYTE + 12], &limit);
+  limit = csp_ntoh16(limit);
+  cnv8_16LE(&packet->data[IN_DATA_BYTE + 14], &max_size);
+  max_size = csp_ntoh16(max_size);
+  uint8_t fields = packet->data[IN_DATA_BYTE + 16];
+
+  csp_buffer_free(packet); //request is not reused for the response
+  if (fetch_hk_range_and_transmit(conn, start, end, stride_s, fields, limit, max_size) != SUCCESS) {
+    return SATR_ERROR;
+  }
+  return SATR_OK;
+}
 
-      set_packet_length(packet, sizeof(int8_t) + 1);  // +1 for subservice
+static SAT_returnState hk_get_hk_cursor(csp_conn_t *conn, csp_packet_t *packet) {
+  //arguments are ranges back to back, each a cursor then a limit
+  hk_cursor cursors[HK_CURSOR_MAX_RANGES];
+  uint16_t limits[HK_CURSOR_MAX_RANGES];
+  uint16_t range_size = sizeof(hk_cursor) + sizeof(uint16_t);
+  uint16_t ranges = (packet->length - IN_DATA_BYTE) / range_size;
+  uint16_t i;
+  if (ranges > HK_CURSOR_MAX_RANGES) {
+    ranges = HK_CURSOR_MAX_RANGES;
+  }
+  for (i = 0; i < ranges; i++) {
+    const uint8_t *range = &packet->data[IN_DATA_BYTE + i * range_size];
+    memcpy(&cursors[i], range, sizeof(hk_cursor));
+    WIRE_SWAP(hk_cursor, &cursors[i]);
+    cnv8_16LE((uint8_t *)&range[sizeof(hk_cursor)], &limits[i]);
+    limits[i] = csp_ntoh16(limits[i]);
+  }
 
-      if (!csp_send(conn, packet, 50)) {
-        csp_buffer_free(packet);
-      }
-      break;
-    
-    case GET_MAX_FILES:
-      new_max_files = MAX_FILES;
-      new_max_files = csp_hton16(new_max_files);
-      status = 0;
-      memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      memcpy(&packet->data[OUT_DATA_BYTE], &new_max_files, sizeof(new_max_files));
-
-      set_packet_length(packet, sizeof(int8_t)
-                              + sizeof(new_max_files)
-                              + 1);  // +1 for subservice
-
-      if (!csp_send(conn, packet, 50)) {
-        csp_buffer_free(packet);
-      }
-      break;
+  csp_buffer_free(packet); //request is not reused for the response
+  if (fetch_hk_cursor_and_transmit(conn, cursors, limits, (uint8_t)ranges) != SUCCESS) {
+    return SATR_ERROR;
+  }
+  return SATR_OK;
+}
 
-    case GET_HK:
-      limit = (uint16_t)packet->data16[IN_DATA_BYTE];
-      before_id = (uint16_t)packet->data16[IN_DATA_BYTE + 1];
-      before_time = (uint32_t)packet->data16[IN_DATA_BYTE + 2];
+static SAT_returnState hk_get_stats(csp_conn_t *conn, csp_packet_t *packet) {
+  uint16_t fields;
+  uint32_t start;
+  uint32_t end;
+  cnv8_16LE(&packet->data[IN_DATA_BYTE], &fields);
+  fields = csp_ntoh16(fields);
+  cnv8_32(&packet->data[IN_DATA_BYTE + 2], &start);
+  start = csp_ntoh32(start);
+  cnv8_32(&packet->data[IN_DATA_BYTE + 6], &end);
+  end = csp_ntoh32(end);
+  if (end == 0) {
+    end = (uint32_t)time(NULL);
+  }
 
-      if (fetch_historic_hk_and_transmit(conn, limit, before_id, before_time) != SUCCESS) {
-        return SATR_ERROR;
-      }
+  //one entry per field in the mask: id, count, crossings, min, max, mean, stddev
+  uint8_t *out = &packet->data[OUT_DATA_BYTE];
+  int8_t status = 0;
+  uint8_t field;
+  for (field = 0; field < HK_STAT_NUM_FIELDS; field++) {
+    hk_field_stats stats;
+    if (!(fields & (1 << field))) {
+      continue;
+    }
+    if (hk_stats_get(field, start, end, &stats) != SUCCESS) {
+      status = -1;
+      out = &packet->data[OUT_DATA_BYTE];
       break;
-
-    default:
-      ex2_log("No such subservice\n");
-      return SATR_PKT_ILLEGAL_SUBSERVICE;
+    }
+    uint32_t words[6];
+    words[0] = csp_hton32(stats.count);
+    words[1] = csp_hton32(stats.crossings);
+    memcpy(&words[2], &stats.min, sizeof(float));
+    memcpy(&words[3], &stats.max, sizeof(float));
+    memcpy(&words[4], &stats.mean, sizeof(float));
+    memcpy(&words[5], &stats.stddev, sizeof(float));
+    int i;
+    for (i = 2; i < 6; i++) { //floats go down as their network order bit pattern
+      words[i] = csp_hton32(words[i]);
+    }
+    *out++ = field;
+    memcpy(out, words, sizeof(words));
+    out += sizeof(words);
   }
+  set_hk_status(packet, status, out - &packet->data[OUT_DATA_BYTE]);
+  return SATR_OK;
+}
 
+static SAT_returnState hk_set_stat_threshold(csp_conn_t *conn, csp_packet_t *packet) {
+  uint8_t field = packet->data[IN_DATA_BYTE];
+  uint32_t bits;
+  float threshold;
+  cnv8_32(&packet->data[IN_DATA_BYTE + 1], &bits);
+  bits = csp_ntoh32(bits);
+  memcpy(&threshold, &bits, sizeof(threshold));
 
-  
-
+  set_hk_status(packet, (hk_stats_set_threshold(field, threshold) != SUCCESS) ? -1 : 0, 0);
   return SATR_OK;
 }
 
-SAT_returnState start_housekeeping_service(void);
+/*housekeeping subservices. lengths exclude the subservice and status bytes*/
+static const subservice_entry hk_subservices[] = {
+  [GET_HK] = {hk_get_hk, 7, 0, PRIV_ANY, SUBSERVICE_SENDS | SUBSERVICE_BULK}, //args are data16[1..3]
+  [SET_MAX_FILES] = {hk_set_max_files, sizeof(uint16_t), 0, PRIV_GROUND, 0},
+  [GET_MAX_FILES] = {hk_get_max_files, 0, sizeof(uint16_t), PRIV_ANY, 0},
+  [GET_HK_BATCH] = {hk_get_hk_batch, 11, 0, PRIV_ANY, SUBSERVICE_SENDS | SUBSERVICE_BULK},
+  [SET_CACHE_SIZE] = {hk_set_cache_size, sizeof(uint16_t), 0, PRIV_GROUND, 0},
+  [GET_CACHE_SIZE] = {hk_get_cache_size, 0, sizeof(uint16_t), PRIV_ANY, 0},
+  [SET_HK_PERIOD] = {hk_set_period, 1 + sizeof(uint32_t), 0, PRIV_GROUND, 0},
+  [GET_HK_PERIODS] = {hk_get_periods, 0, HK_NUM_SOURCES * sizeof(uint32_t), PRIV_ANY, 0},
+  [GET_HK_RANGE] = {hk_get_hk_range, 17, 0, PRIV_ANY, SUBSERVICE_SENDS | SUBSERVICE_BULK},
+  [GET_HK_STATS] = {hk_get_stats, 10, HK_STAT_NUM_FIELDS * HK_STATS_WIRE_SIZE, PRIV_ANY, 0},
+  [SET_HK_STAT_THRESHOLD] = {hk_set_stat_threshold, 1 + sizeof(float), 0, PRIV_GROUND, 0},
+  [GET_HK_CURSOR] = {hk_get_hk_cursor, sizeof(hk_cursor) + sizeof(uint16_t),
+                     sizeof(hk_cursor) + HK_RECORD_SIZE, PRIV_ANY, SUBSERVICE_SENDS | SUBSERVICE_BULK},
+};
+
+/**
+ * @brief
+ *      Processes the incoming requests to decide what response is needed
+ * @details
+ *      See hk_subservices
+ * @param conn
+ *      Pointer to the connection on which to receive and send packets
+ * @param packet
+ *      The packet that was sent from the ground station. Always consumed
+ * @return
+ *      enum for return state
+ */
+SAT_returnState hk_service_app(csp_conn_t *conn, csp_packet_t *packet) {
+  return dispatch_subservice(hk_subservices, TABLE_LEN(hk_subservices), conn, packet);
+}
+
+/**
+ * @brief
+ *      Private. Rebuild the statistics from the records still in the ring
+ * @details
+ *      Only records young enough to land in a kept bucket are read
+ * @attention
+ *      Caller must hold f_count_lock and hk_read_lock
+ */
+static void replay_hk_stats(void) {
+  if (hk_index == NULL || stored_count == 0) {
+    return;
+  }
+  uint8_t *record = malloc(HK_RECORD_SIZE);
+  All_systems_housekeeping *sample = malloc(sizeof(*sample));
+  if (record != NULL && sample != NULL) {
+    uint32_t horizon = (uint32_t)HK_STATS_BUCKETS * HK_STATS_BUCKET_S;
+    uint32_t now = (uint32_t)time(NULL);
+    uint16_t position = index_lower_bound((now > horizon) ? now - horizon : 0);
+    for (; position < stored_count; position++) {
+      if (load_hk_record_locked(ring_slot_at(position), record) == SUCCESS) {
+        deserialize_hk_record(sample, record);
+        hk_stats_add(sample);
+      }
+    }
+  } else {
+    ex2_log("Error, failed to malloc hk stats replay\n");
+  }
+  free(sample);
+  free(record);
+}
 
 /**
  * @brief
- *      FreeRTOS housekeeping server task
+ *      FreeRTOS task preallocating storage for slots added by a resize
  * @details
- *      Accepts incoming housekeeping service packets and executes the application
+ *      Works HK_STORAGE_STEP slots at a time and lets go of f_count_lock in
+ *      between, so samples go on while a large resize is backed. A step that
+ *      fails is tried again on the next resize or boot
  * @param void* param
  * @return None
  */
-void housekeeping_service(void * param) {
-    csp_socket_t *sock;
-    sock = csp_socket(CSP_SO_RDPREQ);
-    csp_bind(sock, TC_HOUSEKEEPING_SERVICE);
-    csp_listen(sock, SERVICE_BACKLOG_LEN);
-
-    for(;;) {
-        csp_conn_t *conn;
-        csp_packet_t *packet;
-        if ((conn = csp_accept(sock, CSP_MAX_TIMEOUT)) == NULL) {
-          /* timeout */
-          continue;
-        }
-        while ((packet = csp_read(conn, 50)) != NULL) {
-          /*
-          if (hk_service_app(packet) != SATR_OK) {
-            // something went wrong, this shouldn't happen
-            csp_buffer_free(packet);
-          } else {
-              if (!csp_send(conn, packet, 50)) {
-                  csp_buffer_free(packet);
-              }
-          }
-          */
-          if (hk_service_app(conn, packet) != SATR_OK) {
-            ex2_log("Error responding to packet");
-          }
+static void hk_storage_task(void *param) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    int more = 1;
+    while (more) {
+      SemaphoreHandle_t lock = prv_get_count_lock();
+      prv_get_lock(lock); //lock
+      more = 0;
+      if (backed_slots < MAX_FILES) {
+        uint16_t step = (MAX_FILES - backed_slots > HK_STORAGE_STEP) ? backed_slots + HK_STORAGE_STEP
+                                                                      : MAX_FILES;
+        if (preallocate_ring(step) == SUCCESS && preallocate_index(step) == SUCCESS) {
+          backed_slots = step;
+          more = (backed_slots < MAX_FILES);
         }
-        csp_close(conn); //frees buffers used
+      }
+      prv_give_lock(lock); //unlock
+      if (more) {
+        vTaskDelay(pdMS_TO_TICKS(HK_STORAGE_PAUSE_MS));
+      }
     }
+  }
 }
 
 /**
  * @brief
- *      Start the housekeeping server task
+ *      Start the housekeeping storage and sampling
  * @details
- *      Starts the FreeRTOS task responsible for accepting incoming
- *      housekeeping service requests
+ *      Restores the ring and starts the storage, poller and sampler tasks. Requests
+ *      are served by the service workers through hk_service_app
  * @param None
  * @return SAT_returnState
  *      success report
  */
 SAT_returnState start_housekeeping_service(void) {
-  if (xTaskCreate((TaskFunction_t)housekeeping_service,
-                  "start_housekeeping_service", 300, NULL, NORMAL_SERVICE_PRIO,
-                  NULL) != pdPASS) {
-    ex2_log("FAILED TO CREATE TASK start_housekeeping_service\n");
+  SemaphoreHandle_t lock = prv_get_count_lock();
+  prv_get_lock(lock); //lock
+  //started first so a resize interrupted by a reboot is carried on
+  if (census_task_create((TaskFunction_t)hk_storage_task, "hk_storage", HK_STORAGE_STACK,
+                         NULL, tskIDLE_PRIORITY + 1, &hk_storage_handle) != pdPASS) {
+    hk_storage_handle = NULL;
+    ex2_log("Resized hk storage will be preallocated inline\n");
+  }
+  //restore ring position from storage before any sample or request
+  if (open_ring_file() != SUCCESS) {
+    ex2_log("Housekeeping storage unavailable\n");
+  } else {
+    SemaphoreHandle_t read_lock = prv_get_read_lock();
+    prv_get_lock(read_lock);
+    replay_hk_stats();
+    prv_give_lock(read_lock);
+  }
+  prv_give_lock(lock); //unlock
+
+  if (start_hk_pollers() != SATR_OK) {
+    ex2_log("Some hk sources will be polled inline\n");
+  }
+
+  sample_lock = xSemaphoreCreateMutex();
+  if (sample_lock == NULL ||
+      census_task_create((TaskFunction_t)hk_sampler_task, "hk_sampler", HK_SAMPLER_STACK,
+                         NULL, NORMAL_SERVICE_PRIO, NULL) != pdPASS) {
+    ex2_log("FAILED TO CREATE TASK hk_sampler\n");
     return SATR_ERROR;
   }
-  ex2_log("Service handlers started\n");
   return SATR_OK;
 }
 
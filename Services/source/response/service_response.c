@@ -25,51 +25,204 @@
 #include <stdint.h>
 
 #include "util/service_utilities.h"
+#include "util/task_census.h"
 #include "services.h"
 
 xQueueHandle response_queue;
 
+typedef struct {
+  csp_conn_t *conn;  // NULL if the slot is free
+  uint8_t dst;
+  uint8_t dport;
+  TickType_t last_used;
+} response_conn;
+
+static response_conn response_conns[RESPONSE_CONN_CACHE_LEN];
+
+// a connection idle for RESPONSE_CONN_IDLE_MS is closed by a sweep up to half
+// that later, which must still be before libcsp times it out
+typedef char response_idle_fits_rdp[(RESPONSE_CONN_IDLE_MS * 3 / 2 < RESPONSE_RDP_CONN_TIMEOUT_MS) ? 1 : -1];
+
+/**
+ * @brief
+ *      Close a cached connection and free its slot
+ */
+static void close_response_conn(response_conn *cached) {
+  csp_close(cached->conn);
+  cached->conn = NULL;
+}
+
+/**
+ * @brief
+ *      Free the slot of a cached connection that can't be used any more
+ * @details
+ *      One idle for RESPONSE_CONN_IDLE_MS is closed. One that no longer
+ *      describes an RDP connection to the slot's destination was dropped by
+ *      libcsp and may already belong to someone else, so it is forgotten
+ *      without being closed
+ * @param cached
+ *      Slot holding a connection
+ * @param now
+ *      Current tick count
+ */
+static void drop_stale_response_conn(response_conn *cached, TickType_t now) {
+  if (csp_conn_dst(cached->conn) != cached->dst ||
+      csp_conn_dport(cached->conn) != cached->dport ||
+      !(csp_conn_flags(cached->conn) & CSP_FRDP)) {
+    cached->conn = NULL;
+  } else if (now - cached->last_used >= pdMS_TO_TICKS(RESPONSE_CONN_IDLE_MS)) {
+    close_response_conn(cached);
+  }
+}
+
+/**
+ * @brief
+ *      Get an open connection to a destination, reusing a cached one
+ * @details
+ *      A cached connection is checked with drop_stale_response_conn before
+ *      it is reused. If there is no connection to (dst, dport) a new one is
+ *      made. When the cache is full the least recently used connection is
+ *      closed to make room
+ * @param dst
+ *      CSP address of the destination
+ * @param dport
+ *      Port of the destination
+ * @param reused
+ *      Set to true if the connection came from the cache
+ * @return response_conn *
+ *      The cache slot of the connection, NULL if the connect failed
+ */
+static response_conn *get_response_conn(uint8_t dst, uint8_t dport, bool *reused) {
+  response_conn *slot = NULL;
+  TickType_t now = xTaskGetTickCount();
+  int i;
+  for (i = 0; i < RESPONSE_CONN_CACHE_LEN; i++) {
+    response_conn *cached = &response_conns[i];
+    if (cached->conn != NULL && cached->dst == dst && cached->dport == dport) {
+      drop_stale_response_conn(cached, now);
+      if (cached->conn != NULL) {
+        *reused = true;
+        return cached;
+      }
+    }
+    if (slot == NULL || (slot->conn != NULL &&
+                         (cached->conn == NULL ||
+                          now - cached->last_used > now - slot->last_used))) {
+      slot = cached;
+    }
+  }
+
+  *reused = false;
+  if (slot->conn != NULL) {
+    drop_stale_response_conn(slot, now);
+  }
+  if (slot->conn != NULL) {
+    close_response_conn(slot);
+  }
+  // Connect with a connection-oriented method.
+  slot->conn = csp_connect(CSP_PRIO_NORM, dst, dport, RESPONSE_CONNECT_TIMEOUT_MS, CSP_O_RDP);
+  if (slot->conn == NULL) {
+    csp_log_error("Failed to get CSP CONNECTION");
+    return NULL;
+  }
+  slot->dst = dst;
+  slot->dport = dport;
+  slot->last_used = now;
+  return slot;
+}
+
+/**
+ * @brief
+ *      Send a response over a cached connection
+ * @details
+ *      A cached connection may have been closed by the other end since it
+ *      was last used, so a failed send on one is retried once over a new
+ *      connection
+ * @param packet
+ *      The response. Always consumed
+ */
+static void send_response(csp_packet_t *packet) {
+  // We're assuming that packet responses should be returned to sender.
+  uint8_t dst = packet->id.src;
+  uint8_t dport = packet->id.dport;
+  int attempt;
+  for (attempt = 0; attempt < 2; attempt++) {
+    bool reused;
+    response_conn *cached = get_response_conn(dst, dport, &reused);
+    if (cached == NULL) {
+      break;
+    }
+    if (csp_send(cached->conn, packet, RESPONSE_SEND_TIMEOUT_MS)) {
+      cached->last_used = xTaskGetTickCount();
+      return;
+    }
+    close_response_conn(cached);
+    if (!reused) {
+      break;
+    }
+  }
+  csp_buffer_free(packet);
+}
+
+/**
+ * @brief
+ *      Close connections that haven't been used for RESPONSE_CONN_IDLE_MS
+ *      and forget ones libcsp dropped
+ */
+static void expire_response_conns(void) {
+  TickType_t now = xTaskGetTickCount();
+  int i;
+  for (i = 0; i < RESPONSE_CONN_CACHE_LEN; i++) {
+    response_conn *cached = &response_conns[i];
+    if (cached->conn != NULL) {
+      drop_stale_response_conn(cached, now);
+    }
+  }
+}
+
 /**
  * @brief
  * 		Wait on a queue of responses to be sent to other CSP nodes
  *              (usually the ground)
  * @details
  * 		CSP client server will wake when data is in the queue for
- *              downlink (telemetery)
+ *              downlink (telemetery). Everything queued at that point is
+ *              taken at once and sent grouped by destination, in queue
+ *              order per destination, over connections that stay open
+ *              between wakes so consecutive responses share one handshake
  * @param void * param
  * 		Not used
- * @return
- * 		A SAT_returnState depending on whether we were successful
- *              in connecting. Not typically used for anything.
  */
 void service_response_task(void *param) {
-  TC_TM_app_id my_address = SYSTEM_APP_ID;
-  csp_packet_t *packet;
-  uint32_t data;
+  csp_packet_t *pending[RESPONSE_QUEUE_LEN];
   for (;;) {
-    if (xQueueReceive(response_queue, &packet,
-                      NORMAL_TICKS_TO_WAIT) == pdPASS) {
-      // Connect with a connection-oriented method.
-      // We're assuming that packet responses should be returned to sender.
-      csp_conn_t *conn = csp_connect(CSP_PRIO_NORM,     // priority
-                                     packet->id.src,    // destination address
-                                     packet->id.dport,  // destination port
-                                     1000,              // timeout (ms)
-                                     CSP_O_RDP         // options
-      );
-
-      if (conn == NULL) {
-        csp_log_error("Failed to get CSP CONNECTION");
+    int count = 0;
+    if (xQueueReceive(response_queue, &pending[count],
+                      pdMS_TO_TICKS(RESPONSE_CONN_IDLE_MS / 2)) == pdPASS) {
+      count++;
+      // coalesce whatever else is waiting
+      while (count < RESPONSE_QUEUE_LEN &&
+             xQueueReceive(response_queue, &pending[count], 0) == pdPASS) {
+        count++;
       }
+    }
 
-      // Send packet to ground
-      if (!csp_send(conn, packet, 1000)) {
-        csp_buffer_free(packet);
+    int i, j;
+    for (i = 0; i < count; i++) {
+      if (pending[i] == NULL) {
+        continue;  // already sent with an earlier packet of the same destination
+      }
+      uint8_t dst = pending[i]->id.src;
+      uint8_t dport = pending[i]->id.dport;
+      for (j = i; j < count; j++) {
+        if (pending[j] != NULL && pending[j]->id.src == dst && pending[j]->id.dport == dport) {
+          send_response(pending[j]);
+          pending[j] = NULL;
+        }
       }
-
-      // Close connection
-      csp_close(conn);
     }
+
+    expire_response_conns();
   }
 }
 
@@ -97,8 +250,8 @@ SAT_returnState start_service_response() {
     return SATR_ERROR;
   }
 
-  if (xTaskCreate((TaskFunction_t)service_response_task, "RESPONSE SERVER", 500,
-                  NULL, configMAX_PRIORITIES - 1 , NULL) != pdPASS) {
+  if (census_task_create((TaskFunction_t)service_response_task, "RESPONSE SERVER", 500,
+                         NULL, configMAX_PRIORITIES - 1 , NULL) != pdPASS) {
     return SATR_ERROR;
   }
   return SATR_OK;
@@ -21,79 +21,562 @@
 
 #include <FreeRTOS.h>
 #include <os_task.h>
+#include <os_queue.h>
 #include <csp/csp.h>
+#include <string.h>
 
 #include "communication/communication_service.h"
 #include "housekeeping/housekeeping_service.h"
 #include "time_management/time_management_service.h"
+#include "util/log_ring.h"
+#include "util/service_buffers.h"
+#include "util/service_metrics.h"
 #include "util/service_utilities.h"
+#include "util/task_census.h"
 #include "general.h"
 
-void csp_server(void *parameters);
+typedef struct {
+  service_handler_t handler;
+  bool rdp_required; //connections without RDP are closed unread
+  bool subservices;  //packets start with a subservice byte and may be tagged
+  uint8_t cls;       //service_class of its connections
+} service_port;
+
+static SAT_returnState csp_port_handler(csp_conn_t *conn, csp_packet_t *packet);
+
+/* every port the dispatcher accepts and who handles it */
+static const service_port service_ports[MAX_SERVICES] = {
+  [CSP_PING] = {csp_port_handler, false, false, SERVICE_CLASS_INTERACTIVE},
+  [TC_TIME_MANAGEMENT_SERVICE] = {time_management_handler, true, true, SERVICE_CLASS_INTERACTIVE},
+  [TC_HOUSEKEEPING_SERVICE] = {hk_service_app, true, true, SERVICE_CLASS_INTERACTIVE},
+  [TC_COMMUNICATION_SERVICE] = {communication_service_handler, true, true, SERVICE_CLASS_CONTROL},
+  [TC_GENERAL_SERVICE] = {general_handler, true, true, SERVICE_CLASS_CONTROL},
+};
+
+/* CSP priority replies of each class are sent at */
+static const uint8_t service_class_prio[SERVICE_NUM_CLASSES] = {
+  [SERVICE_CLASS_INTERACTIVE] = CSP_PRIO_NORM,
+  [SERVICE_CLASS_CONTROL] = CSP_PRIO_HIGH,
+  [SERVICE_CLASS_BULK] = CSP_PRIO_LOW,
+};
+
+static xQueueHandle service_conn_queue;
+static xQueueHandle service_control_queue;
+static volatile uint8_t control_active; //control connections being served
+
+/* one scratch arena per worker, uint32_t so any struct can be placed in it.
+   the extra one is for handlers called outside the pool */
+static TaskHandle_t service_workers[SERVICE_WORKER_COUNT];
+static uint32_t service_scratch_arena[SERVICE_WORKER_COUNT + 1]
+                                     [(SERVICE_SCRATCH_SIZE + sizeof(uint32_t) - 1) / sizeof(uint32_t)];
+
+/* the request each worker is running */
+typedef struct {
+  bool tagged;         //see SUBSERVICE_TAGGED
+  uint8_t request_id;
+  uint8_t cls;         //service_class
+  uint8_t bulk_sent;   //packets sent since the last pause
+  int8_t *step_status; //set while a command list step runs, see service_run_step
+  bool step_replied;
+  uint8_t step_port;
+} service_request;
+
+static service_request service_requests[SERVICE_WORKER_COUNT + 1];
+
+void service_dispatcher(void *parameters);
+void service_worker(void *parameters);
 SAT_returnState start_service_server(void);
 
 /**
  * @brief
- *      Start the services server, and response task
+ *      Start the services, the dispatcher and its worker pool
  * @details
- *      intitializes the FreeRTOS queue and task
+ *      intitializes the FreeRTOS queue and tasks
  * @param void
  * @return SAT_returnState
  *      success or failure
  */
 SAT_returnState start_service_server(void) {
-  if (xTaskCreate((TaskFunction_t)csp_server, "csp_server THREAD", 256, NULL,
-                  NORMAL_SERVICE_PRIO, NULL) != pdPASS) {
+  if (!(service_conn_queue =
+            xQueueCreate((unsigned portBASE_TYPE)SERVICE_CONN_QUEUE_LEN,
+                         (unsigned portBASE_TYPE)CSP_CONN_QUEUE_SIZE)) ||
+      !(service_control_queue =
+            xQueueCreate((unsigned portBASE_TYPE)SERVICE_CONN_QUEUE_LEN,
+                         (unsigned portBASE_TYPE)CSP_CONN_QUEUE_SIZE))) {
+    return SATR_ERROR;
+  }
+
+  if (service_buffers_init() != SATR_OK || start_log_drain() != SATR_OK ||
+      start_task_census() != SATR_OK) {
+    return SATR_ERROR;
+  }
+
+  if (start_time_management_service() != SATR_OK ||
+          start_housekeeping_service() != SATR_OK) {
+    return SATR_ERROR;
+  }
+
+  int i;
+  for (i = 0; i < SERVICE_WORKER_COUNT; i++) {
+    bool control = (i < SERVICE_CONTROL_WORKERS);
+    if (census_task_create((TaskFunction_t)service_worker, "service_worker", SERVICE_WORKER_STACK,
+                           control ? service_control_queue : service_conn_queue,
+                           control ? CONTROL_SERVICE_PRIO : NORMAL_SERVICE_PRIO,
+                           &service_workers[i]) != pdPASS) {
+      ex2_log("FAILED TO CREATE TASK service_worker\n");
+      return SATR_ERROR;
+    }
+  }
+
+  if (census_task_create((TaskFunction_t)service_dispatcher, "service_dispatcher", 256,
+                         NULL, CONTROL_SERVICE_PRIO, NULL) != pdPASS) {
+    ex2_log("FAILED TO CREATE TASK service_dispatcher\n");
+    return SATR_ERROR;
+  }
+  ex2_log("Service handlers started\n");
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Which worker is calling
+ * @return int
+ *      Index into the per worker state. SERVICE_WORKER_COUNT for any other task
+ */
+static int worker_index(void) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  int i;
+  for (i = 0; i < SERVICE_WORKER_COUNT; i++) {
+    if (service_workers[i] == self) {
+      return i;
+    }
+  }
+  return SERVICE_WORKER_COUNT;
+}
+
+/**
+ * @brief
+ *      Scratch storage for the handler being run
+ * @details
+ *      Each worker owns SERVICE_SCRATCH_SIZE bytes that the handler it is
+ *      running may use for the duration of one packet, so no handler needs
+ *      the heap and the worker stacks don't have to fit the largest struct
+ * @attention
+ *      Only valid inside a handler. The contents are not cleared between
+ *      packets. Handlers called by anything but a worker, like the command
+ *      schedule or the benchmark, share one arena so at most one such task
+ *      may call them
+ * @return void *
+ *      The calling worker's arena
+ */
+void *service_scratch(void) {
+  return service_scratch_arena[worker_index()];
+}
+
+/**
+ * @brief
+ *      Whether a command is waiting for or being served by a control worker
+ */
+static bool control_pending(void) {
+  return control_active > 0 || uxQueueMessagesWaiting(service_control_queue) > 0;
+}
+
+/**
+ * @brief
+ *      Pause a bulk transfer at the end of a slice
+ * @details
+ *      Every SERVICE_BULK_SLICE packets, or right away if a command is
+ *      waiting, the worker sleeps so the link and the CPU go to the command.
+ *      It keeps sleeping while commands are pending, up to
+ *      SERVICE_BULK_MAX_PAUSE_MS, then carries on where it stopped
+ * @param request
+ *      The bulk request being run
+ */
+static void bulk_pause(service_request *request) {
+  if (++request->bulk_sent < SERVICE_BULK_SLICE && !control_pending()) {
+    return;
+  }
+  request->bulk_sent = 0;
+  TickType_t start = xTaskGetTickCount();
+  do {
+    vTaskDelay(pdMS_TO_TICKS(SERVICE_BULK_PAUSE_MS));
+  } while (control_pending() &&
+           xTaskGetTickCount() - start < pdMS_TO_TICKS(SERVICE_BULK_MAX_PAUSE_MS));
+}
+
+/**
+ * @brief
+ *      Send a reply to the request being run
+ * @details
+ *      Same as csp_send, except that replies to a tagged request get its
+ *      subservice and request id bytes put back in front, replies are sent
+ *      at the CSP priority of the request's class and bulk transfers pause
+ *      between slices. Replies of a command list step aren't sent, see
+ *      service_run_step
+ * @param conn
+ *      The connection the request arrived on
+ * @param packet
+ *      The reply, laid out as SUBSERVICE_BYTE, STATUS_BYTE and data
+ * @param timeout
+ *      As for csp_send
+ * @return int
+ *      As csp_send. 0 means the caller still owns packet
+ */
+int service_send(csp_conn_t *conn, csp_packet_t *packet, uint32_t timeout) {
+  int worker = worker_index();
+  service_request *request = &service_requests[worker];
+  if (request->step_status != NULL) {
+    //a command list step. keep its status instead of sending, the first
+    //failure of a step that replies more than once sticks
+    int8_t status = 0;
+    if (packet->length > STATUS_BYTE) {
+      memcpy(&status, &packet->data[STATUS_BYTE], sizeof(status));
+    }
+    if (!request->step_replied || *request->step_status == 0) {
+      *request->step_status = status;
+    }
+    request->step_replied = true;
+    csp_buffer_free(packet);
+    return 1;
+  }
+  if (request->tagged && packet->length > SUBSERVICE_BYTE) {
+    if (packet->length + REQUEST_TAG_LEN > csp_buffer_data_size()) {
+      ex2_log("No room to tag reply %hu\n", request->request_id);
+      return 0;
+    }
+    memmove(&packet->data[REQUEST_ID_BYTE + REQUEST_TAG_LEN], &packet->data[REQUEST_ID_BYTE],
+            packet->length - REQUEST_ID_BYTE);
+    packet->data[SUBSERVICE_BYTE] |= SUBSERVICE_TAGGED;
+    packet->data[REQUEST_ID_BYTE] = request->request_id;
+    packet->length += REQUEST_TAG_LEN;
+  }
+  if (!csp_send_prio(service_class_prio[request->cls], conn, packet, timeout)) {
+    return 0;
+  }
+  if (request->cls == SERVICE_CLASS_BULK && worker < SERVICE_WORKER_COUNT) {
+    bulk_pause(request);
+  }
+  return 1;
+}
+
+/**
+ * @brief
+ *      Largest reply service_send can send for the request being run
+ * @return uint16_t
+ *      Bytes of packet data available to a handler for its reply
+ */
+uint16_t service_reply_room(void) {
+  uint16_t room = csp_buffer_data_size();
+  if (service_requests[worker_index()].tagged) {
+    room -= REQUEST_TAG_LEN;
+  }
+  return room;
+}
+
+/**
+ * @brief
+ *      Traffic class of the request being run
+ * @return uint8_t
+ *      service_class. SERVICE_CLASS_INTERACTIVE outside the worker pool
+ */
+uint8_t service_current_class(void) {
+  return service_requests[worker_index()].cls;
+}
+
+/**
+ * @brief
+ *      Refuse a request the handler can't or didn't answer
+ * @details
+ *      Untagged requests are dropped as they always were. Tagged ones are
+ *      answered with status -1 so the ground doesn't wait for the reply, and
+ *      command list steps record -1
+ * @param packet
+ *      The request. Always consumed
+ */
+static void reject_request(csp_conn_t *conn, csp_packet_t *packet) {
+  service_request *request = &service_requests[worker_index()];
+  if (!request->tagged && request->step_status == NULL) {
+    csp_buffer_free(packet);
+    return;
+  }
+  int8_t status = -1;
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(status));
+  set_packet_length(packet, STATUS_BYTE + sizeof(status));
+  if (!service_send(conn, packet, 50)) {
+    csp_buffer_free(packet);
+  }
+}
+
+/**
+ * @brief
+ *      Validate a packet against its service's subservice table and run it
+ * @details
+ *      Unknown subtypes, requests shorter than min_in_len, replies that
+ *      can't fit max_out_len and requests from nodes without the privilege
+ *      are rejected here so handlers don't have to check. SUBSERVICE_BULK
+ *      entries are run as SERVICE_CLASS_BULK. Command list steps are refused
+ *      for SUBSERVICE_BULK and SUBSERVICE_NO_STEP entries
+ * @param table
+ *      The service's subservice table, indexed by subtype
+ * @param table_len
+ *      Number of entries in table. At most MAX_SUBTYPES
+ * @param conn
+ *      The connection the packet arrived on
+ * @param packet
+ *      The request. Always consumed
+ * @return SAT_returnState
+ *      SATR_PKT_ILLEGAL_SUBSERVICE for unknown subtypes, otherwise what the
+ *      handler returned
+ */
+SAT_returnState dispatch_subservice(const subservice_entry *table, uint16_t table_len,
+                                    csp_conn_t *conn, csp_packet_t *packet) {
+  uint8_t ser_subtype = (uint8_t)packet->data[SUBSERVICE_BYTE];
+  const subservice_entry *entry = NULL;
+  if (packet->length > SUBSERVICE_BYTE && ser_subtype < table_len &&
+      table[ser_subtype].handler != NULL) {
+    entry = &table[ser_subtype];
+  }
+
+  if (entry == NULL) {
+    ex2_log("No such subservice\n");
+    reject_request(conn, packet);
+    return SATR_PKT_ILLEGAL_SUBSERVICE;
+  }
+  if (packet->length < IN_DATA_BYTE + entry->min_in_len ||
+      OUT_DATA_BYTE + entry->max_out_len > service_reply_room()) {
+    ex2_log("Bad length for subservice %hu\n", ser_subtype);
+    reject_request(conn, packet);
+    return SATR_ERROR;
+  }
+  if (entry->privilege == PRIV_GROUND && packet->id.src != SERVICE_PRIVILEGED_SRC) {
+    ex2_log("Subservice %hu refused for node %hu\n", ser_subtype, packet->id.src);
+    reject_request(conn, packet);
     return SATR_ERROR;
   }
 
-  if (start_communication_service() != SATR_OK ||
-          start_time_management_service() != SATR_OK ||
-          start_housekeeping_service() != SATR_OK||
-          start_general_service() != SATR_OK) {
+  int worker = worker_index();
+  service_request *request = &service_requests[worker];
+  if ((entry->flags & (SUBSERVICE_BULK | SUBSERVICE_NO_STEP)) && request->step_status != NULL) {
+    ex2_log("Subservice %hu can't be a command list step\n", ser_subtype);
+    reject_request(conn, packet);
     return SATR_ERROR;
   }
+
+  uint8_t port = (request->step_status != NULL) ? request->step_port : csp_conn_dport(conn);
+  uint8_t cls = request->cls;
+  UBaseType_t prio = 0;
+  if (entry->flags & SUBSERVICE_BULK) {
+    request->cls = SERVICE_CLASS_BULK;
+    request->bulk_sent = 0;
+    if (worker < SERVICE_WORKER_COUNT) {
+      prio = uxTaskPriorityGet(NULL);
+      vTaskPrioritySet(NULL, BULK_SERVICE_PRIO);
+    }
+  }
+
+  TickType_t start = xTaskGetTickCount();
+  SAT_returnState state = entry->handler(conn, packet);
+  if (!(entry->flags & SUBSERVICE_SENDS)) {
+    if (state != SATR_OK) {
+      // something went wrong in the service
+      reject_request(conn, packet);
+    } else if (!service_send(conn, packet, 50)) {
+      metrics_record_event(port, ser_subtype, METRIC_SEND_FAILURE);
+      csp_buffer_free(packet);
+    }
+  }
+
+  if (entry->flags & SUBSERVICE_BULK) {
+    request->cls = cls;
+    if (worker < SERVICE_WORKER_COUNT) {
+      vTaskPrioritySet(NULL, prio);
+    }
+  }
+  metrics_record_request(METRICS_SUBSERVICE, port, ser_subtype, state,
+                         xTaskGetTickCount() - start);
+  return state;
+}
+
+/**
+ * @brief
+ *      Run one step of a command list as if it had arrived on its own
+ * @details
+ *      The command is copied to a fresh buffer carrying the CSP id of the
+ *      request it came in, so privileges are checked against the node that
+ *      sent it, and passed to the handler of port. Its replies are not sent,
+ *      only their status is kept. SUBSERVICE_BULK and SUBSERVICE_NO_STEP
+ *      entries are refused
+ * @attention
+ *      Call from a service worker or, like any handler, the one other task
+ *      allowed by service_scratch. The step's handler may use
+ *      service_scratch, so the caller must not keep anything there
+ * @param conn
+ *      The connection the request arrived on. NULL for a command that
+ *      didn't arrive on one, since step replies are never sent
+ * @param id
+ *      CSP id of the request carrying the command
+ * @param port
+ *      Service port the command is for
+ * @param command
+ *      The command laid out from SUBSERVICE_BYTE, untagged
+ * @param len
+ *      Bytes of command
+ * @return int8_t
+ *      Status of the step's reply. -1 if it was rejected, didn't reply or
+ *      couldn't be run
+ */
+int8_t service_run_step(csp_conn_t *conn, csp_id_t id, uint8_t port,
+                        const uint8_t *command, uint16_t len) {
+  service_request *request = &service_requests[worker_index()];
+  if (port >= MAX_SERVICES || service_ports[port].handler == NULL ||
+      !service_ports[port].subservices || request->step_status != NULL ||
+      len <= SUBSERVICE_BYTE || len > csp_buffer_data_size()) {
+    return -1;
+  }
+  csp_packet_t *packet = service_buffer_get(csp_buffer_data_size());
+  if (packet == NULL) {
+    return -1;
+  }
+  packet->id = id;
+  memcpy(packet->data, command, len);
+  packet->length = len;
+
+  int8_t status = -1;
+  service_request saved = *request;
+  request->tagged = false;
+  request->step_status = &status;
+  request->step_replied = false;
+  request->step_port = port;
+  service_ports[port].handler(conn, packet);
+  *request = saved;
+  return status;
+}
+
+/**
+ * @brief
+ *      Pass CSP's own ports (ping and such) to the CSP service handler
+ * @param conn
+ *      The connection the packet arrived on
+ * @param packet
+ *      The packet. Always consumed
+ * @return SAT_returnState
+ *      always SATR_OK
+ */
+static SAT_returnState csp_port_handler(csp_conn_t *conn, csp_packet_t *packet) {
+  csp_service_handler(conn, packet);
   return SATR_OK;
 }
 
 /**
  * @brief
- * 		CSP server loop to services pings, and such
+ * 		Accept connections on every service port
  * @details
- * 		send incoming CSP packets to the appropriate service queues,
- * otherwise pass it to the CSP service handler
+ * 		Accepted connections are queued for the worker pool, ports of
+ * SERVICE_CLASS_CONTROL on their own queue. If every worker is busy and
+ * the queue is full, other connections are closed after
+ * SERVICE_ENQUEUE_TIMEOUT_MS so the dispatcher never stops accepting
+ * commands. Only a full control queue blocks it, and further connections
+ * wait in the CSP backlog
  * @param void *parameters
  * 		not used
  */
-void csp_server(void *parameters) {
+void service_dispatcher(void *parameters) {
   csp_socket_t *sock;
 
-  /* Create socket and listen for incoming connections */
+  /* Create socket and listen for incoming connections. RDP is checked per
+     port by the workers since CSP's ping doesn't use it */
   sock = csp_socket(CSP_SO_NONE);
-//  csp_bind(sock, CSP_CMP);
-  csp_bind(sock, CSP_PING);
-//  csp_bind(sock, CSP_PS);
-//  csp_bind(sock, CSP_MEMFREE);
-//  csp_bind(sock, CSP_REBOOT);
-//  csp_bind(sock, CSP_BUF_FREE);
-//  csp_bind(sock, CSP_UPTIME);
-
+  int port;
+  for (port = 0; port < MAX_SERVICES; port++) {
+    if (service_ports[port].handler != NULL) {
+      csp_bind(sock, port);
+    }
+  }
   csp_listen(sock, SERVICE_BACKLOG_LEN);
 
   for (;;) {
-    /* Process incoming packet */
     csp_conn_t *conn;
-    csp_packet_t *packet;
     if ((conn = csp_accept(sock, CSP_MAX_TIMEOUT)) == NULL) {
       /* timeout */
       continue;
     }
+    port = csp_conn_dport(conn);
+    xQueueHandle queue = service_conn_queue;
+    if (port >= 0 && port < MAX_SERVICES && service_ports[port].cls == SERVICE_CLASS_CONTROL) {
+      queue = service_control_queue;
+    }
+    if (queue == service_control_queue) {
+      xQueueSendToBack(queue, (void *)&conn, portMAX_DELAY);
+    } else if (xQueueSendToBack(queue, (void *)&conn,
+                                pdMS_TO_TICKS(SERVICE_ENQUEUE_TIMEOUT_MS)) != pdPASS) {
+      // every worker is busy, likely with downlinks. refuse rather than
+      // stop accepting, so commands still get through
+      ex2_log("Refused connection to port %d, workers busy\n", port);
+      csp_close(conn);
+    }
+  }
+}
 
+/**
+ * @brief
+ * 		Serve connections handed over by the dispatcher
+ * @details
+ * 		Every packet of a connection is passed to the handler of the
+ * port it was accepted on, then the connection is closed. Tagged packets
+ * are untagged first, see SUBSERVICE_TAGGED
+ * @param void *parameters
+ * 		The queue to serve, service_control_queue or service_conn_queue
+ */
+void service_worker(void *parameters) {
+  xQueueHandle queue = (xQueueHandle)parameters;
+  bool control = (queue == service_control_queue);
+  for (;;) {
+    csp_conn_t *conn;
+    csp_packet_t *packet;
+    if (xQueueReceive(queue, &conn, portMAX_DELAY) != pdPASS) {
+      continue;
+    }
+
+    int port = csp_conn_dport(conn);
+    const service_port *service = NULL;
+    if (port >= 0 && port < MAX_SERVICES && service_ports[port].handler != NULL) {
+      service = &service_ports[port];
+    }
+    if (service == NULL ||
+        (service->rdp_required && !(csp_conn_flags(conn) & CSP_FRDP))) {
+      ex2_log("Rejected connection to port %d\n", port);
+      csp_close(conn);
+      continue;
+    }
+
+    service_request *request = &service_requests[worker_index()];
+    request->cls = service->cls;
+    if (control) {
+      control_active++;
+    }
     while ((packet = csp_read(conn, 50)) != NULL) {
-      csp_service_handler(conn, packet);
+      request->tagged = false;
+      if (service->subservices && packet->length > REQUEST_ID_BYTE &&
+          (packet->data[SUBSERVICE_BYTE] & SUBSERVICE_TAGGED)) {
+        //strip the tag so the handler sees the usual layout
+        request->tagged = true;
+        request->request_id = packet->data[REQUEST_ID_BYTE];
+        packet->data[SUBSERVICE_BYTE] &= ~SUBSERVICE_TAGGED;
+        memmove(&packet->data[REQUEST_ID_BYTE], &packet->data[REQUEST_ID_BYTE + REQUEST_TAG_LEN],
+                packet->length - REQUEST_ID_BYTE - REQUEST_TAG_LEN);
+        packet->length -= REQUEST_TAG_LEN;
+      }
+      TickType_t start = xTaskGetTickCount();
+      SAT_returnState state = service->handler(conn, packet);
+      metrics_record_request(METRICS_SERVICE, port, 0, state, xTaskGetTickCount() - start);
+      if (state != SATR_OK) {
+        ex2_log("Error responding to packet on port %d\n", port);
+      }
     }
-    csp_close(conn);
+    request->tagged = false;
+    if (control) {
+      control_active--;
+    }
+    csp_close(conn); //frees buffers used
   }
-
-  return;
 }
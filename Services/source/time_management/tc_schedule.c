@@ -0,0 +1,435 @@
+/*
+ * Copyright (C) 2021  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file tc_schedule.c
+ * @date 2021-06-30
+ */
+#include "time_management/tc_schedule.h"
+
+#include <FreeRTOS.h>
+#include <os_semphr.h>
+#include <os_task.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "time_management/time_management_service.h"
+#include "util/service_utilities.h"
+#include "util/task_census.h"
+
+/*the file is one tc_schedule_header followed by count entries in heap
+  order. it is rewritten after every change, which at TC_SCHEDULE_LEN
+  entries is a few KB
+*/
+#define TC_SCHEDULE_MAGIC 0x54435343 //"TCSC"
+#define TC_SCHEDULE_VERSION 1
+
+typedef struct __attribute__((packed)) {
+  uint32_t magic;       //TC_SCHEDULE_MAGIC. anything else means the file is not ours
+  uint16_t version;     //TC_SCHEDULE_VERSION. bumped when entry layout changes
+  uint16_t entry_size;  //sizeof(tc_schedule_entry)
+  uint16_t count;       //entries that follow
+  uint16_t next_id;     //id the next command will be given
+} tc_schedule_header;
+
+static FILE *schedule_fp = NULL; //kept open for the life of the service. guarded by schedule_lock
+
+/*min-heap on (execute_at, id). everything below is guarded by schedule_lock*/
+static tc_schedule_entry schedule[TC_SCHEDULE_LEN];
+static uint16_t schedule_count = 0;
+static uint16_t next_id = 1;
+static tc_schedule_status schedule_stats;
+static SemaphoreHandle_t schedule_lock = NULL;
+static TaskHandle_t schedule_task = NULL;
+
+/**
+ * @brief
+ *      Private. Whether a runs before b
+ * @details
+ *      Ties are broken on id, compared as serial numbers so the order they
+ *      were scheduled in holds when ids wrap
+ */
+static bool entry_before(const tc_schedule_entry *a, const tc_schedule_entry *b) {
+  if (a->execute_at != b->execute_at) {
+    return a->execute_at < b->execute_at;
+  }
+  return (int16_t)(a->id - b->id) < 0;
+}
+
+static void swap_entries(uint16_t i, uint16_t j) {
+  tc_schedule_entry tmp = schedule[i];
+  schedule[i] = schedule[j];
+  schedule[j] = tmp;
+}
+
+static void sift_up(uint16_t i) {
+  while (i > 0 && entry_before(&schedule[i], &schedule[(i - 1) / 2])) {
+    swap_entries(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void sift_down(uint16_t i) {
+  for (;;) {
+    uint16_t first = i;
+    uint16_t left = 2 * i + 1;
+    uint16_t right = left + 1;
+    if (left < schedule_count && entry_before(&schedule[left], &schedule[first])) {
+      first = left;
+    }
+    if (right < schedule_count && entry_before(&schedule[right], &schedule[first])) {
+      first = right;
+    }
+    if (first == i) {
+      return;
+    }
+    swap_entries(i, first);
+    i = first;
+  }
+}
+
+static void remove_entry(uint16_t i) {
+  schedule[i] = schedule[--schedule_count];
+  if (i < schedule_count) {
+    sift_up(i);
+    sift_down(i);
+  }
+}
+
+/**
+ * @brief
+ *      Private. Mirror the schedule to its file
+ * @details
+ *      Without a file the schedule is kept in RAM only and lost on reboot
+ * @attention
+ *      Caller must hold schedule_lock
+ */
+static void write_schedule(void) {
+  tc_schedule_header header;
+  if (schedule_fp == NULL) {
+    return;
+  }
+  header.magic = TC_SCHEDULE_MAGIC;
+  header.version = TC_SCHEDULE_VERSION;
+  header.entry_size = sizeof(tc_schedule_entry);
+  header.count = schedule_count;
+  header.next_id = next_id;
+
+  if (fseek(schedule_fp, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, schedule_fp) != 1 ||
+      fwrite(schedule, sizeof(tc_schedule_entry), schedule_count, schedule_fp) != schedule_count) {
+    ex2_log("Failed to write command schedule\n");
+  }
+  fflush(schedule_fp);
+}
+
+/**
+ * @brief
+ *      Private. Load the schedule kept before the last reboot
+ * @details
+ *      An unreadable file is recreated empty. The heap is rebuilt whatever
+ *      order the entries were stored in
+ */
+static void load_schedule(void) {
+  tc_schedule_header header;
+  int i;
+
+  schedule_fp = fopen(TC_SCHEDULE_FILE, "r+b"); //open existing schedule to read and write binary
+  if (schedule_fp != NULL) {
+    if (fread(&header, sizeof(header), 1, schedule_fp) == 1 &&
+        header.magic == TC_SCHEDULE_MAGIC &&
+        header.version == TC_SCHEDULE_VERSION &&
+        header.entry_size == sizeof(tc_schedule_entry) &&
+        header.count <= TC_SCHEDULE_LEN &&
+        fread(schedule, sizeof(tc_schedule_entry), header.count, schedule_fp) == header.count) {
+      schedule_count = header.count;
+      next_id = header.next_id;
+      for (i = schedule_count / 2 - 1; i >= 0; i--) {
+        sift_down(i);
+      }
+      ex2_log("Loaded %hu scheduled commands\n", schedule_count);
+      return;
+    }
+    ex2_log("Command schedule invalid, recreating\n");
+    fclose(schedule_fp);
+  }
+
+  schedule_fp = fopen(TC_SCHEDULE_FILE, "w+b"); //create or truncate schedule file
+  if (schedule_fp == NULL) {
+    ex2_log("Failed to open or create file: '%s'\n", TC_SCHEDULE_FILE);
+  }
+  schedule_count = 0;
+  write_schedule();
+}
+
+/**
+ * @brief
+ *      Private. Run one command that has come due
+ * @details
+ *      The command has already left the schedule, so it is run at most once
+ *      even if this resets the satellite
+ */
+static void run_entry(const tc_schedule_entry *entry, uint32_t now) {
+  if (now - entry->execute_at > TC_SCHEDULE_MAX_LATE_S) {
+    ex2_log("Scheduled command %hu dropped, %u s late\n", entry->id, now - entry->execute_at);
+    xSemaphoreTake(schedule_lock, portMAX_DELAY);
+    schedule_stats.dropped++;
+    xSemaphoreGive(schedule_lock);
+    return;
+  }
+
+  csp_id_t id;
+  memset(&id, 0, sizeof(id));
+  id.src = entry->src;
+  id.dport = entry->port;
+  int8_t status = service_run_step(NULL, id, entry->port, entry->command, entry->len);
+  if (status != 0) {
+    ex2_log("Scheduled command %hu on port %hu returned %d\n", entry->id, entry->port, status);
+  }
+
+  xSemaphoreTake(schedule_lock, portMAX_DELAY);
+  schedule_stats.executed++;
+  if (status != 0) {
+    schedule_stats.failed++;
+  }
+  xSemaphoreGive(schedule_lock);
+}
+
+/**
+ * @brief
+ *      FreeRTOS task running scheduled commands as they come due
+ * @details
+ *      Sleeps until the earliest command is due by get_time_us, so commands
+ *      run at the start of their second rather than up to a second late.
+ *      Wakes early when the schedule changes and at least every
+ *      TC_SCHEDULE_MAX_SLEEP_MS in case the RTC was set meanwhile
+ * @param parameters
+ *      not used
+ */
+static void tc_schedule_service(void *parameters) {
+  for (;;) {
+    tc_schedule_entry due;
+    bool run = false;
+    TickType_t wait = pdMS_TO_TICKS(TC_SCHEDULE_MAX_SLEEP_MS);
+    uint64_t now_us = get_time_us();
+    uint32_t now = (uint32_t)(now_us / 1000000);
+
+    xSemaphoreTake(schedule_lock, portMAX_DELAY);
+    if (schedule_count > 0) {
+      uint64_t due_us = (uint64_t)schedule[0].execute_at * 1000000;
+      if (due_us <= now_us) {
+        due = schedule[0];
+        remove_entry(0);
+        write_schedule();
+        run = true;
+      } else if (due_us - now_us < (uint64_t)TC_SCHEDULE_MAX_SLEEP_MS * 1000) {
+        uint32_t wait_ms = (uint32_t)((due_us - now_us + 999) / 1000);
+        wait = pdMS_TO_TICKS(wait_ms);
+        if (wait == 0) {
+          wait = 1;
+        }
+      }
+    }
+    xSemaphoreGive(schedule_lock);
+
+    if (run) {
+      run_entry(&due, now);
+    } else {
+      ulTaskNotifyTake(pdTRUE, wait);
+    }
+  }
+}
+
+/**
+ * @brief
+ *      Load the schedule and start the task running it
+ * @return SAT_returnState
+ *      success report
+ */
+SAT_returnState start_tc_schedule(void) {
+  if (schedule_lock == NULL) {
+    schedule_lock = xSemaphoreCreateMutex();
+    if (schedule_lock == NULL) {
+      return SATR_ERROR;
+    }
+  }
+  xSemaphoreTake(schedule_lock, portMAX_DELAY);
+  load_schedule();
+  xSemaphoreGive(schedule_lock);
+
+  if (census_task_create((TaskFunction_t)tc_schedule_service, "tc_schedule", TC_SCHEDULE_STACK,
+                         NULL, NORMAL_SERVICE_PRIO, &schedule_task) != pdPASS) {
+    ex2_log("FAILED TO CREATE TASK tc_schedule\n");
+    return SATR_ERROR;
+  }
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Schedule a command
+ * @param execute_at
+ *      Unix time to run it at. Must be in the future
+ * @param src
+ *      Node scheduling it, whose privileges it runs with
+ * @param port
+ *      Service port the command is for
+ * @param command
+ *      The command laid out from its subservice byte
+ * @param len
+ *      Bytes of command. At most TC_SCHEDULE_CMD_LEN
+ * @param id
+ *      Set to the id the command was given
+ * @return SAT_returnState
+ *      SATR_ERROR if the schedule is full or the command is invalid
+ */
+SAT_returnState tc_schedule_add(uint32_t execute_at, uint8_t src, uint8_t port,
+                                const uint8_t *command, uint8_t len, uint16_t *id) {
+  uint32_t now = (uint32_t)(get_time_us() / 1000000);
+  int i;
+  if (len == 0 || len > TC_SCHEDULE_CMD_LEN || port >= MAX_SERVICES || execute_at <= now ||
+      schedule_lock == NULL) {
+    return SATR_ERROR;
+  }
+
+  xSemaphoreTake(schedule_lock, portMAX_DELAY);
+  if (schedule_count >= TC_SCHEDULE_LEN) {
+    xSemaphoreGive(schedule_lock);
+    return SATR_ERROR;
+  }
+  bool taken;
+  do { //skip ids still waiting from before a wrap
+    if (next_id == 0 || next_id == TC_SCHEDULE_ALL) {
+      next_id = 1;
+    }
+    taken = false;
+    for (i = 0; i < schedule_count; i++) {
+      if (schedule[i].id == next_id) {
+        taken = true;
+        next_id++;
+        break;
+      }
+    }
+  } while (taken);
+
+  tc_schedule_entry *entry = &schedule[schedule_count];
+  entry->execute_at = execute_at;
+  entry->id = next_id++;
+  entry->src = src;
+  entry->port = port;
+  entry->len = len;
+  memcpy(entry->command, command, len);
+  *id = entry->id;
+  schedule_count++;
+  sift_up(schedule_count - 1);
+  write_schedule();
+  xSemaphoreGive(schedule_lock);
+
+  if (schedule_task != NULL) {
+    xTaskNotifyGive(schedule_task);
+  }
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Remove a command before it runs
+ * @param id
+ *      Its id, or TC_SCHEDULE_ALL to clear the schedule
+ * @return SAT_returnState
+ *      SATR_ERROR if no command has that id
+ */
+SAT_returnState tc_schedule_delete(uint16_t id) {
+  SAT_returnState state = SATR_ERROR;
+  int i;
+  if (schedule_lock == NULL) {
+    return SATR_ERROR;
+  }
+
+  xSemaphoreTake(schedule_lock, portMAX_DELAY);
+  if (id == TC_SCHEDULE_ALL) {
+    schedule_count = 0;
+    state = SATR_OK;
+  } else {
+    for (i = 0; i < schedule_count; i++) {
+      if (schedule[i].id == id) {
+        remove_entry(i);
+        state = SATR_OK;
+        break;
+      }
+    }
+  }
+  if (state == SATR_OK) {
+    write_schedule();
+  }
+  xSemaphoreGive(schedule_lock);
+  return state;
+}
+
+/**
+ * @brief
+ *      Copy out waiting commands in the order they will run
+ * @details
+ *      Starts after the command at (after_at, after_id), so pass the last
+ *      one returned to get the next page and (0, 0) for the first
+ * @param out
+ *      Room for max entries
+ * @return uint8_t
+ *      Number of entries copied
+ */
+uint8_t tc_schedule_list(uint32_t after_at, uint16_t after_id, tc_schedule_entry *out,
+                         uint8_t max) {
+  tc_schedule_entry cursor;
+  uint8_t n = 0;
+  int i;
+  if (schedule_lock == NULL) {
+    return 0;
+  }
+  cursor.execute_at = after_at;
+  cursor.id = after_id;
+
+  xSemaphoreTake(schedule_lock, portMAX_DELAY);
+  while (n < max) {
+    const tc_schedule_entry *next = NULL;
+    for (i = 0; i < schedule_count; i++) {
+      if (entry_before(&cursor, &schedule[i]) &&
+          (next == NULL || entry_before(&schedule[i], next))) {
+        next = &schedule[i];
+      }
+    }
+    if (next == NULL) {
+      break;
+    }
+    out[n] = *next;
+    cursor = out[n++];
+  }
+  xSemaphoreGive(schedule_lock);
+  return n;
+}
+
+/**
+ * @brief
+ *      Copy out the schedule counters
+ */
+void tc_schedule_get_status(tc_schedule_status *out) {
+  memset(out, 0, sizeof(*out));
+  if (schedule_lock == NULL) {
+    return;
+  }
+  xSemaphoreTake(schedule_lock, portMAX_DELAY);
+  *out = schedule_stats;
+  out->count = schedule_count;
+  out->next_at = (schedule_count > 0) ? schedule[0].execute_at : 0;
+  xSemaphoreGive(schedule_lock);
+}
@@ -23,30 +23,227 @@
 #include <csp/csp.h>
 #include <csp/csp_endian.h>
 #include <main/system.h>
+#include <stdbool.h>
 #include <stdio.h>
+#include "time_management/tc_schedule.h"
 #include "time_management/time_management_service.h"
 #include "util/service_utilities.h"
+#include "util/task_census.h"
 #include "services.h"
 #include "skytraq_gps_driver.h"
 #include "nmea_service.h"
 #include "time_struct.h"
 #include "mocks/rtc.h"
 
-#define GPS_TASK_SIZE 200
+#define GPS_TASK_SIZE 256 // 64 bit clock arithmetic
 #define NMEA_TASK_SIZE 100
 
 #define MIN_YEAR 1577836800  // 2020-01-01
 #define MAX_YEAR 1893456000  // 2030-01-01
 
-#define DISCIPLINE_DELAY 10000 // every 10 seconds for testing purposes
+#define DISCIPLINE_DELAY 10000 // longest wait for a fix notification before polling the GPS
 
-SAT_returnState time_management_app(csp_packet_t *packet);
+#define US_PER_TICK (1000000 / configTICK_RATE_HZ)
+#ifndef GPS_NMEA_DELAY_MS
+#define GPS_NMEA_DELAY_MS 0     // from a fix to its sentence arriving, when there is no PPS
+#endif
+#ifndef GPS_NMEA_MAX_DELAY_MS
+#define GPS_NMEA_MAX_DELAY_MS 300 // longest a sentence takes to be decoded after its PPS edge
+#endif
+#define GPS_POLL_AGE_US 1000000 // a polled fix may be up to a second older than the poll
+#define RESYNC_US 100000        // model error that resets the RTC and the drift measurement
+#define RTC_SET_INTERVAL_S 600  // otherwise the RTC is only realigned this often
+#define DRIFT_SPAN_S 300        // fixes must be this far apart to measure drift
+#define DRIFT_SMOOTHING 4       // drift moves a quarter of the way to each new measurement
+
+static SAT_returnState set_time(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState get_time(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState schedule_add(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState schedule_delete(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState schedule_list(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState schedule_status(csp_conn_t *conn, csp_packet_t *packet);
+static SAT_returnState get_time_us_handler(csp_conn_t *conn, csp_packet_t *packet);
+
+// SCHEDULE_ADD request: execute_at and port ahead of the command
+#define SCHEDULE_ADD_HEADER_LEN (sizeof(uint32_t) + sizeof(uint8_t))
+// SCHEDULE_LIST reply: commands waiting and commands that follow
+#define SCHEDULE_LIST_HEADER_LEN (sizeof(uint16_t) + sizeof(uint8_t))
+#define SCHEDULE_STATUS_LEN (sizeof(uint16_t) + 4 * sizeof(uint32_t))
+// GET_TIME_US reply: time, drift and fix age
+#define TIME_US_LEN (sizeof(uint64_t) + sizeof(int32_t) + sizeof(uint32_t))
+
+/* time management subservices. lengths exclude the subservice and status bytes */
+static const subservice_entry time_management_subservices[] = {
+  [GET_TIME] = {get_time, 0, sizeof(uint32_t), PRIV_ANY, 0},
+  [SET_TIME] = {set_time, sizeof(uint32_t), 0, PRIV_GROUND, 0},
+  [SCHEDULE_ADD] = {schedule_add, SCHEDULE_ADD_HEADER_LEN + 1, sizeof(uint16_t), PRIV_GROUND, 0},
+  [SCHEDULE_DELETE] = {schedule_delete, sizeof(uint16_t), 0, PRIV_GROUND, 0},
+  [SCHEDULE_LIST] = {schedule_list, sizeof(uint32_t) + sizeof(uint16_t),
+                     SCHEDULE_LIST_HEADER_LEN + TC_SCHEDULE_PAGE_LEN * TC_SCHEDULE_WIRE_ENTRY,
+                     PRIV_ANY, 0},
+  [SCHEDULE_STATUS] = {schedule_status, 0, SCHEDULE_STATUS_LEN, PRIV_ANY, 0},
+  [GET_TIME_US] = {get_time_us_handler, 0, TIME_US_LEN, PRIV_ANY, 0},
+};
+
+/*clock model. time at a tick is anchor_us plus the ticks since anchor_tick,
+  less the drift of the tick clock against GPS measured over the last
+  DRIFT_SPAN_S. re-anchored on every fix and whenever the RTC is set. read by
+  any task, so only touched inside a critical section
+*/
+static uint64_t anchor_us = 0;
+static TickType_t anchor_tick = 0;
+static int32_t drift_ppb = 0;       //tick clock fast by this many parts per billion
+static bool drift_known = false;
+static uint64_t drift_ref_us = 0;   //fix the drift is being measured from. 0 for none
+static TickType_t drift_ref_tick = 0;
+static TickType_t last_fix_tick = 0;
+static bool have_fix = false;
+
+/*set by the GPS side, see time_management_gps_fix and time_management_pps_from_isr*/
+static TaskHandle_t rtc_task = NULL;
+static volatile TickType_t fix_rx_tick = 0;
+static volatile TickType_t pps_tick = 0;
+static volatile bool pps_seen = false;
+
+/**
+ * @brief
+ *      Private. Model time at a tick
+ * @attention
+ *      Call inside a critical section. tick must be within 24 days of
+ *      anchor_tick
+ */
+static uint64_t model_us_at(TickType_t tick) {
+  int64_t elapsed = (int64_t)(int32_t)(tick - anchor_tick) * US_PER_TICK;
+  elapsed -= elapsed * drift_ppb / 1000000000;
+  return anchor_us + elapsed;
+}
+
+/**
+ * @brief
+ *      Private. Move the clock model to a known time
+ * @param us
+ *      Unix time in microseconds at tick
+ * @param tick
+ *      Tick count when it was that time
+ */
+static void set_anchor(uint64_t us, TickType_t tick) {
+  taskENTER_CRITICAL();
+  anchor_us = us;
+  anchor_tick = tick;
+  taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief
+ *      Private. Unix seconds of a UTC date and time
+ * @details
+ *      year of the date is years since 2000, as in NMEA
+ */
+static uint32_t utc_to_unix(const date_t *date, const ex2_time_t *utc_time) {
+  //days from civil, with years starting in March so the leap day comes last
+  uint32_t year = 2000 + date->year - (date->month <= 2);
+  uint32_t month = date->month;
+  uint32_t era = year / 400;
+  uint32_t year_of_era = year - era * 400;
+  uint32_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + date->day - 1;
+  uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  uint32_t days = era * 146097 + day_of_era - 719468; //719468 is 1970-01-01
+  return days * 86400 + utc_time->hour * 3600 + utc_time->minute * 60 + utc_time->second;
+}
+
+/**
+ * @brief
+ *      Private. Set the RTC so its seconds start on the model's
+ * @details
+ *      The RTC only takes whole seconds, so this waits for the next second
+ *      boundary of the model and sets it then, a tick late at most
+ */
+static void set_rtc_aligned(void) {
+  taskENTER_CRITICAL();
+  TickType_t now = xTaskGetTickCount();
+  uint64_t now_us = model_us_at(now);
+  taskEXIT_CRITICAL();
+
+  uint32_t second = (uint32_t)(now_us / 1000000) + 1;
+  uint32_t wait_us = (uint32_t)((uint64_t)second * 1000000 - now_us);
+  vTaskDelay((wait_us + US_PER_TICK - 1) / US_PER_TICK);
+  mock_RTC_set_unix_time(second);
+}
+
+/**
+ * @brief
+ *      Private. Bring the clock model and the RTC to a GPS fix
+ * @details
+ *      The model is checked against the fix first. Once fixes span
+ *      DRIFT_SPAN_S the tick clock's drift is updated from how far the
+ *      ticks ran from GPS. A model more than RESYNC_US out, the first fix
+ *      and every RTC_SET_INTERVAL_S also set the RTC.
+ *      A coarse fix is one polled without knowing when it was received, so
+ *      it may be up to GPS_POLL_AGE_US older than epoch_tick. It only checks
+ *      the model against that wider bound, resetting it when outside, and
+ *      never measures drift
+ * @param fix_us
+ *      Unix time of the fix in microseconds
+ * @param epoch_tick
+ *      Tick count at the fix
+ * @param coarse
+ *      true if the fix was polled rather than referred to its reception
+ */
+static void discipline_to_fix(uint64_t fix_us, TickType_t epoch_tick, bool coarse) {
+  static uint32_t last_rtc_set = 0;
+  bool resync;
+
+  taskENTER_CRITICAL();
+  int64_t error_us = (int64_t)(model_us_at(epoch_tick) - fix_us);
+  int64_t bound_us = coarse ? RESYNC_US + GPS_POLL_AGE_US : RESYNC_US;
+  resync = !have_fix || error_us > bound_us || error_us < -bound_us;
+  if (coarse && !resync) {
+    //the model still agrees with GPS and is more precise than the fix
+  } else {
+    if (coarse) {
+      drift_ref_us = 0; //nothing to measure drift from until a precise fix
+    } else if (resync || drift_ref_us == 0) {
+      drift_ref_us = fix_us;
+      drift_ref_tick = epoch_tick;
+    } else if (fix_us - drift_ref_us >= (uint64_t)DRIFT_SPAN_S * 1000000) {
+      int64_t true_us = (int64_t)(fix_us - drift_ref_us);
+      int64_t tick_us = (int64_t)(epoch_tick - drift_ref_tick) * US_PER_TICK;
+      int32_t sample = (int32_t)((tick_us - true_us) * 1000000000 / true_us);
+      drift_ppb = drift_known ? drift_ppb + (sample - drift_ppb) / DRIFT_SMOOTHING : sample;
+      drift_known = true;
+      drift_ref_us = fix_us;
+      drift_ref_tick = epoch_tick;
+    }
+    anchor_us = fix_us;
+    anchor_tick = epoch_tick;
+    have_fix = true;
+  }
+  last_fix_tick = epoch_tick;
+  taskEXIT_CRITICAL();
+
+  uint32_t seconds = (uint32_t)(fix_us / 1000000);
+  if (resync || seconds - last_rtc_set >= RTC_SET_INTERVAL_S) {
+    if (resync) {
+      ex2_log("RTC resynced to GPS, model was %d us out\n", (int)error_us);
+    }
+    set_rtc_aligned();
+    last_rtc_set = seconds;
+  }
+}
 
 /**
  * @brief
  *      FreeRTOS service for disciplining RTC
  * @details
- *      Disicplines rtc by asking the gps subsystem for the time and writing that time to the rtc
+ *      Disciplines the RTC to GPS time. Each time NMEA_service decodes a
+ *      time it wakes this task through time_management_gps_fix. The fix is
+ *      referred to the PPS edge before it when one was captured, otherwise
+ *      to when the sentence arrived less GPS_NMEA_DELAY_MS, so how long
+ *      this task took to run doesn't matter. Without notifications it polls
+ *      the GPS every DISCIPLINE_DELAY. A polled fix is referred to the last
+ *      PPS edge if that came long enough ago for its sentence to have been
+ *      decoded, and within a second. Otherwise it is a coarse fix, which
+ *      keeps the RTC set from GPS to within about a second
  * @param none
  * @return none. use FreeRTOS task features to poll
  */
@@ -56,23 +253,113 @@ void RTC_discipline_service(void) {
 
     if (!gps_skytraq_driver_init()) {
         ex2_log("failed to init skytraq\r\n");
-        vTaskDelete(NULL);
+        census_task_delete_self();
     }
 
     ex2_time_t utc_time;
     date_t utc_date;
 
     for (;;) {
-        vTaskDelay(DISCIPLINE_DELAY);
-        if(!(gps_get_utc_time(&utc_time))){
+        bool notified = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(DISCIPLINE_DELAY)) > 0;
+        TickType_t now = xTaskGetTickCount();
+        TickType_t rx_tick, pps;
+        bool pps_valid;
+        taskENTER_CRITICAL();
+        rx_tick = notified ? fix_rx_tick : now;
+        pps = pps_tick;
+        pps_valid = pps_seen;
+        taskEXIT_CRITICAL();
+        // a polled fix only describes an edge whose sentence has had time to arrive
+        TickType_t pps_age = rx_tick - pps;
+        pps_valid = pps_valid && pps_age < pdMS_TO_TICKS(1000) &&
+                    (notified || pps_age > pdMS_TO_TICKS(GPS_NMEA_MAX_DELAY_MS));
+
+        if (!gps_get_utc_time(&utc_time) || !gps_get_date(&utc_date)) {
             ex2_log("Couldn't get gps time");
-            continue; // delay wait until gps signal acquired
+            continue; // wait until gps signal acquired
         }
-        mock_RTC_set_time(utc_time);
-        mock_RTC_set_date(utc_date);
+        uint32_t seconds = utc_to_unix(&utc_date, &utc_time);
+        if (utc_time.ms >= 1000 || !TIMESTAMP_ISOK(seconds)) {
+            continue;
+        }
+
+        // the newest fix describes the last PPS edge if that came within a second
+        TickType_t epoch_tick = pps_valid ? pps : rx_tick - pdMS_TO_TICKS(GPS_NMEA_DELAY_MS);
+        discipline_to_fix((uint64_t)seconds * 1000000 + (uint64_t)utc_time.ms * 1000, epoch_tick,
+                          !notified && !pps_valid);
     }
 }
 
+/**
+ * @brief
+ *      Tell the RTC discipline a new GPS time was decoded
+ * @attention
+ *      Called by NMEA_service from task context right after it decodes a
+ *      sentence carrying the time, so the arrival tick is close
+ */
+void time_management_gps_fix(void) {
+  taskENTER_CRITICAL();
+  fix_rx_tick = xTaskGetTickCount();
+  taskEXIT_CRITICAL();
+  if (rtc_task != NULL) {
+    xTaskNotifyGive(rtc_task);
+  }
+}
+
+/**
+ * @brief
+ *      Capture a GPS PPS edge
+ * @attention
+ *      Only call from the interrupt of the PPS line
+ */
+void time_management_pps_from_isr(void) {
+  pps_tick = xTaskGetTickCountFromISR();
+  pps_seen = true;
+}
+
+/**
+ * @brief
+ *      Microseconds since the unix epoch
+ * @details
+ *      Seconds come from the RTC, the time within the second from the tick
+ *      count since the model was last anchored, corrected for drift. The
+ *      result is kept inside the RTC's current second, so it agrees with
+ *      the RTC even when the model is stale. Resolution is one tick
+ * @return uint64_t
+ *      Current time
+ */
+uint64_t get_time_us(void) {
+  uint32_t rtc_s;
+  mock_RTC_get_unix_time(&rtc_s);
+  taskENTER_CRITICAL();
+  uint64_t now_us = model_us_at(xTaskGetTickCount());
+  taskEXIT_CRITICAL();
+
+  uint64_t second_us = (uint64_t)rtc_s * 1000000;
+  if (now_us < second_us) {
+    return second_us;
+  }
+  if (now_us >= second_us + 1000000) {
+    return second_us + 999999;
+  }
+  return now_us;
+}
+
+/**
+ * @brief
+ *      State of the RTC discipline
+ * @param fix_age
+ *      Set to the seconds since the last GPS fix, UINT32_MAX if none yet
+ * @param drift
+ *      Set to the drift of the tick clock against GPS in parts per billion
+ */
+void time_management_clock_state(uint32_t *fix_age, int32_t *drift) {
+  taskENTER_CRITICAL();
+  *fix_age = have_fix ? (xTaskGetTickCount() - last_fix_tick) / configTICK_RATE_HZ : UINT32_MAX;
+  *drift = drift_ppb;
+  taskEXIT_CRITICAL();
+}
+
 /**
  * @brief
  *      Start the gps service tasks
@@ -84,11 +371,11 @@ void RTC_discipline_service(void) {
  *      success report
  */
 SAT_returnState start_gps_services(TaskHandle_t *rtc_handle, TaskHandle_t *nmea_handle) {
-    if (xTaskCreate((TaskFunction_t)RTC_discipline_service, "RTC_service", GPS_TASK_SIZE, NULL, 3, rtc_handle) != pdPASS) {
+    if (census_task_create((TaskFunction_t)RTC_discipline_service, "RTC_service", GPS_TASK_SIZE, NULL, 3, rtc_handle) != pdPASS) {
         return SATR_ERROR;
     }
 
-    if (xTaskCreate((TaskFunction_t)NMEA_service, "NMEA_service", NMEA_TASK_SIZE, NULL, 4, nmea_handle) != pdPASS) {
+    if (census_task_create((TaskFunction_t)NMEA_service, "NMEA_service", NMEA_TASK_SIZE, NULL, 4, nmea_handle) != pdPASS) {
         return SATR_ERROR;
     }
 
@@ -97,58 +384,39 @@ SAT_returnState start_gps_services(TaskHandle_t *rtc_handle, TaskHandle_t *nmea_
 
 /**
  * @brief
- *      FreeRTOS time management server task
+ *      Handle one time management packet
  * @details
- *      Accepts incoming time management service packets and executes the application
- * @param void* param
- * @return None
- */
-void time_management_service(void * param) {
-    csp_socket_t *sock;
-    sock = csp_socket(CSP_SO_RDPREQ); // require RDP connection
-    csp_bind(sock, TC_TIME_MANAGEMENT_SERVICE);
-    csp_listen(sock, SERVICE_BACKLOG_LEN);
-
-    for(;;) {
-        csp_conn_t *conn;
-        csp_packet_t *packet;
-        if ((conn = csp_accept(sock, CSP_MAX_TIMEOUT)) == NULL) {
-          /* timeout */
-          continue;
-        }
-        while ((packet = csp_read(conn, 50)) != NULL) {
-          if (time_management_app(packet) != SATR_OK) {
-            // something went wrong, this shouldn't happen
-            csp_buffer_free(packet);
-          } else {
-              if (!csp_send(conn, packet, 50)) {
-                  csp_buffer_free(packet);
-              }
-          }
-        }
-        csp_close(conn);
-    }
+ *      Called by a service worker for every packet read on a
+ *      TC_TIME_MANAGEMENT_SERVICE connection, see time_management_subservices
+ * @param conn
+ *      The connection the packet arrived on
+ * @param packet
+ *      The CSP packet. Always consumed
+ * @return SAT_returnState
+ *      success report
+ */
+SAT_returnState time_management_handler(csp_conn_t *conn, csp_packet_t *packet) {
+  return dispatch_subservice(time_management_subservices,
+                             TABLE_LEN(time_management_subservices), conn, packet);
 }
 
 /**
  * @brief
- *      Start the time management server task
+ *      Start the time management background tasks
  * @details
- *      Starts the FreeRTOS task responsible for accepting incoming
- *      time management packets
+ *      Starts the GPS and RTC discipline tasks and the command schedule.
+ *      Requests are served by the service workers through
+ *      time_management_handler
  * @param None
  * @return SAT_returnState
  *      success report
  */
 SAT_returnState start_time_management_service(void) {
-  if (xTaskCreate((TaskFunction_t)time_management_service,
-                  "time_management_service", 300, NULL, NORMAL_SERVICE_PRIO,
-                  NULL) != pdPASS) {
-    ex2_log("FAILED TO CREATE TASK time_management_service\n");
-    return SATR_ERROR;
-  }
   TaskHandle_t _;
-  if (start_gps_services(&_, &_) != SATR_OK) {
+  uint32_t now;
+  mock_RTC_get_unix_time(&now); //until the first fix the RTC is all there is
+  set_anchor((uint64_t)now * 1000000, xTaskGetTickCount());
+  if (start_gps_services(&rtc_task, &_) != SATR_OK || start_tc_schedule() != SATR_OK) {
       return SATR_ERROR;
   }
 
@@ -157,58 +425,226 @@ SAT_returnState start_time_management_service(void) {
 
 /**
  * @brief
- * 		Handle incoming csp_packet_t
- * @details
- * 		Takes a csp packet destined for the time_management service,
- *              and will handle the packet based on it's subservice type.
+ * 		Set the RTC to the unix time in the packet
  * @param csp_packet_t *packet
- *              Incoming CSP packet - we can be sure that this packet is
- *              valid and destined for this service.
+ *              Incoming CSP packet, reused for the reply
  * @return SAT_returnState
  * 		success report
  */
-SAT_returnState time_management_app(csp_packet_t *packet) {
-  uint8_t ser_subtype = (uint8_t)packet->data[SUBSERVICE_BYTE];
+static SAT_returnState set_time(csp_conn_t *conn, csp_packet_t *packet) {
   int8_t status;
   uint32_t temp_time;
+  cnv8_32(&packet->data[IN_DATA_BYTE], &temp_time);
+  temp_time = csp_ntoh32(temp_time);
 
-  switch (ser_subtype) {
-    case SET_TIME:
-      cnv8_32(&packet->data[IN_DATA_BYTE], &temp_time);
-      temp_time = csp_ntoh32(temp_time);
-
-      if (!TIMESTAMP_ISOK(temp_time)) {
-        status = -1;
-        memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      } else {
-        mock_RTC_set_unix_time(temp_time);
-        status = 0;
-        memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
-      }
-
-      set_packet_length(packet, sizeof(int8_t) + 1);  // +1 for subservice
-
-      break;
-
-    case GET_TIME:
-      // Step 1: get the data
-      mock_RTC_get_unix_time(&temp_time);
-      // Step 2: convert to network order
-      temp_time = csp_hton32(temp_time);
-      // step3: copy data & status byte into packet
-      status = 0;
-      memcpy(&packet->data[STATUS_BYTE], &status,
-             sizeof(int8_t));  // 0 for success
-      memcpy(&packet->data[OUT_DATA_BYTE], &temp_time,
-             sizeof(uint32_t));
-      // Step 4: set packet length
-      set_packet_length(packet, sizeof(int8_t) + sizeof(uint32_t) +
-                                    1);  // plus one for sub-service
-      break;
-
-    default:
-      ex2_log("No such subservice\n");
-      return SATR_PKT_ILLEGAL_SUBSERVICE;
+  if (!TIMESTAMP_ISOK(temp_time)) {
+    status = -1;
+    memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  } else {
+    mock_RTC_set_unix_time(temp_time);
+    set_anchor((uint64_t)temp_time * 1000000, xTaskGetTickCount());
+    status = 0;
+    memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
   }
+
+  set_packet_length(packet, sizeof(int8_t) + 1);  // +1 for subservice
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ * 		Reply with the unix time of the RTC
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet, reused for the reply
+ * @return SAT_returnState
+ * 		success report
+ */
+static SAT_returnState get_time(csp_conn_t *conn, csp_packet_t *packet) {
+  int8_t status;
+  uint32_t temp_time;
+  // Step 1: get the data
+  mock_RTC_get_unix_time(&temp_time);
+  // Step 2: convert to network order
+  temp_time = csp_hton32(temp_time);
+  // step3: copy data & status byte into packet
+  status = 0;
+  memcpy(&packet->data[STATUS_BYTE], &status,
+         sizeof(int8_t));  // 0 for success
+  memcpy(&packet->data[OUT_DATA_BYTE], &temp_time,
+         sizeof(uint32_t));
+  // Step 4: set packet length
+  set_packet_length(packet, sizeof(int8_t) + sizeof(uint32_t) +
+                                1);  // plus one for sub-service
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Schedule a command to run at a given time
+ * @details
+ *      Request data is the unix time to run it at (uint32_t), the service
+ *      port it is for, then the command laid out from its subservice byte as
+ *      it would be sent on its own, at most TC_SCHEDULE_CMD_LEN bytes. It
+ *      runs with the privileges of the node scheduling it. The reply is the
+ *      id the command was given (uint16_t). Status is -1 if the schedule is
+ *      full, the command too long or the time not in the future
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet, reused for the reply
+ * @return SAT_returnState
+ *      success report
+ */
+static SAT_returnState schedule_add(csp_conn_t *conn, csp_packet_t *packet) {
+  uint32_t execute_at;
+  uint8_t port = packet->data[IN_DATA_BYTE + sizeof(uint32_t)];
+  uint16_t len = packet->length - IN_DATA_BYTE - SCHEDULE_ADD_HEADER_LEN;
+  uint16_t id = 0;
+  int8_t status = 0;
+
+  cnv8_32(&packet->data[IN_DATA_BYTE], &execute_at);
+  execute_at = csp_ntoh32(execute_at);
+  if (len > TC_SCHEDULE_CMD_LEN ||
+      tc_schedule_add(execute_at, packet->id.src, port,
+                      &packet->data[IN_DATA_BYTE + SCHEDULE_ADD_HEADER_LEN], (uint8_t)len,
+                      &id) != SATR_OK) {
+    status = -1;
+  }
+
+  id = csp_hton16(id);
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  memcpy(&packet->data[OUT_DATA_BYTE], &id, sizeof(uint16_t));
+  set_packet_length(packet, sizeof(int8_t) + sizeof(uint16_t) + 1);  // +1 for subservice
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Remove a scheduled command
+ * @details
+ *      Request data is the command's id (uint16_t), TC_SCHEDULE_ALL to
+ *      remove every command. Status is -1 if no command has that id
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet, reused for the reply
+ * @return SAT_returnState
+ *      success report
+ */
+static SAT_returnState schedule_delete(csp_conn_t *conn, csp_packet_t *packet) {
+  uint16_t id;
+  int8_t status = 0;
+
+  memcpy(&id, &packet->data[IN_DATA_BYTE], sizeof(uint16_t));
+  if (tc_schedule_delete(csp_ntoh16(id)) != SATR_OK) {
+    status = -1;
+  }
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + 1);  // +1 for subservice
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Reply with a page of the scheduled commands in the order they run
+ * @details
+ *      Request data is the execute time (uint32_t) and id (uint16_t) of the
+ *      last command of the previous page, 0 and 0 for the first page. The
+ *      reply is the number of commands waiting (uint16_t) and the number
+ *      that follow (uint8_t), at most TC_SCHEDULE_PAGE_LEN. Each is its id
+ *      (uint16_t), execute time (uint32_t), port and subtype. All network
+ *      order
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet, reused for the reply
+ * @return SAT_returnState
+ *      success report
+ */
+static SAT_returnState schedule_list(csp_conn_t *conn, csp_packet_t *packet) {
+  tc_schedule_entry *page = service_scratch();
+  tc_schedule_status stats;
+  uint8_t *out = &packet->data[OUT_DATA_BYTE];
+  uint32_t after_at;
+  uint16_t after_id;
+  int8_t status = 0;
+  int i;
+
+  cnv8_32(&packet->data[IN_DATA_BYTE], &after_at);
+  memcpy(&after_id, &packet->data[IN_DATA_BYTE + sizeof(uint32_t)], sizeof(uint16_t));
+  uint8_t count = tc_schedule_list(csp_ntoh32(after_at), csp_ntoh16(after_id), page,
+                                   TC_SCHEDULE_PAGE_LEN);
+  tc_schedule_get_status(&stats);
+
+  uint16_t waiting = csp_hton16(stats.count);
+  memcpy(out, &waiting, sizeof(uint16_t));
+  out[sizeof(uint16_t)] = count;
+  out += SCHEDULE_LIST_HEADER_LEN;
+  for (i = 0; i < count; i++) {
+    uint16_t id = csp_hton16(page[i].id);
+    uint32_t execute_at = csp_hton32(page[i].execute_at);
+    memcpy(out, &id, sizeof(uint16_t));
+    memcpy(out + sizeof(uint16_t), &execute_at, sizeof(uint32_t));
+    out[sizeof(uint16_t) + sizeof(uint32_t)] = page[i].port;
+    out[sizeof(uint16_t) + sizeof(uint32_t) + 1] = page[i].command[SUBSERVICE_BYTE];
+    out += TC_SCHEDULE_WIRE_ENTRY;
+  }
+
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + SCHEDULE_LIST_HEADER_LEN +
+                                count * TC_SCHEDULE_WIRE_ENTRY + 1);  // +1 for subservice
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Reply with the state of the command schedule
+ * @details
+ *      The reply is the number of commands waiting (uint16_t), when the
+ *      next is due, then the commands run, failed and dropped for being too
+ *      late since boot (uint32_t). All network order
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet, reused for the reply
+ * @return SAT_returnState
+ *      success report
+ */
+static SAT_returnState schedule_status(csp_conn_t *conn, csp_packet_t *packet) {
+  tc_schedule_status stats;
+  uint8_t *out = &packet->data[OUT_DATA_BYTE];
+  int8_t status = 0;
+
+  tc_schedule_get_status(&stats);
+  uint16_t count = csp_hton16(stats.count);
+  uint32_t words[4] = {csp_hton32(stats.next_at), csp_hton32(stats.executed),
+                       csp_hton32(stats.failed), csp_hton32(stats.dropped)};
+  memcpy(out, &count, sizeof(uint16_t));
+  memcpy(out + sizeof(uint16_t), words, sizeof(words));
+
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + SCHEDULE_STATUS_LEN + 1);  // +1 for subservice
+  return SATR_OK;
+}
+
+/**
+ * @brief
+ *      Reply with the time to the microsecond and how well it is kept
+ * @details
+ *      The reply is get_time_us (uint64_t), the drift of the tick clock
+ *      against GPS in parts per billion (int32_t) and the seconds since the
+ *      last GPS fix (uint32_t, UINT32_MAX if none since boot). All network
+ *      order
+ * @param csp_packet_t *packet
+ *              Incoming CSP packet, reused for the reply
+ * @return SAT_returnState
+ *      success report
+ */
+static SAT_returnState get_time_us_handler(csp_conn_t *conn, csp_packet_t *packet) {
+  uint8_t *out = &packet->data[OUT_DATA_BYTE];
+  int8_t status = 0;
+  uint32_t fix_age;
+  int32_t drift;
+
+  uint64_t now_us = csp_hton64(get_time_us());
+  time_management_clock_state(&fix_age, &drift);
+  uint32_t words[2] = {csp_hton32((uint32_t)drift), csp_hton32(fix_age)};
+  memcpy(out, &now_us, sizeof(uint64_t));
+  memcpy(out + sizeof(uint64_t), words, sizeof(words));
+
+  memcpy(&packet->data[STATUS_BYTE], &status, sizeof(int8_t));
+  set_packet_length(packet, sizeof(int8_t) + TIME_US_LEN + 1);  // +1 for subservice
   return SATR_OK;
 }
@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file log_ring.c
+ * @date 2020-10-14
+ */
+#include "util/log_ring.h"
+
+#include <FreeRTOS.h>
+#include <os_task.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "printf.h"
+#include "util/task_census.h"
+
+#define SYNC_LOG_LEN 64  // line length when logging before the drain task runs
+#define SPEC_LEN 16      // longest conversion specification that is deferred
+
+typedef struct {
+  const char *format;  // must stay valid, so only string literals
+  TickType_t tick;
+  uint8_t level;
+  uint8_t nargs;  // arguments stored in payload, the rest of format is printed as is
+  volatile uint8_t ready;  // set by the writer once the record is complete
+  uint8_t payload[EX2_LOG_PAYLOAD];
+} log_record;
+
+typedef enum {
+  ARG_NONE,  // %% or nothing to store
+  ARG_INT,
+  ARG_UINT,
+  ARG_LONG,
+  ARG_ULONG,
+  ARG_LLONG,
+  ARG_ULLONG,
+  ARG_SIZE,
+  ARG_PTR,
+  ARG_DOUBLE,
+  ARG_STR,
+  ARG_BAD  // not understood, printed as is with nothing stored
+} arg_kind;
+
+static log_record log_ring[EX2_LOG_RING_LEN];
+static volatile uint16_t log_head;  // next slot to claim, only changed in a critical section
+static uint16_t log_tail;  // next slot to print, only changed by the drain task
+
+static volatile uint8_t log_threshold = EX2_LOG_INFO;
+static volatile uint32_t log_dropped;
+static uint16_t log_tokens = EX2_LOG_BURST;
+static TickType_t log_refill_tick;
+static volatile bool log_drain_running = false;
+
+/**
+ * @brief
+ *      Measure the conversion specification at format
+ * @param format
+ *      Points at the '%'
+ * @param kind
+ *      What argument the conversion takes
+ * @return uint8_t
+ *      Length of the specification including the '%'
+ */
+static uint8_t parse_spec(const char *format, arg_kind *kind) {
+  const char *f = format + 1;
+  uint8_t longs = 0;
+  bool size = false;
+
+  while (*f == '-' || *f == '+' || *f == ' ' || *f == '#' || *f == '0') f++;
+  while (*f >= '0' && *f <= '9') f++;
+  if (*f == '.') {
+    f++;
+    while (*f >= '0' && *f <= '9') f++;
+  }
+  for (;; f++) {
+    if (*f == 'l') {
+      longs++;
+    } else if (*f == 'z' || *f == 't' || *f == 'j') {
+      size = (*f != 'j');
+      longs = (*f == 'j') ? 2 : longs;
+    } else if (*f != 'h') {
+      break;
+    }
+  }
+
+  switch (*f) {
+  case '%':
+    *kind = ARG_NONE;
+    break;
+  case 'd':
+  case 'i':
+  case 'c':
+    *kind = size ? ARG_SIZE : longs >= 2 ? ARG_LLONG : longs ? ARG_LONG : ARG_INT;
+    break;
+  case 'u':
+  case 'x':
+  case 'X':
+  case 'o':
+    *kind = size ? ARG_SIZE : longs >= 2 ? ARG_ULLONG : longs ? ARG_ULONG : ARG_UINT;
+    break;
+  case 'p':
+    *kind = ARG_PTR;
+    break;
+  case 's':
+    *kind = ARG_STR;
+    break;
+  case 'f':
+  case 'F':
+  case 'e':
+  case 'E':
+  case 'g':
+  case 'G':
+    *kind = ARG_DOUBLE;
+    break;
+  default:
+    // '*' widths and anything unknown
+    *kind = ARG_BAD;
+    return (uint8_t)(f - format);
+  }
+  return (uint8_t)(f - format + 1);
+}
+
+/**
+ * @brief
+ *      Copy the arguments of format into a record
+ * @details
+ *      Integers, pointers and doubles are stored as 8 bytes each, strings
+ *      are copied and cut short to fit. Stops at the first argument that
+ *      doesn't fit
+ */
+static void store_args(log_record *record, va_list args) {
+  const char *f = record->format;
+  uint8_t used = 0;
+  record->nargs = 0;
+
+  while ((f = strchr(f, '%')) != NULL) {
+    arg_kind kind;
+    uint8_t len = parse_spec(f, &kind);
+    f += len;
+    if (kind == ARG_NONE) {
+      continue;
+    }
+    if (kind == ARG_BAD || len >= SPEC_LEN) {
+      return;
+    }
+
+    uint64_t value = 0;
+    double real;
+    switch (kind) {
+    case ARG_INT: value = (uint64_t)(int64_t)va_arg(args, int); break;
+    case ARG_UINT: value = va_arg(args, unsigned int); break;
+    case ARG_LONG: value = (uint64_t)(int64_t)va_arg(args, long); break;
+    case ARG_ULONG: value = va_arg(args, unsigned long); break;
+    case ARG_LLONG: value = (uint64_t)va_arg(args, long long); break;
+    case ARG_ULLONG: value = va_arg(args, unsigned long long); break;
+    case ARG_SIZE: value = va_arg(args, size_t); break;
+    case ARG_PTR: value = (uintptr_t)va_arg(args, void *); break;
+    case ARG_DOUBLE:
+      real = va_arg(args, double);
+      memcpy(&value, &real, sizeof(value));
+      break;
+    case ARG_STR: {
+      const char *str = va_arg(args, const char *);
+      if (str == NULL) {
+        str = "(null)";
+      }
+      if (used >= EX2_LOG_PAYLOAD) {
+        return;
+      }
+      uint8_t room = EX2_LOG_PAYLOAD - used - 1;
+      size_t str_len = strlen(str);
+      uint8_t copied = str_len < room ? (uint8_t)str_len : room;
+      memcpy(&record->payload[used], str, copied);
+      record->payload[used + copied] = '\0';
+      used += copied + 1;
+      record->nargs++;
+      continue;
+    }
+    default:
+      return;
+    }
+    if (used + sizeof(value) > EX2_LOG_PAYLOAD) {
+      return;
+    }
+    memcpy(&record->payload[used], &value, sizeof(value));
+    used += sizeof(value);
+    record->nargs++;
+  }
+}
+
+/**
+ * @brief
+ *      Claim a slot, subject to the rate limit
+ * @return log_record *
+ *      The slot, NULL if the ring is full or the rate is exceeded
+ */
+static log_record *claim_record(void) {
+  log_record *record = NULL;
+  TickType_t now = xTaskGetTickCount();
+  taskENTER_CRITICAL();
+  TickType_t elapsed = now - log_refill_tick;
+  if (elapsed >= pdMS_TO_TICKS(1000 / EX2_LOG_RATE_PER_S)) {
+    uint32_t refill = elapsed / pdMS_TO_TICKS(1000 / EX2_LOG_RATE_PER_S);
+    log_tokens = (log_tokens + refill >= EX2_LOG_BURST) ? EX2_LOG_BURST : log_tokens + refill;
+    log_refill_tick = now;
+  }
+  if (log_tokens > 0 && (uint16_t)(log_head - log_tail) < EX2_LOG_RING_LEN) {
+    log_tokens--;
+    record = &log_ring[log_head & (EX2_LOG_RING_LEN - 1)];
+    record->ready = 0;
+    log_head++;
+  } else {
+    log_dropped++;
+  }
+  taskEXIT_CRITICAL();
+  return record;
+}
+
+/**
+ * @brief
+ *      Queue a log line
+ * @details
+ *      Records below the level set by ex2_log_set_level are ignored. Before
+ *      the drain task is started lines are printed straight away
+ * @param level
+ *      Importance of the line
+ * @param format
+ *      printf format. Must be a string literal, only its address is kept
+ * @param args
+ *      Its arguments
+ */
+void ex2_log_record(ex2_log_level level, const char *format, va_list args) {
+  if (level < log_threshold) {
+    return;
+  }
+  if (!log_drain_running) {
+    char buffer[SYNC_LOG_LEN] = {0};
+    vsnprintf(buffer, SYNC_LOG_LEN, format, args);
+    printf("%s\r\n", buffer);
+    return;
+  }
+
+  log_record *record = claim_record();
+  if (record == NULL) {
+    return;
+  }
+  record->format = format;
+  record->tick = xTaskGetTickCount();
+  record->level = level;
+  store_args(record, args);
+  __sync_synchronize();
+  record->ready = 1;
+}
+
+/**
+ * @brief
+ *      Log a line at a level, see ex2_log_record
+ */
+void ex2_log_at(ex2_log_level level, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  ex2_log_record(level, format, args);
+  va_end(args);
+}
+
+/**
+ * @brief
+ *      Ignore log lines less important than level
+ */
+void ex2_log_set_level(ex2_log_level level) {
+  log_threshold = level;
+}
+
+/**
+ * @brief
+ *      Print one argument with its conversion specification
+ * @return uint8_t
+ *      Bytes of payload used
+ */
+static uint8_t print_arg(const char *spec, arg_kind kind, const uint8_t *payload) {
+  uint64_t value;
+  double real;
+  if (kind == ARG_STR) {
+    printf(spec, (const char *)payload);
+    return strlen((const char *)payload) + 1;
+  }
+  memcpy(&value, payload, sizeof(value));
+  switch (kind) {
+  case ARG_INT: printf(spec, (int)value); break;
+  case ARG_UINT: printf(spec, (unsigned int)value); break;
+  case ARG_LONG: printf(spec, (long)value); break;
+  case ARG_ULONG: printf(spec, (unsigned long)value); break;
+  case ARG_LLONG: printf(spec, (long long)value); break;
+  case ARG_ULLONG: printf(spec, (unsigned long long)value); break;
+  case ARG_SIZE: printf(spec, (size_t)value); break;
+  case ARG_PTR: printf(spec, (void *)(uintptr_t)value); break;
+  case ARG_DOUBLE:
+    memcpy(&real, &value, sizeof(real));
+    printf(spec, real);
+    break;
+  default:
+    break;
+  }
+  return sizeof(value);
+}
+
+/**
+ * @brief
+ *      Format and print a record, one conversion at a time
+ */
+static void print_record(const log_record *record) {
+  static const char *const level_names[] = {"DBG", "INF", "WRN", "ERR"};
+  const char *f = record->format;
+  const uint8_t *payload = record->payload;
+  uint8_t nargs = record->nargs;
+  char spec[SPEC_LEN];
+
+  printf("[%lu %s] ", (unsigned long)record->tick, level_names[record->level & 3]);
+  while (*f != '\0') {
+    const char *next = strchr(f, '%');
+    if (next == NULL || nargs == 0) {
+      // once the stored arguments run out the rest is printed as is
+      printf("%s", f);
+      break;
+    }
+    printf("%.*s", (int)(next - f), f);
+    arg_kind kind;
+    uint8_t len = parse_spec(next, &kind);
+    f = next + len;
+    if (kind == ARG_NONE) {
+      printf("%%");
+      continue;
+    }
+    memcpy(spec, next, len);
+    spec[len] = '\0';
+    payload += print_arg(spec, kind, payload);
+    nargs--;
+  }
+  printf("\r\n");
+}
+
+/**
+ * @brief
+ *      Print queued log records
+ * @details
+ *      Runs at the lowest priority so UART output only takes time no other
+ *      task wants
+ * @param void * param
+ *      Not used
+ */
+static void log_drain_task(void *param) {
+  for (;;) {
+    while (log_tail != log_head) {
+      log_record *record = &log_ring[log_tail & (EX2_LOG_RING_LEN - 1)];
+      if (!record->ready) {
+        break;  // still being written
+      }
+      __sync_synchronize();
+      print_record(record);
+      log_tail++;
+    }
+    if (log_dropped > 0) {
+      taskENTER_CRITICAL();
+      uint32_t dropped = log_dropped;
+      log_dropped = 0;
+      taskEXIT_CRITICAL();
+      printf("[%lu log records dropped]\r\n", (unsigned long)dropped);
+    }
+    vTaskDelay(pdMS_TO_TICKS(EX2_LOG_DRAIN_MS));
+  }
+}
+
+/**
+ * @brief
+ *      Start the task that prints the log
+ * @details
+ *      Lines logged before this are printed synchronously
+ * @return SAT_returnState
+ *      success or failure
+ */
+SAT_returnState start_log_drain(void) {
+  if (census_task_create((TaskFunction_t)log_drain_task, "log_drain", EX2_LOG_DRAIN_STACK,
+                         NULL, tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+    return SATR_ERROR;
+  }
+  log_refill_tick = xTaskGetTickCount();
+  log_drain_running = true;
+  return SATR_OK;
+}
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file service_buffers.c
+ * @date 2021-06-28
+ */
+#include "util/service_buffers.h"
+
+#include <FreeRTOS.h>
+#include <os_task.h>
+#include <string.h>
+
+#include "util/service_utilities.h"
+
+static uint16_t pool_size;
+static uint16_t pool_min = UINT16_MAX;
+static service_buffer_tier_stats tier_stats[SERVICE_BUF_TIERS];
+
+/* free buffers each class has to leave in the pool */
+static const uint16_t class_reserve[SERVICE_NUM_CLASSES] = {
+  [SERVICE_CLASS_INTERACTIVE] = SERVICE_BUF_RESERVE_CONTROL,
+  [SERVICE_CLASS_CONTROL] = 0,
+  [SERVICE_CLASS_BULK] = SERVICE_BUF_RESERVE_CONTROL + SERVICE_BUF_RESERVE_INTERACTIVE,
+};
+
+/**
+ * @brief
+ *      Note the size of the CSP pool and check the reserves fit in it
+ * @details
+ *      Called once by start_service_server before any service runs
+ * @return SAT_returnState
+ *      SATR_ERROR if the pool can't hold the reserves and a large buffer
+ */
+SAT_returnState service_buffers_init(void) {
+  int remaining = csp_buffer_remaining();
+  pool_size = (remaining > UINT16_MAX) ? UINT16_MAX : (uint16_t)remaining;
+  pool_min = pool_size;
+  if (pool_size <= SERVICE_BUF_RESERVE_CONTROL + SERVICE_BUF_RESERVE_INTERACTIVE) {
+    ex2_log("CSP pool of %hu buffers can't keep the service reserves\n", pool_size);
+    return SATR_ERROR;
+  }
+  if (csp_buffer_data_size() < SERVICE_BUF_MEDIUM_SIZE) {
+    ex2_log("CSP buffers smaller than SERVICE_BUF_MEDIUM_SIZE\n");
+    return SATR_ERROR;
+  }
+  return SATR_OK;
+}
+
+static service_buffer_tier tier_of(uint16_t size) {
+  if (size <= SERVICE_BUF_SMALL_SIZE) {
+    return SERVICE_BUF_SMALL;
+  }
+  if (size <= SERVICE_BUF_MEDIUM_SIZE) {
+    return SERVICE_BUF_MEDIUM;
+  }
+  return SERVICE_BUF_LARGE;
+}
+
+/**
+ * @brief
+ *      Private. Take a buffer if the pool keeps the reserve of the classes above
+ * @return csp_packet_t*
+ *      NULL if it would eat into the reserve or the pool is empty
+ */
+static csp_packet_t *take_buffer(uint16_t size, uint16_t reserve) {
+  csp_packet_t *packet = NULL;
+  int remaining = csp_buffer_remaining();
+  if (remaining > reserve) {
+    packet = csp_buffer_get(size);
+    if (packet != NULL) {
+      remaining--;
+    }
+  }
+  taskENTER_CRITICAL();
+  if (remaining >= 0 && remaining < pool_min) {
+    pool_min = (uint16_t)remaining;
+  }
+  taskEXIT_CRITICAL();
+  return packet;
+}
+
+/**
+ * @brief
+ *      Get a CSP buffer for a reply of the request being run
+ * @details
+ *      Keeps the reserves of the classes above the request's, waiting up to
+ *      SERVICE_BUF_BULK_WAIT_MS for bulk. Use in place of csp_buffer_get
+ * @param size
+ *      Bytes of packet data needed
+ * @return csp_packet_t*
+ *      The buffer, NULL if none can be had or size is too large
+ */
+csp_packet_t *service_buffer_get(uint16_t size) {
+  service_buffer_tier tier = tier_of(size);
+  uint8_t cls = service_current_class();
+  uint16_t reserve = (cls < SERVICE_NUM_CLASSES) ? class_reserve[cls] : 0;
+  csp_packet_t *packet = NULL;
+
+  if (size <= csp_buffer_data_size()) {
+    packet = take_buffer(size, reserve);
+    TickType_t start = xTaskGetTickCount();
+    while (packet == NULL && cls == SERVICE_CLASS_BULK &&
+           xTaskGetTickCount() - start < pdMS_TO_TICKS(SERVICE_BUF_BULK_WAIT_MS)) {
+      vTaskDelay(1);
+      packet = take_buffer(size, reserve);
+    }
+  }
+
+  taskENTER_CRITICAL();
+  tier_stats[tier].gets++;
+  if (packet == NULL) {
+    tier_stats[tier].failures++;
+  }
+  taskEXIT_CRITICAL();
+  return packet;
+}
+
+/**
+ * @brief
+ *      Copy out the pool and tier counters
+ * @param out
+ *      The counters, in host order
+ */
+void service_buffer_stats_get(service_buffer_stats *out) {
+  int remaining = csp_buffer_remaining();
+  taskENTER_CRITICAL();
+  out->pool = pool_size;
+  out->free_min = pool_min;
+  memcpy(out->tiers, tier_stats, sizeof(tier_stats));
+  taskEXIT_CRITICAL();
+  out->free_now = (remaining > UINT16_MAX) ? UINT16_MAX : (uint16_t)remaining;
+}
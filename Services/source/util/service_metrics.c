@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file service_metrics.c
+ * @date 2020-10-14
+ */
+#include "util/service_metrics.h"
+
+#include <FreeRTOS.h>
+#include <os_task.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Counters for the services actually in use are kept in a small open
+   addressed table instead of MAX_SERVICES * MAX_SUBTYPES of them. Slots are
+   claimed on first use and never released except by metrics_reset */
+typedef struct {
+  uint16_t key;  // 0 if the slot is free
+  service_metrics metrics;
+} metrics_slot;
+
+static metrics_slot metrics_slots[METRICS_SLOTS];
+
+static uint16_t metrics_key(metrics_scope scope, uint8_t port, uint8_t subtype) {
+  // ports are 6 bits, so bit 15 marks the slot used and port 0 is still valid
+  if (scope == METRICS_SERVICE) {
+    return 0x8000 | 0x4000 | port;
+  }
+  return 0x8000 | ((uint16_t)port << 8) | subtype;
+}
+
+/**
+ * @brief
+ *      Find the counters for a key
+ * @attention
+ *      Call inside a critical section
+ * @param create
+ *      Claim a free slot if the key has none
+ * @return service_metrics *
+ *      The counters, NULL if there are none and none could be claimed
+ */
+static service_metrics *find_metrics(uint16_t key, bool create) {
+  uint16_t start = key % METRICS_SLOTS;
+  uint16_t i;
+  for (i = 0; i < METRICS_SLOTS; i++) {
+    metrics_slot *slot = &metrics_slots[(start + i) % METRICS_SLOTS];
+    if (slot->key == key) {
+      return &slot->metrics;
+    }
+    if (slot->key == 0) {
+      if (!create) {
+        return NULL;
+      }
+      slot->key = key;
+      return &slot->metrics;
+    }
+  }
+  return NULL;
+}
+
+static uint8_t latency_bucket(TickType_t ticks) {
+  uint8_t bucket = 0;
+  while (ticks > 0 && bucket < METRICS_LATENCY_BUCKETS - 1) {
+    ticks >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+/**
+ * @brief
+ *      Count one handled packet
+ * @param scope
+ *      Whether these are the counters of the port or of one of its subtypes
+ * @param port
+ *      CSP port the packet arrived on
+ * @param subtype
+ *      Subservice of the packet. Ignored for METRICS_SERVICE
+ * @param state
+ *      What the handler returned
+ * @param ticks
+ *      How long the handler took
+ */
+void metrics_record_request(metrics_scope scope, uint8_t port, uint8_t subtype,
+                            SAT_returnState state, TickType_t ticks) {
+  uint8_t bucket = latency_bucket(ticks);
+  taskENTER_CRITICAL();
+  service_metrics *metrics = find_metrics(metrics_key(scope, port, subtype), true);
+  if (metrics != NULL) {
+    metrics->requests++;
+    if (state != SATR_OK) {
+      metrics->errors++;
+    }
+    if (state == SATR_PKT_ILLEGAL_SUBSERVICE) {
+      metrics->illegal_subservice++;
+    }
+    metrics->latency[bucket]++;
+  }
+  taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief
+ *      Count a failure inside a subservice
+ * @details
+ *      Counted for both the port and the subtype
+ * @param port
+ *      CSP port of the service
+ * @param subtype
+ *      Subservice that failed
+ * @param event
+ *      What failed
+ */
+void metrics_record_event(uint8_t port, uint8_t subtype, metrics_event event) {
+  metrics_scope scope;
+  taskENTER_CRITICAL();
+  for (scope = METRICS_SERVICE; scope <= METRICS_SUBSERVICE; scope++) {
+    service_metrics *metrics = find_metrics(metrics_key(scope, port, subtype), true);
+    if (metrics == NULL) {
+      continue;
+    }
+    if (event == METRIC_ALLOC_FAILURE) {
+      metrics->alloc_failures++;
+    } else {
+      metrics->send_failures++;
+    }
+  }
+  taskEXIT_CRITICAL();
+}
+
+/**
+ * @brief
+ *      Copy the counters of a port or subservice
+ * @param out
+ *      Where to copy them. Zeroed if nothing was recorded yet
+ * @return SAT_returnState
+ *      SATR_ERROR if nothing was recorded for it
+ */
+SAT_returnState metrics_get(metrics_scope scope, uint8_t port, uint8_t subtype,
+                            service_metrics *out) {
+  SAT_returnState state = SATR_OK;
+  taskENTER_CRITICAL();
+  service_metrics *metrics = find_metrics(metrics_key(scope, port, subtype), false);
+  if (metrics != NULL) {
+    *out = *metrics;
+  } else {
+    memset(out, 0, sizeof(*out));
+    state = SATR_ERROR;
+  }
+  taskEXIT_CRITICAL();
+  return state;
+}
+
+/**
+ * @brief
+ *      Forget every counter
+ */
+void metrics_reset(void) {
+  taskENTER_CRITICAL();
+  memset(metrics_slots, 0, sizeof(metrics_slots));
+  taskEXIT_CRITICAL();
+}
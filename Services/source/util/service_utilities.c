@@ -17,6 +17,7 @@
  * @date 2020-06-06
  */
 #include "util/service_utilities.h"
+#include "util/log_ring.h"
 
 #include "printf.h"
 #include <stdarg.h>
@@ -25,17 +26,11 @@
 #include "HL_sci.h"
 #include "os_task.h"
 
-#define PRINT_BUF_LEN 64
-
 void ex2_log(const char *format, ...) {
-    char buffer[PRINT_BUF_LEN] = {0};
     va_list arg;
     va_start(arg, format);
-    vsnprintf(buffer, PRINT_BUF_LEN, format, arg);
+    ex2_log_record(EX2_LOG_INFO, format, arg);
     va_end(arg);
-
-    printf("%s\r\n", buffer);
-    return;
 }
 
 /**
@@ -53,101 +48,33 @@ void set_packet_length(csp_packet_t *packet, uint16_t length) {
   packet->length = length;
 }
 
-/* The following functions convert integer types from one representation to
- * another. Implementation from
+/* The following functions copy values to and from byte buffers in host
+ * order, except cnv8_16 which swaps the two bytes. Interface from
  * https://gitlab.com/librespacefoundation/upsat/upsat-ecss-services
+ * memcpy compiles to a single unaligned load or store. Whole structs are
+ * converted with the generated swaps in wire_endian.h instead
  */
-void cnv32_8(const uint32_t from, uint8_t *to) {
-  union _cnv cnv;
-
-  cnv.cnv32 = from;
-  to[0] = cnv.cnv8[0];
-  to[1] = cnv.cnv8[1];
-  to[2] = cnv.cnv8[2];
-  to[3] = cnv.cnv8[3];
-}
-
-void cnv16_8(const uint16_t from, uint8_t *to) {
-  union _cnv cnv;
+void cnv32_8(const uint32_t from, uint8_t *to) { memcpy(to, &from, sizeof(from)); }
 
-  cnv.cnv16[0] = from;
-  to[0] = cnv.cnv8[0];
-  to[1] = cnv.cnv8[1];
-}
-
-void cnv8_32(uint8_t *from, uint32_t *to) {
-  union _cnv cnv;
+void cnv16_8(const uint16_t from, uint8_t *to) { memcpy(to, &from, sizeof(from)); }
 
-  cnv.cnv8[3] = from[3];
-  cnv.cnv8[2] = from[2];
-  cnv.cnv8[1] = from[1];
-  cnv.cnv8[0] = from[0];
-  *to = cnv.cnv32;
-}
+void cnv8_32(uint8_t *from, uint32_t *to) { memcpy(to, from, sizeof(*to)); }
 
-void cnv8_16LE(uint8_t *from, uint16_t *to) {
-  union _cnv cnv;
-
-  cnv.cnv8[1] = from[1];
-  cnv.cnv8[0] = from[0];
-  *to = cnv.cnv16[0];
-}
+void cnv8_16LE(uint8_t *from, uint16_t *to) { memcpy(to, from, sizeof(*to)); }
 
 void cnv8_16(uint8_t *from, uint16_t *to) {
-  union _cnv cnv;
-
-  cnv.cnv8[1] = from[0];
-  cnv.cnv8[0] = from[1];
-  *to = cnv.cnv16[0];
+  uint16_t value;
+  memcpy(&value, from, sizeof(value));
+  *to = __builtin_bswap16(value);
 }
 
-void cnvF_8(const float from, uint8_t *to) {
-  union _cnv cnv;
-
-  cnv.cnvF = from;
-  to[0] = cnv.cnv8[0];
-  to[1] = cnv.cnv8[1];
-  to[2] = cnv.cnv8[2];
-  to[3] = cnv.cnv8[3];
-}
+void cnvF_8(const float from, uint8_t *to) { memcpy(to, &from, sizeof(from)); }
 
-void cnv8_F(uint8_t *from, float *to) {
-  union _cnv cnv;
-
-  cnv.cnv8[3] = from[3];
-  cnv.cnv8[2] = from[2];
-  cnv.cnv8[1] = from[1];
-  cnv.cnv8[0] = from[0];
-  *to = cnv.cnvF;
-}
+void cnv8_F(uint8_t *from, float *to) { memcpy(to, from, sizeof(*to)); }
 
-void cnvD_8(const double from, uint8_t *to) {
-  union _cnv cnv;
+void cnvD_8(const double from, uint8_t *to) { memcpy(to, &from, sizeof(from)); }
 
-  cnv.cnvD = from;
-  to[0] = cnv.cnv8[0];
-  to[1] = cnv.cnv8[1];
-  to[2] = cnv.cnv8[2];
-  to[3] = cnv.cnv8[3];
-  to[4] = cnv.cnv8[4];
-  to[5] = cnv.cnv8[5];
-  to[6] = cnv.cnv8[6];
-  to[7] = cnv.cnv8[7];
-}
-
-void cnv8_D(uint8_t *from, double *to) {
-  union _cnv cnv;
-
-  cnv.cnv8[7] = from[7];
-  cnv.cnv8[6] = from[6];
-  cnv.cnv8[5] = from[5];
-  cnv.cnv8[4] = from[4];
-  cnv.cnv8[3] = from[3];
-  cnv.cnv8[2] = from[2];
-  cnv.cnv8[1] = from[1];
-  cnv.cnv8[0] = from[0];
-  *to = cnv.cnvD;
-}
+void cnv8_D(uint8_t *from, double *to) { memcpy(to, from, sizeof(*to)); }
 
 uint16_t htons(uint16_t x) {
 #if (SYSTEM_ENDIANESS == SYS_LITTLE_ENDIAN)
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file task_census.c
+ * @date 2020-10-14
+ */
+#include "util/task_census.h"
+
+#include <FreeRTOS.h>
+#include <os_task.h>
+
+#include "util/service_utilities.h"
+
+typedef struct {
+  TaskHandle_t handle;  // NULL if the slot is free
+  const char *name;
+  uint16_t stack_depth;
+} census_task;
+
+static census_task census_tasks[CENSUS_MAX_TASKS];
+
+/**
+ * @brief
+ *      xTaskCreate, remembering the task for the census
+ * @details
+ *      Same arguments and return as xTaskCreate. The task is created even
+ *      if the census is full, it just isn't reported
+ * @param name
+ *      Task name. Must stay valid, so a string literal
+ */
+BaseType_t census_task_create(TaskFunction_t code, const char *name, uint16_t stack_depth,
+                              void *parameters, UBaseType_t priority, TaskHandle_t *handle) {
+  TaskHandle_t task;
+  BaseType_t result = xTaskCreate(code, name, stack_depth, parameters, priority, &task);
+  if (result != pdPASS) {
+    return result;
+  }
+  if (handle != NULL) {
+    *handle = task;
+  }
+
+  int i;
+  taskENTER_CRITICAL();
+  for (i = 0; i < CENSUS_MAX_TASKS && census_tasks[i].handle != NULL; i++)
+    ;
+  if (i < CENSUS_MAX_TASKS) {
+    census_tasks[i].handle = task;
+    census_tasks[i].name = name;
+    census_tasks[i].stack_depth = stack_depth;
+  }
+  taskEXIT_CRITICAL();
+  if (i == CENSUS_MAX_TASKS) {
+    ex2_log("Task census full, %s not counted", name);
+  }
+  return result;
+}
+
+/**
+ * @brief
+ *      Leave the census, then vTaskDelete(NULL)
+ * @details
+ *      A counted task must end this way, its handle is not valid after
+ */
+void census_task_delete_self(void) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  int i;
+  taskENTER_CRITICAL();
+  for (i = 0; i < CENSUS_MAX_TASKS; i++) {
+    if (census_tasks[i].handle == self) {
+      census_tasks[i].handle = NULL;
+    }
+  }
+  taskEXIT_CRITICAL();
+  vTaskDelete(NULL);
+}
+
+/**
+ * @brief
+ *      Number of census slots, used or not
+ */
+uint8_t census_task_count(void) {
+  return CENSUS_MAX_TASKS;
+}
+
+/**
+ * @brief
+ *      Read the stack use of one counted task
+ * @param index
+ *      Census slot, below census_task_count()
+ * @param out
+ *      The task's name, depth and fewest words ever free
+ * @return SAT_returnState
+ *      SATR_ERROR if the slot is unused
+ */
+SAT_returnState census_sample_task(uint8_t index, census_entry *out) {
+  SAT_returnState state = SATR_ERROR;
+  if (index >= CENSUS_MAX_TASKS) {
+    return state;
+  }
+  // the critical section keeps the task from leaving the census meanwhile
+  taskENTER_CRITICAL();
+  census_task *task = &census_tasks[index];
+  if (task->handle != NULL) {
+    out->name = task->name;
+    out->stack_depth = task->stack_depth;
+    out->stack_free = (uint16_t)uxTaskGetStackHighWaterMark(task->handle);
+    state = SATR_OK;
+  }
+  taskEXIT_CRITICAL();
+  return state;
+}
+
+/**
+ * @brief
+ *      Read the FreeRTOS heap use
+ * @param free_now
+ *      Bytes free now
+ * @param free_min
+ *      Fewest bytes ever free. The same as free_now with heaps that
+ *      don't track it
+ */
+void census_heap(uint32_t *free_now, uint32_t *free_min) {
+  *free_now = xPortGetFreeHeapSize();
+#ifndef CENSUS_NO_MIN_EVER_HEAP
+  *free_min = xPortGetMinimumEverFreeHeapSize();
+#else
+  *free_min = *free_now;
+#endif
+}
+
+/**
+ * @brief
+ *      Log the census every CENSUS_LOG_PERIOD_S
+ * @param void * param
+ *      Not used
+ */
+static void census_log_task(void *param) {
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(CENSUS_LOG_PERIOD_S * 1000));
+    uint32_t free_now, free_min;
+    census_heap(&free_now, &free_min);
+    ex2_log("heap free %u min %u", (unsigned)free_now, (unsigned)free_min);
+    uint8_t i;
+    for (i = 0; i < CENSUS_MAX_TASKS; i++) {
+      census_entry entry;
+      if (census_sample_task(i, &entry) == SATR_OK) {
+        ex2_log("%s stack %u free %u", entry.name, entry.stack_depth, entry.stack_free);
+      }
+    }
+  }
+}
+
+/**
+ * @brief
+ *      Start logging the census, if CENSUS_LOG_PERIOD_S is set
+ * @return SAT_returnState
+ *      success or failure
+ */
+SAT_returnState start_task_census(void) {
+  if (CENSUS_LOG_PERIOD_S == 0) {
+    return SATR_OK;
+  }
+  if (census_task_create((TaskFunction_t)census_log_task, "census", CENSUS_TASK_STACK, NULL,
+                         tskIDLE_PRIORITY + 1, NULL) != pdPASS) {
+    return SATR_ERROR;
+  }
+  return SATR_OK;
+}
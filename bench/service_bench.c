@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2015  University of Alberta
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+/**
+ * @file service_bench.c
+ * @date 2020-10-14
+ */
+
+/* Host benchmark of the service handlers, built with `make bench`.
+ *
+ * Handlers are called directly from one task with packets from the real
+ * CSP buffer pool. The link wraps csp_send, csp_conn_dport and
+ * csp_conn_flags so replies are counted and freed instead of sent, and
+ * wraps the allocators so heap use can be reported per request. The
+ * HALs are the stubbed ones selected by the *_IS_STUBBED flags */
+
+#define _POSIX_C_SOURCE 200809L  // clock_gettime
+
+#include <FreeRTOS.h>
+#include <csp/csp.h>
+#include <csp/csp_endian.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <task.h>
+#include <time.h>
+
+#include "communication/communication_service.h"
+#include "general.h"
+#include "housekeeping/housekeeping_service.h"
+#include "services.h"
+#include "time_management/time_management_service.h"
+#include "mocks/rtc.h"
+#include "util/log_ring.h"
+
+#define BENCH_MIX_REQUESTS 20000
+#define BENCH_FETCH_REQUESTS 2000
+#define BENCH_STACK 4096
+#define BENCH_BUF_SIZE 256
+
+/* FAKE CSP */
+typedef struct {
+  uint8_t dport;
+} bench_conn;
+
+static uint32_t sent_packets;
+
+int __wrap_csp_send(csp_conn_t *conn, csp_packet_t *packet, uint32_t timeout) {
+  sent_packets++;
+  csp_buffer_free(packet);
+  return 1;
+}
+
+// services send at their class's priority. libcsp's csp_send_prio calls
+// its own csp_send, which the wrap can't reach, with the fake connection
+int __wrap_csp_send_prio(uint8_t prio, csp_conn_t *conn, csp_packet_t *packet,
+                         uint32_t timeout) {
+  return __wrap_csp_send(conn, packet, timeout);
+}
+
+int __wrap_csp_conn_dport(csp_conn_t *conn) { return ((bench_conn *)conn)->dport; }
+
+int __wrap_csp_conn_flags(csp_conn_t *conn) { return CSP_FRDP; }
+
+/* HEAP ACCOUNTING */
+// every block gets a header holding its size so frees can be counted
+typedef union {
+  size_t size;
+  long double align;
+} alloc_header;
+
+static size_t heap_live;
+static size_t heap_peak;
+static size_t heap_allocated;  // total bytes ever allocated
+
+void *__real_malloc(size_t size);
+void __real_free(void *ptr);
+void *__real_realloc(void *ptr, size_t size);
+
+static void *count_alloc(alloc_header *block, size_t size) {
+  if (block == NULL) {
+    return NULL;
+  }
+  block->size = size;
+  heap_live += size;
+  heap_allocated += size;
+  if (heap_live > heap_peak) {
+    heap_peak = heap_live;
+  }
+  return block + 1;
+}
+
+void *__wrap_malloc(size_t size) {
+  return count_alloc(__real_malloc(sizeof(alloc_header) + size), size);
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  alloc_header *block = (alloc_header *)ptr - 1;
+  heap_live -= block->size;
+  __real_free(block);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return __wrap_malloc(size);
+  }
+  alloc_header *block = (alloc_header *)ptr - 1;
+  size_t old_size = block->size;
+  block = __real_realloc(block, sizeof(alloc_header) + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  heap_live -= old_size;
+  return count_alloc(block, size);
+}
+
+void *__wrap_pvPortMalloc(size_t size) { return __wrap_malloc(size); }
+
+void __wrap_vPortFree(void *ptr) { __wrap_free(ptr); }
+
+/* MEASUREMENT */
+typedef struct {
+  const char *name;
+  uint32_t requests;
+  uint64_t *latency_ns;  // one per request
+  uint64_t total_ns;
+  size_t allocated_before;
+  uint32_t sent_before;
+} bench_run;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void begin_run(bench_run *run, const char *name, uint32_t requests) {
+  run->name = name;
+  run->requests = 0;
+  run->latency_ns = __real_malloc(requests * sizeof(uint64_t));
+  run->total_ns = 0;
+  run->allocated_before = heap_allocated;
+  run->sent_before = sent_packets;
+  heap_peak = heap_live;
+}
+
+static void add_sample(bench_run *run, uint64_t ns) {
+  run->latency_ns[run->requests++] = ns;
+  run->total_ns += ns;
+}
+
+static void end_run(bench_run *run) {
+  if (run->requests == 0) {
+    __real_free(run->latency_ns);
+    return;
+  }
+  qsort(run->latency_ns, run->requests, sizeof(uint64_t), compare_u64);
+  uint64_t p50 = run->latency_ns[run->requests / 2];
+  uint64_t p99 = run->latency_ns[(run->requests * 99) / 100];
+  double seconds = run->total_ns / 1e9;
+  printf("%-28s %8u %12.0f %10.1f %10.1f %10zu %10.1f %8u\n", run->name, run->requests,
+         seconds > 0 ? run->requests / seconds : 0.0, p50 / 1e3, p99 / 1e3, heap_peak,
+         (double)(heap_allocated - run->allocated_before) / run->requests,
+         sent_packets - run->sent_before);
+  __real_free(run->latency_ns);
+}
+
+/* REQUESTS */
+typedef SAT_returnState (*bench_handler)(csp_conn_t *conn, csp_packet_t *packet);
+
+static uint64_t run_request(bench_handler handler, uint8_t port, uint8_t subtype,
+                            const void *args, uint16_t args_len) {
+  bench_conn conn = {port};
+  csp_packet_t *packet = csp_buffer_get(BENCH_BUF_SIZE);
+  if (packet == NULL) {
+    printf("CSP buffer pool exhausted\n");
+    exit(1);
+  }
+  packet->id.src = SERVICE_PRIVILEGED_SRC;
+  packet->id.dport = port;
+  packet->data[SUBSERVICE_BYTE] = subtype;
+  memcpy(&packet->data[IN_DATA_BYTE], args, args_len);
+  packet->length = IN_DATA_BYTE + args_len;
+
+  uint64_t start = now_ns();
+  handler((csp_conn_t *)&conn, packet);
+  return now_ns() - start;
+}
+
+typedef struct {
+  bench_handler handler;
+  uint8_t port;
+  uint8_t subtype;
+  uint8_t args[8];
+  uint16_t args_len;
+  uint8_t weight;
+} mix_entry;
+
+/* a ground pass worth of mostly small reads */
+static const mix_entry command_mix[] = {
+  {time_management_handler, TC_TIME_MANAGEMENT_SERVICE, GET_TIME, {0}, 0, 4},
+  {hk_service_app, TC_HOUSEKEEPING_SERVICE, GET_MAX_FILES, {0}, 0, 2},
+  {hk_service_app, TC_HOUSEKEEPING_SERVICE, GET_HK_PERIODS, {0}, 0, 2},
+  {communication_service_handler, TC_COMMUNICATION_SERVICE, S_GET_FREQ, {0}, 0, 2},
+  {communication_service_handler, TC_COMMUNICATION_SERVICE, UHF_GET_FULL_STAT, {0}, 0, 1},
+  {general_handler, TC_GENERAL_SERVICE, GET_METRICS,
+   {TC_HOUSEKEEPING_SERVICE, 0, 0}, 3, 1},
+};
+
+static void bench_command_mix(void) {
+  uint16_t total_weight = 0;
+  uint32_t i;
+  for (i = 0; i < TABLE_LEN(command_mix); i++) {
+    total_weight += command_mix[i].weight;
+  }
+
+  bench_run run;
+  begin_run(&run, "command mix", BENCH_MIX_REQUESTS);
+  for (i = 0; i < BENCH_MIX_REQUESTS; i++) {
+    int pick = rand() % total_weight;
+    const mix_entry *entry = command_mix;
+    while (pick >= entry->weight) {
+      pick -= entry->weight;
+      entry++;
+    }
+    add_sample(&run, run_request(entry->handler, entry->port, entry->subtype, entry->args,
+                                 entry->args_len));
+  }
+  end_run(&run);
+}
+
+// GET_HK reads its arguments as the 16 bit words following the subservice,
+// so before_time only has 16 bits
+static uint64_t get_hk(uint16_t limit, uint16_t before_id, uint16_t before_time) {
+  uint16_t args[4] = {0, limit, before_id, before_time};
+  // args[0] holds the subservice byte and the first byte is skipped
+  return run_request(hk_service_app, TC_HOUSEKEEPING_SERVICE, GET_HK, (uint8_t *)args + 1,
+                     sizeof(args) - 1);
+}
+
+static uint64_t get_hk_range(uint32_t start, uint32_t end, uint32_t stride_s, uint8_t fields,
+                             uint16_t limit) {
+  uint8_t args[17];
+  uint32_t word;
+  uint16_t half;
+  word = csp_hton32(start);
+  memcpy(&args[0], &word, sizeof(word));
+  word = csp_hton32(end);
+  memcpy(&args[4], &word, sizeof(word));
+  word = csp_hton32(stride_s);
+  memcpy(&args[8], &word, sizeof(word));
+  half = csp_hton16(limit);
+  memcpy(&args[12], &half, sizeof(half));
+  half = 0;  // largest buffer
+  memcpy(&args[14], &half, sizeof(half));
+  args[16] = fields;
+  return run_request(hk_service_app, TC_HOUSEKEEPING_SERVICE, GET_HK_RANGE, args, sizeof(args));
+}
+
+static void bench_hk_storage(uint16_t max_files) {
+  char name[48];
+  bench_run run;
+  uint32_t i;
+
+  set_max_files(max_files);
+
+  snprintf(name, sizeof(name), "hk store (%u files)", max_files);
+  begin_run(&run, name, max_files);
+  for (i = 0; i < max_files; i++) {
+    uint64_t start = now_ns();
+    populate_and_store_hk_data();
+    add_sample(&run, now_ns() - start);
+  }
+  end_run(&run);
+
+  snprintf(name, sizeof(name), "hk fetch by id (%u)", max_files);
+  begin_run(&run, name, BENCH_FETCH_REQUESTS);
+  for (i = 0; i < BENCH_FETCH_REQUESTS; i++) {
+    add_sample(&run, get_hk(1, 1 + rand() % max_files, 0));
+  }
+  end_run(&run);
+
+  snprintf(name, sizeof(name), "hk fetch by time (%u)", max_files);
+  begin_run(&run, name, BENCH_FETCH_REQUESTS);
+  uint32_t now;
+  mock_RTC_get_unix_time(&now);
+  for (i = 0; i < BENCH_FETCH_REQUESTS; i++) {
+    add_sample(&run, get_hk(1, 0, (uint16_t)(now - rand() % 60)));
+  }
+  end_run(&run);
+
+  // stores in a run share a few seconds, so this is mostly the index search
+  snprintf(name, sizeof(name), "hk range eps (%u)", max_files);
+  begin_run(&run, name, BENCH_FETCH_REQUESTS);
+  for (i = 0; i < BENCH_FETCH_REQUESTS; i++) {
+    add_sample(&run, get_hk_range(now - 60, 0, 0, 1 << HK_EPS, 100));
+  }
+  end_run(&run);
+
+  // shrinking discards the ring, so there is one sample per size
+  snprintf(name, sizeof(name), "hk shrink %u -> %u", max_files, max_files / 2);
+  begin_run(&run, name, 1);
+  uint64_t start = now_ns();
+  set_max_files(max_files / 2);
+  add_sample(&run, now_ns() - start);
+  end_run(&run);
+}
+
+static void bench_task(void *param) {
+  // sampling would compete with the measured requests
+  int source;
+  for (source = 0; source < HK_NUM_SOURCES; source++) {
+    set_hk_period(source, 0);
+  }
+  ex2_log_set_level(EX2_LOG_ERROR);
+
+  printf("%-28s %8s %12s %10s %10s %10s %10s %8s\n", "workload", "requests", "req/s",
+         "p50 us", "p99 us", "heap peak", "B alloc/rq", "replies");
+  bench_command_mix();
+  bench_hk_storage(500);
+  bench_hk_storage(5000);
+  exit(0);
+}
+
+int main(int argc, char **argv) {
+  csp_conf_t csp_conf;
+  csp_conf_get_defaults(&csp_conf);
+  csp_conf.address = DEMO_APP_ID;
+  csp_conf.buffer_data_size = BENCH_BUF_SIZE;
+  if (csp_init(&csp_conf) != CSP_ERR_NONE) {
+    printf("csp_init() failed\n");
+    return -1;
+  }
+  srand(1);
+
+  if (start_housekeeping_service() != SATR_OK) {
+    printf("Failed to start housekeeping\n");
+    return -1;
+  }
+  xTaskCreate((TaskFunction_t)bench_task, "bench", BENCH_STACK, NULL, configMAX_PRIORITIES - 1,
+              NULL);
+  vTaskStartScheduler();
+  return 0;
+}
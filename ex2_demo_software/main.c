@@ -20,12 +20,17 @@
 #include <FreeRTOS.h>
 #include <csp/csp.h>
 #include <csp/interfaces/csp_if_zmqhub.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <packet_ring.h>
+#include <poll.h>
 #include <service_utilities.h>
+#include <task_census.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <task.h>
 #include <unistd.h>
 
@@ -49,9 +54,16 @@
 
 
 /* FIFO INTERFACE */
-pthread_t rx_thread;
+pthread_t rx_thread, tx_thread;
 int rx_channel, tx_channel;
 #define BUF_SIZE    250
+#define RX_RING_LEN 16  // power of 2
+#define RX_BATCH    8   // most frames read per wakeup
+#define RX_POLL_MS  100
+#define TX_RING_LEN 32  // power of 2
+#define TX_BATCH    8   // most frames per writev
+#define TX_POLL_US  500
+#define TX_MAX_LATENCY_US 2000  // longest a frame waits for a batch to fill
 
 int csp_fifo_tx(const csp_route_t * ifroute, csp_packet_t *packet);
 void vAssertCalled(unsigned long ulLine, const char *const pcFileName);
@@ -62,25 +74,153 @@ csp_iface_t csp_if_fifo = {
     .mtu = BUF_SIZE,
 };
 
+/* The FIFO is read by a plain thread blocked in poll(), since a blocking
+   read can't be done from a task. CSP buffers can only be handled by
+   tasks, so the fifo_rx task keeps free_ring stocked with empty buffers
+   and routes the frames the thread puts in rx_ring */
+static csp_packet_t *rx_slots[RX_RING_LEN];
+static csp_packet_t *free_slots[RX_RING_LEN];
+static packet_ring_t rx_ring;    // received frames, thread to task
+static packet_ring_t free_ring;  // empty buffers, task to thread
+
+/* Outgoing frames are queued by csp_fifo_tx and written in batches by a
+   second thread with one writev. Written buffers go back through
+   sent_ring for the fifo_rx task to free */
+static csp_packet_t *tx_slots[TX_RING_LEN];
+static csp_packet_t *sent_slots[TX_RING_LEN];
+static packet_ring_t tx_ring;    // frames to write, tasks to thread
+static packet_ring_t sent_ring;  // written frames, thread to task
+
+static struct {
+    volatile uint32_t frames;        // frames written
+    volatile uint32_t bytes;         // bytes written
+    volatile uint32_t busy;          // frames refused because tx_ring was full
+    volatile uint32_t write_errors;  // frames lost to failed writes
+} fifo_tx_stats;
+
 int csp_fifo_tx(const csp_route_t * ifroute, csp_packet_t *packet) {
-    /* Write packet to fifo */
-    if (write(tx_channel, &packet->length, packet->length + sizeof(uint32_t) + sizeof(uint16_t)) < 0)
-        printf("Failed to write frame\r\n");
-    csp_buffer_free(packet);
+    bool queued;
+    // any task may send, the critical section makes them a single producer
+    taskENTER_CRITICAL();
+    queued = packet_ring_push(&tx_ring, packet);
+    taskEXIT_CRITICAL();
+    if (!queued) {
+        // the packet is still the caller's, csp_send fails and it may retry
+        fifo_tx_stats.busy++;
+        return CSP_ERR_BUSY;
+    }
     return CSP_ERR_NONE;
 }
 
+static inline size_t fifo_frame_len(const csp_packet_t *packet) {
+    return packet->length + sizeof(uint32_t) + sizeof(uint16_t);
+}
+
+// writev until every byte is written or the write fails
+static int writev_all(int fd, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+static void *fifo_tx_thread(void *parameters) {
+    csp_packet_t *batch[TX_BATCH];
+    struct iovec iov[TX_BATCH];
+    unsigned waited = 0;
+    for (;;) {
+      uint16_t queued = packet_ring_count(&tx_ring);
+      if (queued == 0 || (queued < TX_BATCH && waited < TX_MAX_LATENCY_US)) {
+        usleep(TX_POLL_US);
+        waited = queued == 0 ? 0 : waited + TX_POLL_US;
+        continue;
+      }
+      waited = 0;
+
+      int frames = 0;
+      size_t bytes = 0;
+      while (frames < TX_BATCH && (batch[frames] = packet_ring_pop(&tx_ring)) != NULL) {
+        /* Write packet to fifo */
+        iov[frames].iov_base = &batch[frames]->length;
+        iov[frames].iov_len = fifo_frame_len(batch[frames]);
+        bytes += iov[frames].iov_len;
+        frames++;
+      }
+      if (writev_all(tx_channel, iov, frames) < 0) {
+        printf("Failed to write %d frames\r\n", frames);
+        fifo_tx_stats.write_errors += frames;
+      } else {
+        fifo_tx_stats.frames += frames;
+        fifo_tx_stats.bytes += bytes;
+      }
+
+      int i;
+      for (i = 0; i < frames; i++) {
+        while (!packet_ring_push(&sent_ring, batch[i])) {
+          usleep(TX_POLL_US); // wait for the task to free some
+        }
+      }
+    }
+    return NULL;
+}
+
+static void *fifo_rx_thread(void *parameters) {
+    struct pollfd fds = {.fd = rx_channel, .events = POLLIN};
+    csp_packet_t *buf = NULL;
+    for (;;) {
+      /* Wait for packet on fifo */
+      if (poll(&fds, 1, RX_POLL_MS) <= 0) {
+        continue;
+      }
+      int frames;
+      for (frames = 0; frames < RX_BATCH; frames++) {
+        if (buf == NULL && (buf = packet_ring_pop(&free_ring)) == NULL) {
+          break; // the task hasn't stocked buffers yet, leave the rest in the fifo
+        }
+        if (read(rx_channel, &buf->length, BUF_SIZE) <= 0) {
+          break;
+        }
+        if (!packet_ring_push(&rx_ring, buf)) {
+          break; // can't happen, there are no more buffers than slots
+        }
+        buf = NULL;
+      }
+    }
+    return NULL;
+}
+
+// routes received frames and does the buffer handling of both threads
 void fifo_rx(void * parameters) {
-    csp_packet_t *buf = csp_buffer_get(BUF_SIZE);
-    /* Wait for packet on fifo */
+    csp_packet_t *buf;
     for (;;) {
-      while (read(rx_channel, &buf->length, BUF_SIZE) > 0) {
+      while ((buf = packet_ring_pop(&rx_ring)) != NULL) {
         csp_qfifo_write(buf, &csp_if_fifo, NULL);
-        buf = csp_buffer_get(BUF_SIZE);
       }
-      vTaskDelay(500);
+      while ((buf = packet_ring_pop(&sent_ring)) != NULL) {
+        csp_buffer_free(buf);
+      }
+      // every buffer is either stocked, held by the thread or in rx_ring
+      while (packet_ring_count(&free_ring) + packet_ring_count(&rx_ring) < RX_RING_LEN - 1 &&
+             (buf = csp_buffer_get(BUF_SIZE)) != NULL) {
+        packet_ring_push(&free_ring, buf);
+      }
+      vTaskDelay(1);
     }
-    return NULL;
 }
 /** FIFO INTERFACE ENDS **/
 
@@ -119,13 +259,25 @@ int main(int argc, char **argv) {
       return -1;
   }
 
-  rx_channel = open(rx_channel_name, O_RDWR);
+  rx_channel = open(rx_channel_name, O_RDWR | O_NONBLOCK);
   if (rx_channel < 0) {
       printf("Failed to open RX channel\r\n");
       return -1;
   }
-  xTaskCreate((TaskFunction_t)fifo_rx, "fifo rx", 128, NULL,
-                  configMAX_PRIORITIES - 1, NULL);
+  packet_ring_init(&rx_ring, rx_slots, RX_RING_LEN);
+  packet_ring_init(&free_ring, free_slots, RX_RING_LEN);
+  packet_ring_init(&tx_ring, tx_slots, TX_RING_LEN);
+  packet_ring_init(&sent_ring, sent_slots, TX_RING_LEN);
+  census_task_create((TaskFunction_t)fifo_rx, "fifo rx", 128, NULL,
+                     configMAX_PRIORITIES - 1, NULL);
+  if (pthread_create(&rx_thread, NULL, fifo_rx_thread, NULL) != 0) {
+      printf("Failed to start RX thread\r\n");
+      return -1;
+  }
+  if (pthread_create(&tx_thread, NULL, fifo_tx_thread, NULL) != 0) {
+      printf("Failed to start TX thread\r\n");
+      return -1;
+  }
   ex2_log("Running at %d\n", my_address);
   /* Set default route and start router & server */
   csp_route_set(CSP_DEFAULT_ROUTE, &csp_if_fifo, CSP_NODE_MAC);
@@ -144,8 +296,7 @@ int main(int argc, char **argv) {
   csp_route_print_table();
 
   /* START ALL SERVICES YOU WANT TO TEST HERE */
-  if (start_time_management_service() != SATR_OK ||
-    start_communication_service() != SATR_OK) {
+  if (start_service_server() != SATR_OK) {
     ex2_log("Initialization error\n");
     return -1;
   }